@@ -0,0 +1,73 @@
+#include "Kaey/Renderer/ThreadPool.hpp"
+#include "Kaey/Renderer/Utility.hpp"
+
+#include "MeshTopology.hpp"
+
+using namespace Kaey::Renderer;
+using namespace Kaey;
+
+namespace
+{
+    //Triangulated grid of 'size' by 'size' quads, rows are shuffled so the points of a face are far apart like in real meshes.
+    vector<u32> GridCorners(u32 size)
+    {
+        auto rows = vector<u32>(size + 1);
+        std::iota(rows.begin(), rows.end(), 0u);
+        std::shuffle(rows.begin(), rows.end(), std::mt19937(42));
+        auto point = [&](u32 x, u32 y) { return rows[y] * (size + 1) + x; };
+        vector<u32> corners;
+        corners.reserve(size_t(size) * size * 6);
+        for (u32 y = 0; y < size; ++y)
+        for (u32 x = 0; x < size; ++x)
+        {
+            corners.insert(corners.end(), { point(x, y), point(x + 1, y), point(x, y + 1) });
+            corners.insert(corners.end(), { point(x + 1, y), point(x + 1, y + 1), point(x, y + 1) });
+        }
+        return corners;
+    }
+
+    //Best of 'runs', in milliseconds.
+    f64 Time(u32 runs, auto&& fn)
+    {
+        auto best = std::numeric_limits<f64>::max();
+        for (u32 i = 0; i < runs; ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            best = std::min(best, std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        return best;
+    }
+
+    void BenchPointFaces(ThreadPool* threadPool)
+    {
+        for (u32 size : { 64u, 256u, 1024u, 2048u })
+        {
+            auto corners = GridCorners(size);
+            auto pointCount = (size + 1) * (size + 1);
+            vector<u32> serialLists(pointCount + 1), serialFaces(corners.size());
+            vector<u32> pooledLists(pointCount + 1), pooledFaces(corners.size());
+            auto serial = Time(5, [&] { BuildPointFaces<u32, u32>(corners, 3, serialLists, serialFaces); });
+            auto pooled = Time(5, [&] { BuildPointFaces<u32, u32>(corners, 3, pooledLists, pooledFaces, threadPool); });
+            if (serialLists != pooledLists || serialFaces != pooledFaces)
+                throw runtime_error("BuildPointFaces gave different results on the thread pool for a {}x{} grid!"_f(size, size));
+            std::cout << "BuildPointFaces {:>10} corners: {:>9.3f} ms serial, {:>9.3f} ms on the pool\n"_f(corners.size(), serial, pooled);
+        }
+    }
+
+}
+
+int main()
+{
+    try
+    {
+        auto threadPool = ThreadPool();
+        BenchPointFaces(&threadPool);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
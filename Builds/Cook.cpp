@@ -0,0 +1,486 @@
+#include "Kaey/Renderer/ThreadPool.hpp"
+#include "Kaey/Renderer/Utility.hpp"
+
+#include "MeshFile.hpp"
+#include "MeshTopology.hpp"
+#include "ObjFile.hpp"
+#include "TextureFile.hpp"
+
+#include <print>
+
+using namespace Kaey::Renderer;
+using namespace Kaey;
+
+using enum MeshAttributeDomain;
+using enum MeshAttributeType;
+using enum MeshRotationMode;
+
+namespace
+{
+    //Bump whenever the cooked output changes, so everything gets cooked again.
+    constexpr u32 CookerVersion = 11;
+
+    constexpr string_view CookedExtension = ".ksc";
+    constexpr string_view KeyExtension    = ".key";
+
+    u64 HashBytes(cspan<u8> bytes, u64 seed)
+    {
+        constexpr u64 Prime = 0x9E3779B97F4A7C15ull;
+        auto h = seed ^ (bytes.size() * Prime);
+        auto mix = [&](u64 v)
+        {
+            v *= Prime;
+            v ^= v >> 29;
+            h = (h ^ v) * Prime;
+        };
+        auto words = bytes.size() / sizeof(u64);
+        for (auto i : irange(words))
+        {
+            u64 v;
+            std::memcpy(&v, bytes.data() + i * sizeof(u64), sizeof(v));
+            mix(v);
+        }
+        //An empty span may have no data to copy from.
+        u64 tail = 0;
+        if (auto rest = bytes.size() % sizeof(u64))
+            std::memcpy(&tail, bytes.data() + words * sizeof(u64), rest);
+        mix(tail);
+        return h ^ (h >> 32);
+    }
+
+    Vector3 Cross(const Vector3& a, const Vector3& b)
+    {
+        return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+    }
+
+    Vector3 SafeNormalized(const Vector3& v)
+    {
+        auto sq = v.x * v.x + v.y * v.y + v.z * v.z;
+        return sq > 0 ? v * (1 / std::sqrt(sq)) : Vector3{ 0, 0, 0 };
+    }
+
+    Vector3F16 ToF16(const Vector3& v)
+    {
+        return { (f16)v.x, (f16)v.y, (f16)v.z };
+    }
+
+    template<class T>
+    MeshFileAttribute MakeAttribute(string_view name, MeshAttributeDomain domain, MeshAttributeType type, cspan<T> values)
+    {
+        auto bytes = span((const u8*)values.data(), values.size_bytes()) | to_vector;
+        return { string(name), domain, type, move(bytes), {} };
+    }
+
+    ObjectInstance MakeObject(string name, u32 dataIndex, Vector3 location = { 0, 0, 0 }, Quaternion rotation = Quaternion::Identity, Vector3 scale = { 1, 1, 1 })
+    {
+        return
+        {
+            .Name            = move(name),
+            .DataIndex       = dataIndex,
+            .Location        = location,
+            .RotationMode    = Quat,
+            .Rotation        = { 0, 0, 0 },
+            .RotationQuat    = rotation,
+            .Scale           = scale,
+            .ViewportDisplay = {},
+        };
+    }
+
+    unique_ptr<Collection> MakeCollection(string name, vector<u32> objectIds)
+    {
+        auto col = make_unique<Collection>(Collection{ .Name = move(name), .Children = {}, .ObjectIds = move(objectIds), .Flags = {}, });
+        col->ViewLayerEnabled = true;
+        col->SelectionEnabled = true;
+        col->ViewportEnabled  = true;
+        col->RenderEnabled    = true;
+        return col;
+    }
+
+    //Parsed without a thread pool, as cooking already runs one file per task.
+    SceneFile ImportObj(crpath path)
+    {
+        SceneFile sf;
+        for (auto& mesh : LoadObjFile(path))
+        {
+            auto pointCount = (u32)mesh.Positions.size();
+            auto cornerCount = (u32)mesh.PointsOfCorners.size();
+            auto& mf = sf.Meshes.emplace_back(mesh.Name, pointCount, 0, cornerCount / 3, cornerCount);
+            mf.Attributes.emplace_back(MakeAttribute<Vector3>("position", Point, Vec3, mesh.Positions));
+            mf.Attributes.emplace_back(MakeAttribute<u32>(".corner_vert", Corner, UInt32, mesh.PointsOfCorners));
+            if (!mesh.Uvs.empty())
+            {
+                mf.UvIndices.emplace_back((u32)mf.Attributes.size());
+                mf.Attributes.emplace_back(MakeAttribute<Vector2F16>("UVMap", Corner, Vec2F16, mesh.Uvs));
+            }
+            sf.Objects.emplace_back(MakeObject(mesh.Name, (u32)sf.Meshes.size() - 1));
+        }
+        sf.Collection = MakeCollection(path.stem().string(), irange((u32)sf.Objects.size()) | to_vector);
+        return sf;
+    }
+
+    template<class T>
+    vector<T> ReadAccessor(const tinygltf::Model& model, int index)
+    {
+        auto& accessor = model.accessors[index];
+        vector<T> values(accessor.count);
+        if (accessor.count == 0 || accessor.bufferView == -1)
+            return values;
+        auto& bv = model.bufferViews[accessor.bufferView];
+        auto& buf = model.buffers[bv.buffer];
+        auto stride = (size_t)accessor.ByteStride(bv);
+        auto src = buf.data.data() + bv.byteOffset + accessor.byteOffset;
+        for (auto [i, v] : values | indexed)
+            std::memcpy(&v, src + stride * i, sizeof(T));
+        return values;
+    }
+
+    vector<u32> ReadIndices(const tinygltf::Model& model, int index)
+    {
+        auto& accessor = model.accessors[index];
+        auto widen = [](auto v) { return v | vs::transform([](auto i) { return (u32)i; }) | to_vector; };
+        switch (accessor.componentType)
+        {
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:  return widen(ReadAccessor<u8>(model, index));
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: return widen(ReadAccessor<u16>(model, index));
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:   return ReadAccessor<u32>(model, index);
+        default: throw runtime_error("Invalid index component type: {}"_f(accessor.componentType));
+        }
+    }
+
+    //Primitives of a mesh are merged, each one becomes a material range. Only triangle lists are supported.
+    MeshFile ImportGltfMesh(const tinygltf::Model& model, const tinygltf::Mesh& mesh)
+    {
+        auto mirror = [](Vector3 v) -> Vector3 { return { -v.x, v.y, v.z }; };
+        vector<Vector3> positions;
+        vector<u32> pointsOfCorners;
+        vector<Vector2F16> uvs;
+        vector<vector<Vector3>> shapes(mesh.weights.size());
+        vector<MeshFileMaterialRange> materials;
+        auto hasUvs = rn::all_of(mesh.primitives, [](auto& p) { return p.attributes.contains("TEXCOORD_0"); });
+        for (auto& primitive : mesh.primitives)
+        {
+            if (primitive.mode != TINYGLTF_MODE_TRIANGLES && primitive.mode != -1)
+                throw runtime_error("Unsupported primitive mode in mesh '{}': {}"_f(mesh.name, primitive.mode));
+            auto base = (u32)positions.size();
+            auto points = ReadAccessor<Vector3>(model, primitive.attributes.at("POSITION"));
+            auto indices = primitive.indices != -1 ? ReadIndices(model, primitive.indices) : irange((u32)points.size()) | to_vector;
+            materials.emplace_back((u32)std::max(primitive.material, 0), (u32)pointsOfCorners.size() / 3, (u32)indices.size() / 3);
+            for (auto i : indices)
+                pointsOfCorners.emplace_back(base + i);
+            if (hasUvs)
+            {
+                auto pointUvs = ReadAccessor<Vector2>(model, primitive.attributes.at("TEXCOORD_0"));
+                for (auto i : indices)
+                    uvs.emplace_back((f16)pointUvs[i].x, (f16)pointUvs[i].y);
+            }
+            for (auto [s, shape] : shapes | indexed)
+            {
+                auto deltas = s < primitive.targets.size() && primitive.targets[s].contains("POSITION") ? ReadAccessor<Vector3>(model, primitive.targets[s].at("POSITION")) : vector<Vector3>(points.size(), Vector3{ 0, 0, 0 });
+                for (auto [i, p] : points | indexed)
+                    shape.emplace_back(mirror(p + deltas[i]));
+            }
+            for (auto& p : points)
+                positions.emplace_back(mirror(p));
+        }
+        auto pointCount = (u32)positions.size();
+        auto cornerCount = (u32)pointsOfCorners.size();
+        MeshFile mf{ mesh.name, pointCount, 0, cornerCount / 3, cornerCount, {}, {}, move(materials) };
+        auto& pos = mf.Attributes.emplace_back(MakeAttribute<Vector3>("position", Point, Vec3, positions));
+        if (!shapes.empty())
+        {
+            pos.Morphs.emplace_back("Basis", "Basis", 0.f, 0.f, 1.f, pos.Buffer);
+            for (auto [s, shape] : shapes | indexed)
+            {
+                auto name = "Key {}"_f(s);
+                pos.Morphs.emplace_back(MakePositionMorph(name, "Basis", (f32)mesh.weights[s], 0.f, 1.f, positions, shape));
+            }
+        }
+        mf.Attributes.emplace_back(MakeAttribute<u32>(".corner_vert", Corner, UInt32, pointsOfCorners));
+        if (hasUvs)
+        {
+            mf.UvIndices.emplace_back((u32)mf.Attributes.size());
+            mf.Attributes.emplace_back(MakeAttribute<Vector2F16>("UVMap", Corner, Vec2F16, uvs));
+        }
+        return mf;
+    }
+
+    SceneFile ImportGltf(crpath path)
+    {
+        tinygltf::TinyGLTF loader;
+        tinygltf::Model model;
+        string err, warn;
+        auto res = path.extension() == ".glb" ? loader.LoadBinaryFromFile(&model, &err, &warn, path.string()) : loader.LoadASCIIFromFile(&model, &err, &warn, path.string());
+        if (!res)
+            throw runtime_error("Failed to parse '{}': {}"_f(path.string(), err));
+
+        SceneFile sf;
+        sf.Meshes = model.meshes | vs::transform([&](auto& mesh) { return ImportGltfMesh(model, mesh); }) | to_vector;
+        sf.Materials = model.materials | vs::transform([](auto& mat) { return MeshFileMaterial{ mat.name }; }) | to_vector;
+
+        //Node transforms are taken as they are, matrices and parent transforms aren't applied.
+        auto scene = model.defaultScene != -1 ? model.defaultScene : 0;
+        if (scene < (int)model.scenes.size())
+            rn::for_each(model.scenes[scene].nodes, [&](this auto& self, int nodeId) -> void
+            {
+                auto& node = model.nodes[nodeId];
+                if (node.mesh != -1)
+                {
+                    cspan<double> v;
+                    auto location = (v = node.translation).empty() ? Vector3{ 0, 0, 0 }  : Vector3   {-f32(v[0]), f32(v[1]), f32(v[2]) };
+                    auto rotation = (v = node.rotation   ).empty() ? Quaternion::Identity : Quaternion{-f32(v[0]), f32(v[1]), f32(v[2]), f32(v[3]) };
+                    auto scale    = (v = node.scale      ).empty() ? Vector3{ 1, 1, 1 }  : Vector3   { f32(v[0]), f32(v[1]), f32(v[2]) };
+                    sf.Objects.emplace_back(MakeObject(node.name, (u32)node.mesh, location, rotation, scale));
+                }
+                rn::for_each(node.children, self);
+            });
+        sf.Collection = MakeCollection(path.stem().string(), irange((u32)sf.Objects.size()) | to_vector);
+        return sf;
+    }
+
+    SceneFile Import(crpath path)
+    {
+        auto ext = path.extension();
+        return
+            ext == CookedExtension            ? SceneFile::Load(path) :
+            ext == ".obj"                     ? ImportObj(path) :
+            ext == ".glb" || ext == ".gltf"   ? ImportGltf(path) :
+            throw runtime_error("Unsupported file extension: '{}'"_f(ext.string()));
+    }
+
+    const MeshFileAttribute* FindAttribute(const MeshFile& mf, string_view name)
+    {
+        auto it = rn::find_if(mf.Attributes, [&](auto& at) { return at.Name == name; });
+        return it != mf.Attributes.end() ? &*it : nullptr;
+    }
+
+    //Computes what MeshData3D would otherwise build at load time, with the same layouts.
+    void Bake(MeshFile& mf)
+    {
+        if (mf.FaceCount == 0 || FindAttribute(mf, CookedFaceList))
+            return;
+        auto pos = FindAttribute(mf, "position");
+        auto cvs = FindAttribute(mf, ".corner_vert");
+        if (!pos || !cvs || pos->Type != Vec3)
+            throw runtime_error("Mesh '{}' is missing its position or .corner_vert attributes."_f(mf.Name));
+
+        auto cornerPerFace = mf.CornerCount / mf.FaceCount;
+        auto positions = span((const Vector3*)pos->Buffer.data(), mf.PointCount);
+        auto pointsOfCorners = cvs->Type == UInt32
+            ? span((const u32*)cvs->Buffer.data(), mf.CornerCount) | to_vector
+            : span((const u16*)cvs->Buffer.data(), mf.CornerCount) | vs::transform([](u16 i) { return (u32)i; }) | to_vector;
+
+        vector<u32> faceList(mf.PointCount + 1);
+        vector<u32> faceIndices(mf.CornerCount);
+        BuildPointFaces<u32, u32>(pointsOfCorners, cornerPerFace, faceList, faceIndices);
+
+        vector<Vector3> faceNormals(mf.FaceCount);
+        for (auto [face, n] : faceNormals | uindexed32)
+        {
+            auto corners = span(pointsOfCorners).subspan(face * cornerPerFace, cornerPerFace);
+            auto sum = Vector3{ 0, 0, 0 };
+            for (auto i : irange(cornerPerFace))
+                sum = sum + Cross(positions[corners[i]], positions[corners[(i + 1) % cornerPerFace]]);
+            n = SafeNormalized(sum);
+        }
+
+        vector<Vector3> pointNormals(mf.PointCount, Vector3{ 0, 0, 0 });
+        for (auto p : irange(mf.PointCount))
+        {
+            auto sum = Vector3{ 0, 0, 0 };
+            for (auto i = faceList[p]; i < faceList[p + 1]; ++i)
+                sum = sum + faceNormals[faceIndices[i]];
+            pointNormals[p] = SafeNormalized(sum);
+        }
+
+        auto f16Of = [](auto& v) { return v | vs::transform(ToF16) | to_vector; };
+        mf.Attributes.emplace_back(MakeAttribute<u32>(CookedFaceList, Point, UInt32, faceList));
+        if (mf.FaceCount <= UINT16_MAX)
+        {
+            auto narrow = faceIndices | vs::transform([](u32 i) { return (u16)i; }) | to_vector;
+            mf.Attributes.emplace_back(MakeAttribute<u16>(CookedFaceIndex, Point, UInt16, narrow));
+        }
+        else mf.Attributes.emplace_back(MakeAttribute<u32>(CookedFaceIndex, Point, UInt32, faceIndices));
+        mf.Attributes.emplace_back(MakeAttribute<Vector3F16>(CookedFaceNormal, Face, Vec3F16, f16Of(faceNormals)));
+        mf.Attributes.emplace_back(MakeAttribute<Vector3F16>(CookedPointNormal, Point, Vec3F16, f16Of(pointNormals)));
+
+        vector<MeshFileAttribute> tangentAttributes;
+        for (auto uvIndex : mf.UvIndices)
+        {
+            auto& uvAt = mf.Attributes[uvIndex];
+            auto uvs = span((const Vector2F16*)uvAt.Buffer.data(), mf.CornerCount);
+            vector<Vector3> tangents(mf.CornerCount, Vector3{ 0, 0, 0 });
+            auto uvOf = [&](u32 c) { return Vector2{ (f32)uvs[c].x, (f32)uvs[c].y }; };
+            for (auto face : irange(mf.FaceCount))
+            {
+                //Every triangle of the fan counts, not just the first, polygons whose uvs bend would otherwise follow one corner.
+                auto c0 = face * cornerPerFace;
+                auto p0 = positions[pointsOfCorners[c0]];
+                auto u0 = uvOf(c0);
+                auto sum = Vector3{ 0, 0, 0 };
+                for (auto i = 1u; i + 1 < cornerPerFace; ++i)
+                {
+                    auto e1 = positions[pointsOfCorners[c0 + i]] - p0, e2 = positions[pointsOfCorners[c0 + i + 1]] - p0;
+                    auto d1 = uvOf(c0 + i) - u0, d2 = uvOf(c0 + i + 1) - u0;
+                    auto det = d1.x * d2.y - d2.x * d1.y;
+                    if (det != 0)
+                        sum = sum + SafeNormalized((e1 * d2.y - e2 * d1.y) * (1 / det));
+                }
+                auto t = SafeNormalized(sum);
+                for (auto c : irange(cornerPerFace))
+                    tangents[c0 + c] = t;
+            }
+            tangentAttributes.emplace_back(MakeAttribute<Vector3F16>("{}{}"_f(CookedTangentPrefix, uvAt.Name), Corner, Vec3F16, f16Of(tangents)));
+        }
+        mf.Attributes.insert_range(mf.Attributes.end(), move(tangentAttributes));
+    }
+
+    u64 KeyOf(crpath input)
+    {
+        auto file = MappedFile(input);
+        auto version = CookerVersion;
+        return HashBytes(file.Bytes, HashBytes(span((const u8*)&version, sizeof(version)), 0));
+    }
+
+    bool IsTexture(crpath path)
+    {
+        auto ext = path.extension();
+        return ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".tga" || ext == ".bmp";
+    }
+
+    //Returns false when the output was already up to date.
+    //'normalMap' overrides telling normal maps apart by their name.
+    bool Cook(crpath input, crpath output, ThreadPool* threadPool, std::optional<bool> normalMap = std::nullopt)
+    {
+        //Forced normal maps are keyed apart, so passing --normal cooks them again.
+        auto key = "{:016x}{}"_f(KeyOf(input), normalMap.value_or(false) ? "n" : "");
+        auto keyPath = fs::path(output) += KeyExtension;
+        if (fs::exists(output) && fs::exists(keyPath))
+        {
+            string stored;
+            std::ifstream(keyPath) >> stored;
+            if (stored == key)
+                return false;
+        }
+        fs::create_directories(output.parent_path());
+        if (IsTexture(input))
+        {
+            CookTexture(input, DefaultCookOptions(input, normalMap), threadPool).Save(output);
+            std::ofstream(keyPath) << key;
+            return true;
+        }
+        auto sf = Import(input);
+        for (auto& mf : sf.Meshes)
+        {
+            //Exports made with SceneFileSetPacking come in packed.
+            UnpackAttributes(mf);
+            //Before baking, the baked tangents would otherwise lock every point on a uv seam.
+            if (mf.Lods.empty())
+                GenerateLods(mf);
+            Bake(mf);
+            //After baking, which is the last step that could reorder the faces.
+            if (mf.Meshlets.empty())
+                GenerateMeshlets(mf);
+            PackAttributes(mf);
+        }
+        sf.Save(output, { .Compress = true });
+        std::ofstream(keyPath) << key;
+        return true;
+    }
+
+    bool IsCookable(crpath path)
+    {
+        auto ext = path.extension();
+        return ext == ".obj" || ext == ".glb" || ext == ".gltf" || ext == CookedExtension || IsTexture(path);
+    }
+
+}
+
+int main(int argc, char* argv[])
+{
+    //Textures whose file name contains any of these are normal maps, whatever IsNormalMapName says.
+    vector<string_view> normalNames;
+    auto args = span(argv + 1, argv + argc);
+    while (args.size() >= 2 && args[0] == string_view("--normal"))
+    {
+        normalNames.emplace_back(args[1]);
+        args = args.subspan(2);
+    }
+    if (args.size() < 2)
+    {
+        std::println(std::cerr, "Usage: Cook [--normal <name part>]... <output directory> <input file or directory>...");
+        return 1;
+    }
+    auto outputDir = fs::path(args[0]);
+    auto normalMapOf = [&](crpath path)
+    {
+        auto name = path.filename().string();
+        return rn::any_of(normalNames, [&](auto n) { return name.contains(n); }) ? std::optional(true) : std::nullopt;
+    };
+
+    auto outputOf = [](fs::path path) { return path.replace_extension(IsTexture(path) ? TextureFileExtension : CookedExtension); };
+
+    //Directories are walked recursively and mirrored into the output directory.
+    //Cooked scenes are accepted as input, but not the ones in the output directory, which may be what an earlier run wrote.
+    //Nothing is ever cooked over itself.
+    auto canonicalOutputDir = fs::weakly_canonical(outputDir);
+    if (!canonicalOutputDir.has_filename())
+        canonicalOutputDir = canonicalOutputDir.parent_path();
+    auto isCooked = [&](crpath path)
+    {
+        if (path.extension() != CookedExtension)
+            return false;
+        auto canonical = fs::weakly_canonical(path);
+        auto [end, _] = rn::mismatch(canonicalOutputDir, canonical);
+        return end == canonicalOutputDir.end();
+    };
+    vector<pair<fs::path, fs::path>> jobs;
+    auto addJob = [&](fs::path input, fs::path output)
+    {
+        if (isCooked(input) || fs::weakly_canonical(input) == fs::weakly_canonical(output))
+        {
+            std::println("Skipped '{}', it's already cooked.", input.string());
+            return;
+        }
+        jobs.emplace_back(move(input), move(output));
+    };
+    for (auto arg : args.subspan(1))
+    {
+        auto input = fs::path(arg);
+        if (fs::is_directory(input))
+        {
+            for (auto& entry : fs::recursive_directory_iterator(input)) if (entry.is_regular_file() && IsCookable(entry.path()))
+                addJob(entry.path(), outputOf(outputDir / fs::relative(entry.path(), input)));
+        }
+        else addJob(input, outputOf(outputDir / input.filename()));
+    }
+
+    auto threadPool = ThreadPool();
+    //Textures are compressed a row of blocks per task, so they run on this thread when their result is asked for instead of in a task.
+    auto tasks = jobs | vs::transform([&](auto& job)
+    {
+        return IsTexture(job.first) ?
+            std::async(std::launch::deferred, [&] { return Cook(job.first, job.second, &threadPool, normalMapOf(job.first)); }) :
+            threadPool.Submit([&] { return Cook(job.first, job.second, nullptr); });
+    }) | to_vector;
+
+    auto failed = 0, cooked = 0;
+    for (auto [i, task] : tasks | indexed)
+    {
+        auto& [input, output] = jobs[i];
+        try
+        {
+            if (task.get())
+            {
+                ++cooked;
+                std::println("Cooked '{}' -> '{}'", input.string(), output.string());
+            }
+        }
+        catch (const std::exception& e)
+        {
+            ++failed;
+            std::println(std::cerr, "Failed to cook '{}': {}", input.string(), e.what());
+        }
+    }
+    std::println("{} cooked, {} up to date, {} failed.", cooked, jobs.size() - cooked - failed, failed);
+    return failed == 0 ? 0 : 1;
+}
@@ -1,5 +1,7 @@
 #include "MeshFile.hpp"
 
+#include <print>
+
 using namespace Kaey::Renderer;
 using namespace Kaey;
 
@@ -64,53 +66,340 @@ namespace
         { "ZYX",        ZYX  },
     };
 
-    void ReorderMeshFaces(MeshFile* mf)
+    //Post-transform cache size the face orders are tuned for and measured against.
+    constexpr u32 VertexCacheSize = 16;
+
+    struct VertexCacheStats
     {
-        if (mf->Materials.size() <= 1)
-            return;
-        auto it = rn::find_if(mf->Attributes, [&](MeshFileAttribute& at) { return at.Name == "material_index"; });
-        if (it == mf->Attributes.end())
+        f32 Acmr; //Vertices transformed per triangle.
+        f32 Atvr; //Vertices transformed per vertex used, 1 is optimal.
+    };
+
+    //Simulates a FIFO cache over the corners, polygons count as the triangles they're split into.
+    VertexCacheStats MeasureVertexCache(cspan<u32> corners, u32 cornerPerFace, u32 pointCount)
+    {
+        constexpr auto Never = u32(-1);
+        vector<u32> insertedAt(pointCount, Never);
+        auto misses = u32(0), used = u32(0);
+        for (auto p : corners)
+        {
+            auto& t = insertedAt[p];
+            if (t != Never && misses - t <= VertexCacheSize)
+                continue;
+            used += t == Never;
+            t = misses++;
+        }
+        auto triangleCount = corners.size() / cornerPerFace * (cornerPerFace - 2);
+        return { f32(misses) / std::max<size_t>(triangleCount, 1), f32(misses) / std::max(used, 1u) };
+    }
+
+    struct FaceClusters
+    {
+        vector<u32> Order;  //Faces of the range, in the order they should be drawn.
+        vector<u32> Starts; //Offsets into Order where a cluster starts.
+    };
+
+    //Tipsify (Sander et al. 2007): fans around a vertex that stays in cache, and only jumps elsewhere when there's none.
+    //Each jump starts a new cluster, which is the unit the overdraw pass reorders.
+    FaceClusters Tipsify(cspan<u32> corners, u32 cornerPerFace, u32 pointCount)
+    {
+        constexpr auto None = u32(-1);
+        auto faceCount = u32(corners.size() / cornerPerFace);
+
+        //Compact the points used by the range, so everything below is sized by the range.
+        vector<u32> localOf(pointCount, None);
+        vector<u32> localCorners(corners.size());
+        auto vertexCount = u32(0);
+        for (auto [i, p] : corners | uindexed32)
+        {
+            auto& l = localOf[p];
+            if (l == None)
+                l = vertexCount++;
+            localCorners[i] = l;
+        }
+
+        vector<u32> faceOffsets(vertexCount + 1, 0);
+        for (auto v : localCorners)
+            ++faceOffsets[v + 1];
+        std::partial_sum(faceOffsets.begin(), faceOffsets.end(), faceOffsets.begin());
+        vector<u32> facesOfVertices(localCorners.size());
+        {
+            auto cursor = faceOffsets;
+            for (auto [i, v] : localCorners | uindexed32)
+                facesOfVertices[cursor[v]++] = i / cornerPerFace;
+        }
+
+        vector<u32> live(vertexCount);
+        for (auto v : irange(vertexCount))
+            live[v] = faceOffsets[v + 1] - faceOffsets[v];
+        vector<u32> cachedAt(vertexCount, 0);
+        vector<bool> emitted(faceCount, false);
+        vector<u32> deadEnds, candidates;
+
+        FaceClusters res;
+        res.Order.reserve(faceCount);
+        auto time = VertexCacheSize + 1;
+        auto cursor = u32(0);
+        auto fan = vertexCount > 0 ? u32(0) : None;
+        auto jumped = true;
+        while (fan != None)
+        {
+            if (jumped)
+                res.Starts.emplace_back((u32)res.Order.size());
+            candidates.clear();
+            for (auto i = faceOffsets[fan]; i < faceOffsets[fan + 1]; ++i)
+            {
+                auto face = facesOfVertices[i];
+                if (emitted[face])
+                    continue;
+                emitted[face] = true;
+                res.Order.emplace_back(face);
+                for (auto v : span(localCorners).subspan(face * cornerPerFace, cornerPerFace))
+                {
+                    deadEnds.emplace_back(v);
+                    candidates.emplace_back(v);
+                    --live[v];
+                    if (time - cachedAt[v] > VertexCacheSize)
+                        cachedAt[v] = time++;
+                }
+            }
+
+            //Prefer the oldest vertex that would still be in cache after its remaining faces are emitted.
+            auto next = None;
+            auto bestPriority = i64(-1);
+            for (auto v : candidates) if (live[v] > 0)
+            {
+                auto age = time - cachedAt[v];
+                auto priority = age + 2 * live[v] <= VertexCacheSize ? i64(age) : 0;
+                if (priority > bestPriority)
+                {
+                    bestPriority = priority;
+                    next = v;
+                }
+            }
+            jumped = next == None;
+            while (next == None && !deadEnds.empty())
+            {
+                auto v = deadEnds.back();
+                deadEnds.pop_back();
+                if (live[v] > 0)
+                    next = v;
+            }
+            for (; next == None && cursor < vertexCount; ++cursor) if (live[cursor] > 0)
+                next = cursor;
+            fan = next;
+        }
+        return res;
+    }
+
+    Vector3 FaceNormal(cspan<u32> face, cspan<Vector3> positions)
+    {
+        //Newell's method, same winding as the face normals of MeshLod and Bake.
+        auto n = Vector3{ 0, 0, 0 };
+        for (auto [i, p] : face | uindexed32)
+        {
+            auto& a = positions[p];
+            auto& b = positions[face[(i + 1) % face.size()]];
+            n = n + Vector3{ a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+        }
+        return n;
+    }
+
+    //Clusters facing away from the center of the range go first, so they occlude the rest of it (Sander et al. 2007).
+    void SortClustersForOverdraw(FaceClusters& clusters, cspan<u32> corners, u32 cornerPerFace, cspan<Vector3> positions)
+    {
+        auto dot = [](const Vector3& a, const Vector3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; };
+        auto faceCount = (u32)clusters.Order.size();
+        vector<Vector3> normals(faceCount), centroids(faceCount);
+        auto center = Vector3{ 0, 0, 0 };
+        auto totalWeight = 0.f;
+        for (auto face : irange(faceCount))
+        {
+            auto corner = corners.subspan(face * cornerPerFace, cornerPerFace);
+            auto c = Vector3{ 0, 0, 0 };
+            for (auto p : corner)
+                c = c + positions[p];
+            centroids[face] = c * (1.f / cornerPerFace);
+            normals[face] = FaceNormal(corner, positions);
+            auto weight = std::sqrt(dot(normals[face], normals[face]));
+            center = center + centroids[face] * weight;
+            totalWeight += weight;
+        }
+        if (totalWeight == 0)
             return;
-        auto ids = span((u32*)it->Buffer.data(), mf->FaceCount);
-        map<u32, vector<pair<size_t, size_t>>> matIdRanges;
-        for (size_t i = 0; i < ids.size();)
+        center = center * (1 / totalWeight);
+
+        auto clusterCount = (u32)clusters.Starts.size();
+        auto endOf = [&](u32 c) { return c + 1 < clusterCount ? clusters.Starts[c + 1] : faceCount; };
+        vector<f32> metrics(clusterCount);
+        for (auto [c, metric] : metrics | uindexed32)
         {
-            auto id = ids[i];
-            auto& [offset, count] = matIdRanges[id].emplace_back(i, 0);
-            do ++count;
-            while (i + count < ids.size() && ids[i + count] == id);
-            i += count;
+            auto n = Vector3{ 0, 0, 0 }, p = Vector3{ 0, 0, 0 };
+            auto weight = 0.f;
+            for (auto i = clusters.Starts[c]; i < endOf(c); ++i)
+            {
+                auto face = clusters.Order[i];
+                auto w = std::sqrt(dot(normals[face], normals[face]));
+                n = n + normals[face];
+                p = p + centroids[face] * w;
+                weight += w;
+            }
+            auto length = std::sqrt(dot(n, n));
+            metric = weight > 0 && length > 0 ? dot(p * (1 / weight) - center, n) / length : 0;
         }
+        auto sorted = irange(clusterCount) | to_vector;
+        rn::stable_sort(sorted, std::greater(), [&](u32 c) { return metrics[c]; });
+
+        FaceClusters res;
+        res.Order.reserve(faceCount);
+        for (auto c : sorted)
+        {
+            res.Starts.emplace_back((u32)res.Order.size());
+            res.Order.insert_range(res.Order.end(), span(clusters.Order).subspan(clusters.Starts[c], endOf(c) - clusters.Starts[c]));
+        }
+        clusters = move(res);
+    }
+
+    //'faces' are the faces of one material, reordered in place.
+    void OptimizeFaceOrder(span<u32> faces, cspan<u32> corners, u32 cornerPerFace, u32 pointCount, cspan<Vector3> positions)
+    {
+        vector<u32> rangeCorners;
+        rangeCorners.reserve(faces.size() * cornerPerFace);
+        for (auto face : faces)
+            rangeCorners.insert_range(rangeCorners.end(), corners.subspan(face * cornerPerFace, cornerPerFace));
+        auto clusters = Tipsify(rangeCorners, cornerPerFace, pointCount);
+        if (!positions.empty())
+            SortClustersForOverdraw(clusters, rangeCorners, cornerPerFace, positions);
+        auto original = faces | to_vector;
+        for (auto [i, face] : clusters.Order | uindexed32)
+            faces[i] = original[face];
+    }
+
+    //Groups the faces by material with a counting sort, then orders each material for the vertex cache and overdraw.
+    //'verbose' prints how the vertex cache fares before and after.
+    void ReorderMeshFaces(MeshFile* mf, bool verbose)
+    {
+        if (mf->FaceCount == 0)
+            return;
+        auto find = [&](string_view name) { auto it = rn::find_if(mf->Attributes, [&](MeshFileAttribute& at) { return at.Name == name; }); return it != mf->Attributes.end() ? &*it : nullptr; };
+        auto cvs = find(".corner_vert");
+        if (!cvs)
+            return;
         auto cornerPerFace = mf->CornerCount / mf->FaceCount;
-        vector<u8> atData;
+        auto corners = cvs->Type == UInt16
+            ? span((const u16*)cvs->Buffer.data(), mf->CornerCount) | vs::transform([](u16 i) { return (u32)i; }) | to_vector
+            : span((const u32*)cvs->Buffer.data(), mf->CornerCount) | to_vector;
+        auto pos = find("position");
+        auto positions = pos && pos->Type == Vec3 ? cspan<Vector3>((const Vector3*)pos->Buffer.data(), mf->PointCount) : cspan<Vector3>();
+
+        //Out of range ids use the last material, same as blender.
+        auto materialCount = std::max((u32)mf->Materials.size(), 1u);
+        auto mat = mf->Materials.size() > 1 ? find("material_index") : nullptr;
+        auto ids = mat ? cspan<u32>((const u32*)mat->Buffer.data(), mf->FaceCount) : cspan<u32>();
+        auto slotOf = [&](u32 face) { return ids.empty() ? 0 : std::min(ids[face], materialCount - 1); };
+        vector<u32> offsets(materialCount + 1, 0);
+        for (auto face : irange(mf->FaceCount))
+            ++offsets[slotOf(face) + 1];
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        vector<u32> order(mf->FaceCount);
+        {
+            auto cursor = offsets;
+            for (auto face : irange(mf->FaceCount))
+                order[cursor[slotOf(face)]++] = face;
+        }
+
+        //Materials are independent, and so are the attributes once the order is known.
+        vector<std::future<void>> tasks;
+        for (auto slot : irange(materialCount)) if (offsets[slot + 1] > offsets[slot])
+        {
+            auto faces = span(order).subspan(offsets[slot], offsets[slot + 1] - offsets[slot]);
+            tasks.emplace_back(std::async(std::launch::async, [&, faces] { OptimizeFaceOrder(faces, corners, cornerPerFace, mf->PointCount, positions); }));
+        }
+        for (auto& task : tasks)
+            task.get();
+        tasks.clear();
+
         for (auto& attribute : mf->Attributes) if (attribute.Domain == Corner || attribute.Domain == Face)
         {
-            auto byteSize = ByteSizeOfAttribute(attribute.Type) * (attribute.Domain == Corner ? cornerPerFace : 1);
-            atData.clear();
-            atData.reserve(attribute.Buffer.size());
-            for (auto& ranges : matIdRanges | vs::values)
-            for (auto& [offset, count] : ranges)
+            tasks.emplace_back(std::async(std::launch::async, [&]
             {
-                auto v = span(attribute.Buffer.data() + offset * byteSize, count * byteSize);
-                atData.insert_range(atData.end(), v);
-            }
-            rn::copy(atData, attribute.Buffer.data());
+                auto byteSize = ByteSizeOfAttribute(attribute.Type) * (attribute.Domain == Corner ? cornerPerFace : 1);
+                auto src = attribute.Buffer.data();
+                vector<u8> atData(attribute.Buffer.size());
+                for (auto [i, face] : order | uindexed32)
+                    std::memcpy(atData.data() + i * byteSize, src + face * byteSize, byteSize);
+                attribute.Buffer = move(atData);
+            }));
         }
-        for (u32 offset = 0; auto [i, ranges] : matIdRanges | vs::values | uindexed32)
+        for (auto& task : tasks)
+            task.get();
+
+        for (auto [i, r] : mf->Materials | uindexed32)
         {
-            auto& r = mf->Materials[i];
-            r.Offset = offset;
-            r.Count = 0;
-            for (auto& count : ranges | vs::values)
-                r.Count += count;
-            offset += r.Count;
+            r.Offset = offsets[i];
+            r.Count = offsets[i + 1] - offsets[i];
         }
+
+        if (!verbose)
+            return;
+        auto reordered = vector<u32>();
+        reordered.reserve(corners.size());
+        for (auto face : order)
+            reordered.insert_range(reordered.end(), span(corners).subspan(face * cornerPerFace, cornerPerFace));
+        auto before = MeasureVertexCache(corners, cornerPerFace, mf->PointCount);
+        auto after = MeasureVertexCache(reordered, cornerPerFace, mf->PointCount);
+        std::println("{}: ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}", mf->Name, before.Acmr, after.Acmr, before.Atvr, after.Atvr);
+    }
+
+}
+
+//Buffers the whole scene until saved, unless created with CreateSceneFileStream, in which case meshes are
+//written as they are added and only objects, materials and the collection are kept for the final table.
+//A stream destroyed without being saved deletes its file, it has no table and wouldn't load.
+struct SceneFileHandle
+{
+    SceneFile Scene;
+    unique_ptr<SceneFileWriter> Writer;
+    fs::path Path; //Of the stream.
+    MeshFileWriteOptions Options;
+    MeshLodOptions LodOptions{ .LevelCount = 0 };
+    bool Pack = false;
+    bool Verbose = false;
+};
+
+namespace
+{
+    thread_local string LastError;
+
+    //Exceptions can't cross into the exporter, they are kept for LastErrorMessage and reported as failure instead.
+    bool Guard(auto&& fn)
+    {
+        try
+        {
+            fn();
+            return true;
+        }
+        catch (const std::exception& e)
+        {
+            LastError = e.what();
+        }
+        catch (...)
+        {
+            LastError = "Unknown error";
+        }
+        return false;
     }
 
 }
 
 extern "C"
 {
+    //Why the last call that failed on this thread did, empty if none has.
+    const char* LastErrorMessage()
+    {
+        return LastError.c_str();
+    }
+
     MeshAttributeDomain AttributeDomain(const char* n)
     {
         assert(DomainMap.contains(n));
@@ -279,8 +568,15 @@ extern "C"
     {
         auto it = rn::find_if(mf->Attributes, [&](auto& at) { return at.Name == "position"; });
         assert(it != mf->Attributes.end());
-        auto vec = span(buffer, mf->PointCount * sizeof(Vector3)) | to_vector;
-        it->Morphs.emplace_back(name, relativeName, value, min, max, move(vec));
+        auto shape = span((const Vector3*)buffer, mf->PointCount);
+        if (it->Morphs.empty())
+        {
+            it->Morphs.emplace_back(name, relativeName, value, min, max, span(buffer, shape.size_bytes()) | to_vector);
+            return;
+        }
+        //Every key after the basis is stored as deltas from it, most only move a small part of the mesh.
+        auto basis = span((const Vector3*)it->Morphs.front().Buffer.data(), mf->PointCount);
+        it->Morphs.emplace_back(MakePositionMorph(name, relativeName, value, min, max, basis, shape));
     }
 
     void MeshFileAddMaterial(MeshFile* mf, u32 id)
@@ -288,9 +584,9 @@ extern "C"
         mf->Materials.emplace_back(id, 0, mf->FaceCount);
     }
 
-    void MeshFileSave(MeshFile* mf, const char* path)
+    bool MeshFileSave(MeshFile* mf, const char* path)
     {
-        return mf->Save(path);
+        return Guard([&] { mf->Save(path); });
     }
 
     void DestroyMeshFile(MeshFile* mf)
@@ -298,43 +594,101 @@ extern "C"
         delete mf;
     }
 
-    SceneFile* CreateSceneFile()
+    SceneFileHandle* CreateSceneFile()
     {
-        return new SceneFile();
+        return new SceneFileHandle();
     }
 
-    void SceneFileAddMesh(SceneFile* scene, MeshFile* mf)
+    //Null if the file can't be created.
+    SceneFileHandle* CreateSceneFileStream(const char* path)
     {
-        ReorderMeshFaces(mf);
-        scene->Meshes.emplace_back(move(*mf));
-        delete mf;
+        auto scene = make_unique<SceneFileHandle>();
+        if (!Guard([&] { scene->Writer = make_unique<SceneFileWriter>(path); }))
+            return nullptr;
+        scene->Path = path;
+        return scene.release();
+    }
+
+    //Applies to meshes added from now on when streaming, or to the whole scene on save otherwise.
+    void SceneFileSetCompression(SceneFileHandle* scene, bool compress, bool quantizePositions)
+    {
+        scene->Options = { .Compress = compress, .QuantizePositions = quantizePositions };
+    }
+
+    //Meshes added from now on get 'levelCount' LODs, none by default.
+    void SceneFileSetLods(SceneFileHandle* scene, u32 levelCount, f32 faceRatio, f32 maxError)
+    {
+        scene->LodOptions = { .LevelCount = levelCount, .FaceRatio = faceRatio, .MaxError = maxError };
+    }
+
+    //Meshes added from now on store their positions as 16 bits per component, see PackAttributes.
+    void SceneFileSetPacking(SceneFileHandle* scene, bool pack)
+    {
+        scene->Pack = pack;
     }
 
-    void SceneFileAddObject(SceneFile* scene, ObjectInstance* obj)
+    //Meshes added from now on print their vertex cache stats.
+    void SceneFileSetVerbose(SceneFileHandle* scene, bool verbose)
     {
-        scene->Objects.emplace_back(move(*obj));
+        scene->Verbose = verbose;
+    }
+
+    //Takes 'mf' even when it fails.
+    bool SceneFileAddMesh(SceneFileHandle* scene, MeshFile* mf)
+    {
+        auto ptr = unique_ptr<MeshFile>(mf);
+        return Guard([&]
+        {
+            ReorderMeshFaces(mf, scene->Verbose);
+            if (scene->LodOptions.LevelCount > 0)
+                GenerateLods(*mf, scene->LodOptions);
+            if (scene->Pack)
+                PackAttributes(*mf);
+            if (scene->Writer)
+                scene->Writer->AddMesh(*mf, scene->Options);
+            else scene->Scene.Meshes.emplace_back(move(*mf));
+        });
+    }
+
+    void SceneFileAddObject(SceneFileHandle* scene, ObjectInstance* obj)
+    {
+        scene->Scene.Objects.emplace_back(move(*obj));
         delete obj;
     }
 
-    void SceneFileAddMaterial(SceneFile* scene, MeshFileMaterial* mat)
+    void SceneFileAddMaterial(SceneFileHandle* scene, MeshFileMaterial* mat)
     {
-        scene->Materials.emplace_back(move(*mat));
+        scene->Scene.Materials.emplace_back(move(*mat));
         delete mat;
     }
 
-    void SceneFileSetColletion(SceneFile* scene, Collection* col)
+    void SceneFileSetColletion(SceneFileHandle* scene, Collection* col)
     {
-        scene->Collection.reset(col);
+        scene->Scene.Collection.reset(col);
     }
 
-    void SceneFileSave(SceneFile* scene, const char* path)
+    //Streamed scenes were opened with their path, so 'path' is ignored for them.
+    bool SceneFileSave(SceneFileHandle* scene, const char* path)
     {
-        scene->Save(path);
+        return Guard([&]
+        {
+            if (scene->Writer)
+            {
+                auto& sf = scene->Scene;
+                scene->Writer->Finish(sf.Objects, sf.Materials, sf.Collection);
+            }
+            else scene->Scene.Save(path, scene->Options);
+        });
     }
 
-    void DestroySceneFile(SceneFile* scene)
+    void DestroySceneFile(SceneFileHandle* scene)
     {
-        delete scene;
+        auto ptr = unique_ptr<SceneFileHandle>(scene);
+        if (!ptr->Writer || ptr->Writer->IsFinished)
+            return;
+        ptr->Writer.reset(); //Closes the file first.
+        std::error_code ec;
+        fs::remove(ptr->Path, ec);
     }
 
 }
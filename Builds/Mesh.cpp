@@ -1,4 +1,5 @@
 #include "Mesh.hpp"
+#include "MeshTopology.hpp"
 
 #include <Slang/MeshPipeline.hpp>
 #include <Slang/ShapesPipeline.hpp>
@@ -13,6 +14,11 @@ namespace Kaey::Renderer
     {
         constexpr auto AttributeFlags = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer;
         constexpr auto     SceneFlags = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer;
+
+        f32 Dot(const Vector3& a, const Vector3& b)
+        {
+            return a.x * b.x + a.y * b.y + a.z * b.z;
+        }
     }
 
     SceneData::SceneData(RenderDevice* device) :
@@ -47,27 +53,33 @@ namespace Kaey::Renderer
 
     MeshAttribute* MeshData2::AddAttribute(string name, MeshAttributeDomain domain, MeshAttributeType type, u32 extraCount)
     {
-        assert("Named attribute is already present!" && FindAttribute(name) == nullptr);
         auto count =
             domain == Point  ?  PointCount :
             domain == Face   ?   FaceCount :
             domain == Corner ? CornerCount :
             throw runtime_error("!");
-        count += extraCount;
+        return AllocateAttribute(move(name), domain, type, count + extraCount);
+    }
+
+    MeshAttribute* MeshData2::AllocateAttribute(string name, MeshAttributeDomain domain, MeshAttributeType type, u32 count)
+    {
+        assert("Named attribute is already present!" && FindAttribute(name) == nullptr);
         auto offset =
-            type == UInt8   ? data->AttributeAllocator->AllocateIndex32<u8>        (count) :
-            type == UInt16  ? data->AttributeAllocator->AllocateIndex32<u16>       (count) :
-            type == UInt32  ? data->AttributeAllocator->AllocateIndex32<u32>       (count) :
-            type == Float   ? data->AttributeAllocator->AllocateIndex32<f32>       (count) :
-            type == Vec2    ? data->AttributeAllocator->AllocateIndex32<Vector2>   (count) :
-            type == Vec3    ? data->AttributeAllocator->AllocateIndex32<Vector3>   (count) :
-            type == Vec4    ? data->AttributeAllocator->AllocateIndex32<Vector4>   (count) :
-            type == Vec2Int ? data->AttributeAllocator->AllocateIndex32<Vector2>   (count) :
-            type == Vec3Int ? data->AttributeAllocator->AllocateIndex32<Vector3>   (count) :
-            type == Vec4Int ? data->AttributeAllocator->AllocateIndex32<Vector4>   (count) :
-            type == Vec2F16 ? data->AttributeAllocator->AllocateIndex32<Vector2F16>(count) :
-            type == Vec3F16 ? data->AttributeAllocator->AllocateIndex32<Vector3F16>(count) :
-            type == Vec4F16 ? data->AttributeAllocator->AllocateIndex32<Vector4F16>(count) :
+            type == UInt8   ? data->AllocateAttributeIndex<u8>        (count) :
+            type == UInt16  ? data->AllocateAttributeIndex<u16>       (count) :
+            type == UInt32  ? data->AllocateAttributeIndex<u32>       (count) :
+            type == Float   ? data->AllocateAttributeIndex<f32>       (count) :
+            type == Vec2    ? data->AllocateAttributeIndex<Vector2>   (count) :
+            type == Vec3    ? data->AllocateAttributeIndex<Vector3>   (count) :
+            type == Vec4    ? data->AllocateAttributeIndex<Vector4>   (count) :
+            type == Vec2Int ? data->AllocateAttributeIndex<Vector2>   (count) :
+            type == Vec3Int ? data->AllocateAttributeIndex<Vector3>   (count) :
+            type == Vec4Int ? data->AllocateAttributeIndex<Vector4>   (count) :
+            type == Vec2F16 ? data->AllocateAttributeIndex<Vector2F16>(count) :
+            type == Vec3F16 ? data->AllocateAttributeIndex<Vector3F16>(count) :
+            type == Vec4F16 ? data->AllocateAttributeIndex<Vector4F16>(count) :
+            type == Vec3Oct ? data->AllocateAttributeIndex<u32>       (count) :
+            type == Vec3Q16 ? data->AllocateAttributeIndex<Vector3Q16>(count) :
             throw runtime_error("!");
         auto size =
             type == UInt8   ? sizeof(u8)         :
@@ -83,6 +95,8 @@ namespace Kaey::Renderer
             type == Vec2F16 ? sizeof(Vector2F16) :
             type == Vec3F16 ? sizeof(Vector3F16) :
             type == Vec4F16 ? sizeof(Vector4F16) :
+            type == Vec3Oct ? sizeof(u32)        :
+            type == Vec3Q16 ? sizeof(Vector3Q16) :
             throw runtime_error("!");
         return attributes.emplace_back(make_unique<MeshAttribute>(move(name), domain, type, offset, vector<u8, GPUAllocator<u8>>(size * count, {}, { Device }), size)).get();
     }
@@ -98,70 +112,57 @@ namespace Kaey::Renderer
             throw runtime_error("!");
         auto res = AddAttribute({}, at->Domain, at->Type, count * shapeCount);
         at->Morphs.Attribute = res;
-        at->Morphs.ValuesIndexOffset = Data->AttributeAllocator->AllocateIndex32<f32>(shapeCount);
+        at->Morphs.ValuesIndexOffset = Data->AllocateAttributeIndex<f32>(shapeCount);
         at->Morphs.Values.resize(shapeCount, { {}, 0, 0, 1 });
         return res;
     }
 
     KR_GETTER_DEF(MeshData3D, FaceIndices)
+    {
+        return BuildFaceIndices();
+    }
+
+    const MeshAttribute* MeshData3D::BuildFaceIndices(ThreadPool* threadPool) const
     {
         if (faceIndices)
             return faceIndices;
 
-        auto facesOfVertices = vector<vector<u32>>(PointCount + 1); //One more to get the count of the last vertex.
-        auto emplaceCount = u32(0);
-        auto createCorners = [&](auto&& pointsOfCorner)
-        {
-            for (auto faceId : irange(FaceCount))
-            for (auto cornerId : vs::iota(CornerPerFace * faceId) | vs::take(CornerPerFace))
-            {
-                auto vertexId = pointsOfCorner[cornerId];
-                facesOfVertices[vertexId].emplace_back(faceId);
-                ++emplaceCount;
-            }
-        };
-
-        if (PointOfCorner->Type == UInt32)
-            createCorners(PointsOfCorners32);
-        else createCorners(PointsOfCorners16);
-
         auto faceIndexType = FaceCount <= UINT16_MAX ? UInt16 : UInt32;
-        faceIndices = const_cast<MeshData3D*>(this)->AddAttribute("FaceIndex", Point, faceIndexType, emplaceCount - PointCount);
+        faceIndices = const_cast<MeshData3D*>(this)->AddAttribute("FaceIndex", Point, faceIndexType, CornerCount - PointCount);
 
-        auto createFaceIndices = [&]<class Int>(Int* faceIndexIt)
+        //FaceList has one more element than points, to hold the end of the last one.
+        auto faceLists = span(FaceLists.data(), PointCount + 1);
+        auto build = [&]<class Index>(span<Index> pointsOfCorners)
         {
-            auto faceIt = FaceLists.data();
-            auto  index = u32(0);
-            for (auto [vertexId, faces] : facesOfVertices | uindexed32)
-            {
-                for (auto faceId : faces)
-                    *faceIndexIt++ = (Int)faceId;
-                *faceIt++ = index;
-                index += u32(faces.size());
-            }
+            auto bytes = faceIndices->Buffer.data();
+            if (faceIndexType == UInt16)
+                BuildPointFaces<Index, u16>(pointsOfCorners, CornerPerFace, faceLists, span((u16*)bytes, CornerCount), threadPool);
+            else BuildPointFaces<Index, u32>(pointsOfCorners, CornerPerFace, faceLists, span((u32*)bytes, CornerCount), threadPool);
         };
-
-        if (FaceCount <= UINT16_MAX)
-            createFaceIndices((u16*)faceIndices->Buffer.data());
-        else createFaceIndices((u32*)faceIndices->Buffer.data());
+        if (PointOfCorner->Type == UInt32)
+            build(PointsOfCorners32);
+        else build(PointsOfCorners16);
 
         Uniform->FaceIndexOfPointOffset = faceIndices->IndexOffset;
 
         return faceIndices;
     }
 
-    MeshData3D::MeshData3D(SceneData* data, string name, u32 pointCount, u32 faceCount, u32 cornerCount) :
+    MeshData3D::MeshData3D(SceneData* data, string name, u32 pointCount, u32 faceCount, u32 cornerCount, MeshPacking packing) :
         MeshData2(data, pointCount, faceCount, cornerCount),
         name(move(name)),
-        meshIndex(data->SceneAllocator->AllocateIndex32<UniformMesh>(1)),
-        faceIndices(nullptr)
+        meshIndex(data->AllocateSceneIndex<UniformMesh>(1)),
+        faceIndices(nullptr),
+        packing(move(packing))
     {
         auto pointIndexType = PointCount <= UINT16_MAX ? UInt16 : UInt32;
-        AddAttribute("PointOfCorner", Corner,           pointIndexType, 0);
-        AddAttribute("NormalOfFace",  Face,  Vec3F16, 0);
-        AddAttribute("Position",      Point, Vec3,    0);
-        AddAttribute("Normal",        Point, Vec3F16, 0);
-        AddAttribute("FaceList",      Point, UInt32,  1);
+        auto positionType = Packing.Positions ? Vec3Q16 : Vec3;
+        auto unitType = Packing.UnitVectors ? Vec3Oct : Vec3F16;
+        AddAttribute("PointOfCorner", Corner, pointIndexType, 0);
+        AddAttribute("NormalOfFace",  Face,   unitType,       0);
+        AddAttribute("Position",      Point,  positionType,   0);
+        AddAttribute("Normal",        Point,  unitType,       0);
+        AddAttribute("FaceList",      Point,  UInt32,         1);
 
         Uniform->PointCount             = PointCount;
         Uniform->FaceCount              = FaceCount;
@@ -174,6 +175,13 @@ namespace Kaey::Renderer
         //Uniform->FaceIndexOfPointOffset = FaceIndices->IndexOffset;
         Uniform->UseU32Indices          = PointOfCorner->Type == UInt32;
         Uniform->UseF32Normals          = false;
+        Uniform->UseOctNormals          = Packing.UnitVectors;
+        Uniform->UseQ16Positions        = Packing.Positions.has_value();
+        if (auto& bounds = Packing.Positions)
+        {
+            Uniform->PositionMin        = bounds->Min;
+            Uniform->PositionMax        = bounds->Max;
+        }
         Uniform->UvOffset               = u32(-1);
     }
 
@@ -193,6 +201,7 @@ namespace Kaey::Renderer
     {
         if (Position->Morphs.Values.empty())
             return;
+        assert("Packed positions can't be morphed!" && !Packing.Positions);
         Device->ExecuteSingleTimeCommands(frame, [this](Frame* fr)
         {
             auto writer = fr->NewObject<BufferQueue>(Device);
@@ -216,6 +225,7 @@ namespace Kaey::Renderer
 
     void MeshData3D::CalcFaceNormals(Frame* frame)
     {
+        assert("Packed normals can't be computed on the GPU!" && !Packing.UnitVectors);
         Device->ExecuteSingleTimeCommands(frame, [this](Frame* fr)
         {
             auto nfp = Data->NormalOfFacesPipeline;
@@ -227,11 +237,17 @@ namespace Kaey::Renderer
             nfp->Params.Binding0 = Data->SceneBuffer;
             nfp->Params.Binding1 = Data->AttributeBuffer;
             nfp->Compute({ FaceCount }, fr);
+            for (auto& lod : lods)
+            {
+                nfp->PushConstantValue.MeshIndex = lod.MeshIndex;
+                nfp->Compute({ lod.FaceCount }, fr);
+            }
         });
     }
 
     void MeshData3D::CalcPointNormals(Frame* frame)
     {
+        assert("Packed normals can't be computed on the GPU!" && !Packing.UnitVectors);
         Device->ExecuteSingleTimeCommands(frame, [this](Frame* fr)
         {
             auto nvp = Data->NormalOfVerticesPipeline;
@@ -250,6 +266,7 @@ namespace Kaey::Renderer
     {
         if (Uvs.empty())
             return;
+        assert("Packed tangents can't be computed on the GPU!" && !Packing.UnitVectors);
         Device->ExecuteSingleTimeCommands(frame, [this](Frame* fr)
         {
             auto tgp = Data->TangentOfCornersPipeline;
@@ -261,13 +278,18 @@ namespace Kaey::Renderer
             tgp->Params.Binding0 = Data->SceneBuffer;
             tgp->Params.Binding1 = Data->AttributeBuffer;
             tgp->Compute({ CornerCount }, fr);
+            for (auto& lod : lods)
+            {
+                tgp->PushConstantValue.MeshIndex = lod.MeshIndex;
+                tgp->Compute({ lod.CornerCount }, fr);
+            }
         });
     }
 
     MeshAttribute* MeshData3D::AddUvMap(string name)
     {
         auto uv = AddAttribute(move(name), Corner, Vec2F16);
-        auto tg = AddAttribute("TangentOf{}"_f(uv->Name), Corner, Vec3F16);
+        auto tg = AddAttribute("TangentOf{}"_f(uv->Name), Corner, Packing.UnitVectors ? Vec3Oct : Vec3F16);
         if (uvMaps.empty())
         {
             Uniform->UvOffset = uv->IndexOffset;
@@ -277,52 +299,231 @@ namespace Kaey::Renderer
         return uv;
     }
 
-    LoadedScene LoadSceneFile(SceneData* sceneData, crpath path)
+    const MeshLod& MeshData3D::AddLod(const MeshFileLod& lod)
     {
-        using namespace std::string_view_literals;
-        auto sf = SceneFile::Load(path);
-        auto meshes = sf.Meshes | vs::transform([&](MeshFile& mf) -> unique_ptr<MeshData3D>
+        assert("LOD face normals and tangents are computed on the GPU, which doesn't write packed ones!" && !Packing.UnitVectors);
+        auto sources = span((const u32*)lod.Corners.data(), lod.Corners.size() / sizeof(u32));
+        auto index = (u32)lods.size() + 1;
+        auto& res = lods.emplace_back();
+        res.Error         = lod.Error;
+        res.MeshIndex     = Data->AllocateSceneIndex<UniformMesh>(1);
+        res.FaceCount     = lod.FaceCount;
+        res.CornerCount   = (u32)sources.size();
+        res.PointOfCorner = AllocateAttribute("Lod{}PointOfCorner"_f(index), Corner, PointOfCorner->Type, res.CornerCount);
+        res.NormalOfFace  = AllocateAttribute("Lod{}NormalOfFace"_f(index), Face, Vec3F16, res.FaceCount);
+
+        auto gather = [&]<class T>(const MeshAttribute* from, MeshAttribute* to, T)
         {
-            if (mf.FaceCount == 0)
-                return nullptr;
-            assert("Invalid Mixed Topology!" && mf.CornerCount % mf.FaceCount == 0);
-            auto mesh = make_unique<MeshData3D>(sceneData, mf.Name, mf.PointCount, mf.FaceCount, mf.CornerCount);
+            auto src = (const T*)from->Buffer.data();
+            for (auto [i, s] : sources | uindexed32)
+                ((T*)to->Buffer.data())[i] = src[s];
+        };
+        if (PointOfCorner->Type == UInt32)
+            gather(PointOfCorner, res.PointOfCorner, u32());
+        else gather(PointOfCorner, res.PointOfCorner, u16());
+        MeshAttribute* tangent = nullptr;
+        for (auto uv : uvMaps)
+        {
+            auto lodUv = res.Uvs.emplace_back(AllocateAttribute("Lod{}{}"_f(index, uv->Name), Corner, Vec2F16, res.CornerCount));
+            gather(uv, lodUv, Vector2F16());
+            auto tg = AllocateAttribute("Lod{}TangentOf{}"_f(index, uv->Name), Corner, Vec3F16, res.CornerCount);
+            if (!tangent)
+                tangent = tg;
+        }
+        res.MaterialRanges = lod.Materials | vs::transform([](auto r) { return pair(r.Offset, r.Count); }) | to_vector;
+
+        auto uniform = (UniformMesh*)Data->SceneAllocator->MappedAddress + res.MeshIndex;
+        *uniform = *Uniform;
+        uniform->FaceCount           = res.FaceCount;
+        uniform->CornerCount         = res.CornerCount;
+        uniform->PointOfCornerOffset = res.PointOfCorner->IndexOffset;
+        uniform->NormalOfFaceOffset  = res.NormalOfFace->IndexOffset;
+        if (!res.Uvs.empty())
+        {
+            uniform->UvOffset      = res.Uvs[0]->IndexOffset;
+            uniform->TangentOffset = tangent->IndexOffset;
+        }
+        return res;
+    }
 
-            auto pos = rn::find_if(mf.Attributes, [](auto& at) { return at.Name == "position"sv; });
-            rn::copy(pos->Buffer, (u8*)mesh->Positions.data());
+    const MeshLod* MeshData3D::SelectLod(f32 distance, f32 pixelsPerUnit, f32 maxPixelError) const
+    {
+        const MeshLod* res = nullptr;
+        for (auto& lod : lods)
+        {
+            if (lod.Error * pixelsPerUnit > maxPixelError * distance)
+                break;
+            res = &lod;
+        }
+        return res;
+    }
 
-            if (auto count = pos->Morphs.size(); count > 1)
+    vector<pair<u32, u32>> MeshData3D::VisibleFaceRanges(cspan<Vector4> planes, const Vector3* camera) const
+    {
+        vector<pair<u32, u32>> res;
+        for (auto& m : Meshlets)
+        {
+            auto outside = rn::any_of(planes, [&](const Vector4& p)
             {
-                auto mp = mesh->Position;
-                auto mAtt = mesh->AddAttributeMorphs(mp, (u32)pos->Morphs.size());
-                for (auto it = mAtt->Buffer.data(); auto [i, morph] : pos->Morphs | indexed)
-                {
-                    auto& m = mp->Morphs.Values[i];
-                    m.Name  = morph.Name;
-                    m.Value = morph.Value;
-                    m.Min   = morph.Min;
-                    m.Max   = morph.Max;
-                    it = rn::copy(morph.Buffer, it).out;
-                }
+                auto n = Vector3{ p.x, p.y, p.z };
+                return Dot(n, m.Center) + p.w < -m.Radius * n.Magnitude;
+            });
+            if (outside)
+                continue;
+            //Every face points away from the camera, anywhere inside the sphere.
+            if (camera && m.ConeCutoff < 1)
+            {
+                auto toCenter = m.Center - *camera;
+                if (Dot(toCenter, m.ConeAxis) >= m.ConeCutoff * toCenter.Magnitude + m.Radius)
+                    continue;
             }
+            if (!res.empty() && res.back().first + res.back().second == m.FaceOffset)
+                res.back().second += m.FaceCount;
+            else res.emplace_back(m.FaceOffset, m.FaceCount);
+        }
+        return res;
+    }
 
-            auto cvs = rn::find_if(mf.Attributes, [](auto& at) { return at.Name == ".corner_vert"sv; });
-            rn::copy(cvs->Buffer, (u8*)mesh->PointsOfCorners32.data());
+    void MeshData3D::SetFaceIndices(MeshAttributeType type, cspan<u8> faceLists, cspan<u8> faceIndexBytes)
+    {
+        assert(faceIndices == nullptr && (type == UInt16 || type == UInt32));
+        assert(faceLists.size() == FaceList->Buffer.size() && faceIndexBytes.size() == CornerCount * ByteSizeOfAttribute(type));
+        auto at = AddAttribute("FaceIndex", Point, type, CornerCount - PointCount);
+        rn::copy(faceIndexBytes, at->Buffer.data());
+        rn::copy(faceLists, FaceList->Buffer.data());
+        Uniform->FaceIndexOfPointOffset = at->IndexOffset;
+        faceIndices = at;
+    }
 
-            for (auto& uvIndex : mf.UvIndices)
+    namespace
+    {
+        LoadedScene LoadScene(SceneData* sceneData, SceneFile sf, ThreadPool* threadPool)
+        {
+            using namespace std::string_view_literals;
+            if (threadPool)
             {
-                auto& uv = mf.Attributes[uvIndex];
-                assert(uv.Type == Vec2F16);
-                auto uvAtt = mesh->AddUvMap(uv.Name);
-                auto uvValues = span{ (Vector2F16*)uv.Buffer.data(), mf.CornerCount };
-                rn::copy(uvValues, (Vector2F16*)uvAtt->Buffer.data());
+                vector<MeshFileBuffer*> encoded;
+                for (auto& mf : sf.Meshes)
+                for (auto& at : mf.Attributes)
+                {
+                    if (at.Buffer.IsEncoded)
+                        encoded.emplace_back(&at.Buffer);
+                    for (auto& m : at.Morphs)
+                    for (auto buffer : { &m.Buffer, &m.Indices }) if (buffer->IsEncoded)
+                        encoded.emplace_back(buffer);
+                }
+                for (auto& mf : sf.Meshes)
+                for (auto& lod : mf.Lods) if (lod.Corners.IsEncoded)
+                    encoded.emplace_back(&lod.Corners);
+                auto tasks = encoded | vs::transform([&](MeshFileBuffer* buffer) { return threadPool->Submit([=] { buffer->Decode(); }); }) | to_vector;
+                for (auto& task : tasks)
+                    task.get();
             }
+            auto build = [&](MeshFile& mf) -> unique_ptr<MeshData3D>
+            {
+                if (mf.FaceCount == 0)
+                    return nullptr;
+                assert("Invalid Mixed Topology!" && mf.CornerCount % mf.FaceCount == 0);
+                auto find = [&](string_view name) { auto it = rn::find_if(mf.Attributes, [&](auto& at) { return at.Name == name; }); return it != mf.Attributes.end() ? &*it : nullptr; };
+                auto pos = find("position"sv);
+
+                //Cooked shading is computed from the rest positions, it's only valid when no shape key is active.
+                auto shadingCooked = find(CookedFaceList) && rn::all_of(pos->Morphs | vs::drop(1), [](auto& m) { return m.Value == 0; });
+                //LODs still need their face normals and tangents computed.
+                auto tangentsCooked = shadingCooked && mf.Lods.empty() && rn::all_of(mf.UvIndices, [&](u32 i) { return find("{}{}"_f(CookedTangentPrefix, mf.Attributes[i].Name)) != nullptr; });
+
+                //Packed attributes are uploaded as they are unless a pipeline has to write them, which shape keys do.
+                auto packing = MeshPacking{};
+                auto morphed = pos->Morphs.size() > 1;
+                if (pos->Type == Vec3Q16 && !morphed)
+                    packing.Positions = mf.Bounds;
+                packing.UnitVectors = tangentsCooked && !morphed && find(CookedPointNormal)->Type == Vec3Oct;
+                UnpackAttributes(mf, !packing.Positions, !packing.UnitVectors);
+
+                auto mesh = make_unique<MeshData3D>(sceneData, mf.Name, mf.PointCount, mf.FaceCount, mf.CornerCount, move(packing));
+                rn::copy(pos->Buffer, mesh->Position->Buffer.data());
+
+                if (auto count = pos->Morphs.size(); count > 1)
+                {
+                    //Sparse shapes only save space on disk, they are expanded into full morphs against the first one.
+                    //UpdateShapePipeline evaluates every point of every shape and the shading passes cover the whole mesh.
+                    auto basis = span((const Vector3*)pos->Morphs[0].Buffer.data(), mf.PointCount);
+                    auto mp = mesh->Position;
+                    auto mAtt = mesh->AddAttributeMorphs(mp, (u32)count);
+                    for (auto it = (Vector3*)mAtt->Buffer.data(); auto [i, morph] : pos->Morphs | indexed)
+                    {
+                        auto& m = mp->Morphs.Values[i];
+                        m.Name  = morph.Name;
+                        m.Value = morph.Value;
+                        m.Min   = morph.Min;
+                        m.Max   = morph.Max;
+                        if (!morph.IsSparse)
+                        {
+                            it = rn::copy(span((const Vector3*)morph.Buffer.data(), mf.PointCount), it).out;
+                            continue;
+                        }
+                        auto points = span((const u32*)morph.Indices.data(), morph.Indices.size() / sizeof(u32));
+                        auto deltas = span((const Vector3*)morph.Buffer.data(), points.size());
+                        rn::copy(basis, it);
+                        for (auto [k, p] : points | uindexed32)
+                            it[p] = basis[p] + deltas[k];
+                        it += mf.PointCount;
+                    }
+                }
+
+                auto cvs = rn::find_if(mf.Attributes, [](auto& at) { return at.Name == ".corner_vert"sv; });
+                rn::copy(cvs->Buffer, (u8*)mesh->PointsOfCorners32.data());
+
+                for (auto& uvIndex : mf.UvIndices)
+                {
+                    auto& uv = mf.Attributes[uvIndex];
+                    assert(uv.Type == Vec2F16);
+                    auto uvAtt = mesh->AddUvMap(uv.Name);
+                    auto uvValues = span{ (Vector2F16*)uv.Buffer.data(), mf.CornerCount };
+                    rn::copy(uvValues, (Vector2F16*)uvAtt->Buffer.data());
+                }
+
+                for (auto& lod : mf.Lods)
+                    mesh->AddLod(lod);
+
+                mesh->SetMeshlets(move(mf.Meshlets));
+
+                if (shadingCooked)
+                {
+                    auto faceIndex = find(CookedFaceIndex);
+                    mesh->SetFaceIndices(faceIndex->Type, find(CookedFaceList)->Buffer, faceIndex->Buffer);
+                    rn::copy(find(CookedFaceNormal)->Buffer, mesh->NormalOfFace->Buffer.data());
+                    rn::copy(find(CookedPointNormal)->Buffer, mesh->Normal->Buffer.data());
+                    for (auto uv : mesh->Uvs) if (auto tg = find("{}{}"_f(CookedTangentPrefix, uv->Name)))
+                        rn::copy(tg->Buffer, mesh->FindAttribute("TangentOf{}"_f(uv->Name))->Buffer.data());
+                    mesh->CookedShading = tangentsCooked;
+                }
 
-            mesh->MaterialRanges = mf.Materials | vs::transform([](auto r) { return pair(r.Offset, r.Count); }) | to_vector;
+                mesh->MaterialRanges = mf.Materials | vs::transform([](auto r) { return pair(r.Offset, r.Count); }) | to_vector;
 
-            return mesh;
-        }) | to_vector;
-        return { move(meshes), move(sf.Objects), move(sf.Collection), };
+                return mesh;
+            };
+            if (!threadPool)
+                return { sf.Meshes | vs::transform(build) | to_vector, move(sf.Objects), move(sf.Collection), };
+            //Meshes only share SceneData's allocators, which are locked, everything else they write is their own.
+            auto tasks = sf.Meshes | vs::transform([&](MeshFile& mf) { return threadPool->Submit([&] { return build(mf); }); }) | to_vector;
+            auto meshes = tasks | vs::transform([](auto& task) { return task.get(); }) | to_vector;
+            //Built here rather than in the tasks above, which would block their workers waiting on the pool.
+            for (auto& mesh : meshes) if (mesh)
+                mesh->BuildFaceIndices(threadPool);
+            return { move(meshes), move(sf.Objects), move(sf.Collection), };
+        }
+
+    }
+
+    LoadedScene LoadSceneFile(SceneData* sceneData, crpath path, ThreadPool* threadPool)
+    {
+        return LoadScene(sceneData, SceneFile::Load(path, threadPool == nullptr), threadPool);
+    }
+
+    LoadedScene LoadSceneFile(SceneData* sceneData, crpath path, const SceneFileSelection& selection, ThreadPool* threadPool)
+    {
+        return LoadScene(sceneData, SceneFile::Load(path, selection, threadPool == nullptr), threadPool);
     }
 
 }
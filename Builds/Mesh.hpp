@@ -1,5 +1,6 @@
 #pragma once
 #include "Kaey/Renderer/Renderer.hpp"
+#include "Kaey/Renderer/ThreadPool.hpp"
 
 #include <Slang/TestPipeline.hpp>
 
@@ -19,6 +20,7 @@ namespace Kaey::Renderer
 
         mutable GPUVirtualMemoryAllocator sceneAllocator;
         mutable GPUVirtualMemoryAllocator attributeAllocator;
+        mutable std::mutex allocatorMutex;
 
         u32 sceneIndex;
 
@@ -42,6 +44,21 @@ namespace Kaey::Renderer
         KR_GETTER(GPUVirtualMemoryAllocator*, SceneAllocator) { return &sceneAllocator; }
         KR_GETTER(GPUVirtualMemoryAllocator*, AttributeAllocator) { return &attributeAllocator; }
 
+        //Unlike going through the allocators directly, these can be used while meshes are created concurrently.
+        template<class T>
+        u32 AllocateSceneIndex(u32 count) const
+        {
+            auto l = std::lock_guard(allocatorMutex);
+            return sceneAllocator.AllocateIndex32<T>(count);
+        }
+
+        template<class T>
+        u32 AllocateAttributeIndex(u32 count) const
+        {
+            auto l = std::lock_guard(allocatorMutex);
+            return attributeAllocator.AllocateIndex32<T>(count);
+        }
+
         KR_GETTER(u32, Index) { return sceneIndex; }
         KR_GETTER(UniformScene*, Data) { return (UniformScene*)sceneAllocator.MappedAddress + Index; }
 
@@ -84,6 +101,9 @@ namespace Kaey::Renderer
 
         vector<unique_ptr<MeshAttribute>> attributes;
 
+    protected:
+        MeshAttribute* AllocateAttribute(string name, MeshAttributeDomain domain, MeshAttributeType type, u32 count);
+
     public:
         MeshData2(SceneData* data, u32 pointCount, u32 faceCount, u32 cornerCount);
 
@@ -107,6 +127,30 @@ namespace Kaey::Renderer
 
     };
 
+    //Coarser topology over the points of a mesh, drawn through its own UniformMesh. Positions, normals and shape keys
+    //are shared with the full mesh, face normals and tangents are computed along with the full mesh's.
+    struct MeshLod
+    {
+        f32 Error;
+        u32 MeshIndex;
+        u32 FaceCount;
+        u32 CornerCount;
+        MeshAttribute* PointOfCorner;
+        MeshAttribute* NormalOfFace;
+        vector<MeshAttribute*> Uvs;
+        vector<pair<u32, u32>> MaterialRanges;
+    };
+
+    //Built by Cook, see GenerateMeshlets.
+    using Meshlet = MeshFileMeshlet;
+
+    //Layouts of PackAttributes uploaded as they are, the shaders decode them through UniformMesh.
+    struct MeshPacking
+    {
+        std::optional<MeshFileBounds> Positions; //Vec3Q16 within these bounds, shape keys can't write them.
+        bool UnitVectors = false;                //Vec3Oct normals and tangents, the Calc pipelines can't write them.
+    };
+
     class MeshData3D : public MeshData2
     {
         string name;
@@ -119,9 +163,15 @@ namespace Kaey::Renderer
 
         vector<MeshAttribute*> uvMaps;
 
+        vector<MeshLod> lods;
+
+        vector<Meshlet> meshlets;
+
+        MeshPacking packing;
+
     public:
 
-        MeshData3D(SceneData* data, string name, u32 pointCount, u32 faceCount, u32 cornerCount);
+        MeshData3D(SceneData* data, string name, u32 pointCount, u32 faceCount, u32 cornerCount, MeshPacking packing = {});
 
         KR_NO_COPY_MOVE(MeshData3D);
 
@@ -137,6 +187,26 @@ namespace Kaey::Renderer
 
         MeshAttribute* AddUvMap(string name);
 
+        //Gathers the corner attributes of the LOD from the full mesh, so uv maps have to be added first.
+        const MeshLod& AddLod(const MeshFileLod& lod);
+
+        //Coarsest LOD whose error covers at most 'maxPixelError' pixels, null when only the full mesh will do.
+        //'pixelsPerUnit' is how many pixels a unit spans at a distance of one: viewport height * abs(projection[1, 1]) / 2.
+        const MeshLod* SelectLod(f32 distance, f32 pixelsPerUnit, f32 maxPixelError = 1) const;
+
+        //Meshlets over the faces in their current order, used for culling on the CPU.
+        void SetMeshlets(vector<Meshlet> value) { meshlets = move(value); }
+
+        //Face ranges of the meshlets that may be visible, consecutive ones merged. 'planes' and 'camera' are in object space,
+        //planes keep the inside positive and don't need to be normalized. Cone culling is skipped without a camera.
+        vector<pair<u32, u32>> VisibleFaceRanges(cspan<Vector4> planes, const Vector3* camera = nullptr) const;
+
+        //Builds the face lists GetFaceIndices returns, in parallel chunks on 'threadPool' when one is given. Does nothing once they exist.
+        const MeshAttribute* BuildFaceIndices(ThreadPool* threadPool = nullptr) const;
+
+        //Uses face lists built offline instead of building them in GetFaceIndices.
+        void SetFaceIndices(MeshAttributeType type, cspan<u8> faceLists, cspan<u8> faceIndexBytes);
+
         KR_GETTER(string_view, Name) { return name; }
         KR_GETTER(u32, MeshIndex) { return meshIndex; }
         KR_GETTER(UniformMesh*, Uniform) { return (UniformMesh*)Data->SceneAllocator->MappedAddress + MeshIndex; }
@@ -148,6 +218,11 @@ namespace Kaey::Renderer
         KR_GETTER(MeshAttribute*, FaceList)      { return Attributes[4]; }
 
         KR_GETTER(cspan<MeshAttribute*>, Uvs)    { return uvMaps; }
+        KR_GETTER(cspan<MeshLod>,        Lods)   { return lods; }
+
+        KR_GETTER(cspan<Meshlet>, Meshlets) { return meshlets; }
+
+        KR_GETTER(const MeshPacking&, Packing) { return packing; }
 
         KR_GETTER(span<u16>,        PointsOfCorners16) { return {        (u16*)PointOfCorner->Buffer.data(), CornerCount }; }
         KR_GETTER(span<u32>,        PointsOfCorners32) { return {        (u32*)PointOfCorner->Buffer.data(), CornerCount }; }
@@ -156,6 +231,9 @@ namespace Kaey::Renderer
         KR_GETTER(span<Vector3F16>, Normals)           { return { (Vector3F16*)       Normal->Buffer.data(),  PointCount }; }
         KR_GETTER(span<u32>,        FaceLists)         { return {        (u32*)     FaceList->Buffer.data(),  PointCount }; }
 
+        //Normals and tangents were loaded already computed, the Calc functions only need to run after morphing.
+        bool CookedShading = false;
+
     };
 
     struct LoadedScene
@@ -165,6 +243,9 @@ namespace Kaey::Renderer
         unique_ptr<Collection> Collection;
     };
 
-    LoadedScene LoadSceneFile(SceneData* sceneData, crpath path);
+    //Encoded attributes are decoded on 'threadPool' when one is given.
+    LoadedScene LoadSceneFile(SceneData* sceneData, crpath path, ThreadPool* threadPool = nullptr);
+    //Only creates the meshes used by the selected objects, the others are left null.
+    LoadedScene LoadSceneFile(SceneData* sceneData, crpath path, const SceneFileSelection& selection, ThreadPool* threadPool = nullptr);
 
 }
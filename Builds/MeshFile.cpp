@@ -1,5 +1,15 @@
 #include "MeshFile.hpp"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace Kaey::Renderer
 {
     using enum MeshAttributeType;
@@ -22,10 +32,124 @@ namespace Kaey::Renderer
         case Vec2F16: return sizeof(Vector2F16);
         case Vec3F16: return sizeof(Vector3F16);
         case Vec4F16: return sizeof(Vector4F16);
+        case Vec3Oct: return sizeof(u32);
+        case Vec3Q16: return sizeof(Vector3Q16);
         default: throw invalid_argument("Invalid value for 'type': {}"_f((u32)type));
         }
     }
 
+    u32 EncodeOctahedral(const Vector3& n)
+    {
+        auto length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+        if (length == 0)
+            return 0;
+        auto x = n.x / length, y = n.y / length;
+        if (n.z < 0)
+            std::tie(x, y) = pair((1 - std::abs(y)) * (x >= 0 ? 1 : -1), (1 - std::abs(x)) * (y >= 0 ? 1 : -1));
+        auto unorm = [](f32 v) { return (u32)std::lround(std::clamp(v * .5f + .5f, 0.f, 1.f) * UINT16_MAX); };
+        //Every corner of the square decodes to -z, so the one that would collide with zero vectors can be swapped.
+        auto packed = unorm(x) | unorm(y) << 16;
+        return packed != 0 ? packed : ~0u;
+    }
+
+    Vector3 DecodeOctahedral(u32 packed)
+    {
+        if (packed == 0)
+            return { 0, 0, 0 };
+        auto x = f32(packed & UINT16_MAX) / UINT16_MAX * 2 - 1;
+        auto y = f32(packed >> 16) / UINT16_MAX * 2 - 1;
+        auto z = 1 - std::abs(x) - std::abs(y);
+        auto t = std::clamp(-z, 0.f, 1.f);
+        x += x >= 0 ? -t : t;
+        y += y >= 0 ? -t : t;
+        auto length = std::sqrt(x * x + y * y + z * z);
+        return { x / length, y / length, z / length };
+    }
+
+    Vector3Q16 QuantizePosition(const Vector3& p, const MeshFileBounds& bounds)
+    {
+        auto quantize = [](f32 v, f32 min, f32 max) { return max > min ? (u16)std::lround(std::clamp((v - min) / (max - min), 0.f, 1.f) * UINT16_MAX) : u16(0); };
+        auto& [min, max] = bounds;
+        return { quantize(p.x, min.x, max.x), quantize(p.y, min.y, max.y), quantize(p.z, min.z, max.z) };
+    }
+
+    Vector3 DequantizePosition(const Vector3Q16& q, const MeshFileBounds& bounds)
+    {
+        auto dequantize = [](u16 v, f32 min, f32 max) { return min + (max - min) * (f32(v) / UINT16_MAX); };
+        auto& [min, max] = bounds;
+        return { dequantize(q.x, min.x, max.x), dequantize(q.y, min.y, max.y), dequantize(q.z, min.z, max.z) };
+    }
+
+}
+
+namespace Kaey::Renderer
+{
+    MappedFile::MappedFile(crpath path) : data(nullptr), size(0)
+    {
+#ifdef _WIN32
+        auto file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            throw std::system_error((int)GetLastError(), std::system_category(), path.string());
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize))
+        {
+            auto err = (int)GetLastError();
+            CloseHandle(file);
+            throw std::system_error(err, std::system_category(), path.string());
+        }
+        size = (size_t)fileSize.QuadPart;
+        if (size > 0)
+        {
+            auto mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping)
+            {
+                data = (const u8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping); //The view keeps the mapping alive.
+            }
+        }
+        auto err = (int)GetLastError();
+        CloseHandle(file);
+        if (size > 0 && !data)
+            throw std::system_error(err, std::system_category(), path.string());
+#else
+        auto fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+            throw std::system_error(errno, std::generic_category(), path.string());
+        struct stat st;
+        if (fstat(fd, &st) == -1)
+        {
+            auto err = errno;
+            close(fd);
+            throw std::system_error(err, std::generic_category(), path.string());
+        }
+        size = (size_t)st.st_size;
+        if (size > 0)
+        {
+            auto ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr == MAP_FAILED)
+            {
+                auto err = errno;
+                close(fd);
+                throw std::system_error(err, std::generic_category(), path.string());
+            }
+            madvise(ptr, size, MADV_WILLNEED);
+            data = (const u8*)ptr;
+        }
+        close(fd); //The mapping keeps the file alive.
+#endif
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (!data)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap((void*)data, size);
+#endif
+    }
+
 }
 
 namespace Kaey::Renderer
@@ -34,54 +158,706 @@ namespace Kaey::Renderer
     {
         constexpr u32  MeshFileMagic = 'K' << 0u | 'M' << 8u | 'F' << 16u | '\0' << 24u;
         constexpr u32 SceneFileMagic = 'K' << 0u | 'S' << 8u | 'C' << 16u | '\0' << 24u;
+
+        constexpr u32  MeshFileMagicV2 = 'K' << 0u | 'M' << 8u | 'F' << 16u | '2' << 24u;
+        constexpr u32 SceneFileMagicV2 = 'K' << 0u | 'S' << 8u | 'C' << 16u | '2' << 24u;
+
+        constexpr u32 ContainerVersion = 2;
+        constexpr u64 SectionAlignment = 64;
+
+        //v2 layout: ContainerHeader, then the attribute/morph sections aligned to SectionAlignment, then the table.
+        //Only the table is parsed, sections are handed out as spans into the mapped file. Scene tables are an index of
+        //per-mesh entry sections, so meshes can be skipped without being parsed.
+        struct ContainerHeader
+        {
+            u32 Magic;
+            u32 Version;
+            u64 TableOffset;
+            u64 TableSize;
+        };
+
+        struct FileSection
+        {
+            u64 Offset;
+            u64 Size;
+            u64 DecodedSize;
+            MeshFileCodec Codec;
+            u32 Stride;
+        };
+
+        void WriteVarint(vector<u8>& out, u64 v)
+        {
+            for (; v >= 0x80; v >>= 7)
+                out.emplace_back(u8(v | 0x80));
+            out.emplace_back(u8(v));
+        }
+
+        u64 ReadVarint(const u8*& it, const u8* end)
+        {
+            u64 v = 0;
+            for (u32 shift = 0; shift < 64; shift += 7)
+            {
+                if (it == end)
+                    throw runtime_error("Truncated varint in encoded section.");
+                auto b = *it++;
+                v |= u64(b & 0x7F) << shift;
+                if ((b & 0x80) == 0)
+                    return v;
+            }
+            throw runtime_error("Varint too long in encoded section.");
+        }
+
+        template<class Int>
+        void EncodeDeltaVarint(cspan<u8> bytes, vector<u8>& out)
+        {
+            Int prev = 0;
+            for (auto i : irange(bytes.size() / sizeof(Int)))
+            {
+                Int v;
+                std::memcpy(&v, bytes.data() + i * sizeof(Int), sizeof(Int));
+                auto delta = (i64)v - (i64)prev;
+                WriteVarint(out, u64(delta << 1) ^ u64(delta >> 63));
+                prev = v;
+            }
+        }
+
+        template<class Int>
+        void DecodeDeltaVarint(cspan<u8> bytes, span<u8> out)
+        {
+            auto it = bytes.data(), end = it + bytes.size();
+            i64 prev = 0;
+            for (auto i : irange(out.size() / sizeof(Int)))
+            {
+                auto zz = ReadVarint(it, end);
+                prev += i64(zz >> 1) ^ -i64(zz & 1);
+                auto v = (Int)prev;
+                std::memcpy(out.data() + i * sizeof(Int), &v, sizeof(Int));
+            }
+        }
+
+        //Bounds first, then 3 u16 per element.
+        void EncodeQuantized16(cspan<u8> bytes, vector<u8>& out)
+        {
+            auto values = span((const f32*)bytes.data(), bytes.size() / sizeof(f32));
+            f32 min[3]{ 0, 0, 0 }, max[3]{ 0, 0, 0 };
+            for (auto c : irange(3))
+            {
+                if (values.empty())
+                    break;
+                auto [mn, mx] = rn::minmax(values | vs::drop(c) | vs::stride(3));
+                min[c] = mn;
+                max[c] = mx;
+            }
+            out.insert_range(out.end(), span((const u8*)min, sizeof(min)));
+            out.insert_range(out.end(), span((const u8*)max, sizeof(max)));
+            for (auto i : irange(values.size()))
+            {
+                auto c = i % 3;
+                auto extent = max[c] - min[c];
+                auto q = extent > 0 ? (u16)std::lround((values[i] - min[c]) / extent * 65535.f) : u16(0);
+                out.insert_range(out.end(), span((const u8*)&q, sizeof(q)));
+            }
+        }
+
+        void DecodeQuantized16(cspan<u8> bytes, span<u8> out)
+        {
+            f32 min[3], max[3];
+            auto values = span((f32*)out.data(), out.size() / sizeof(f32));
+            if (bytes.size() != sizeof(min) + sizeof(max) + values.size() * sizeof(u16))
+                throw runtime_error("Invalid size for a quantized section: {} bytes for {} components"_f(bytes.size(), values.size()));
+            std::memcpy(min, bytes.data(), sizeof(min));
+            std::memcpy(max, bytes.data() + sizeof(min), sizeof(max));
+            auto qs = bytes.subspan(sizeof(min) + sizeof(max));
+            for (auto i : irange(values.size()))
+            {
+                auto c = i % 3;
+                u16 q;
+                std::memcpy(&q, qs.data() + i * sizeof(u16), sizeof(q));
+                values[i] = min[c] + (max[c] - min[c]) * (f32(q) / 65535.f);
+            }
+        }
+
+        //Same byte of every component goes together, sign and exponent bytes then barely change between neighbours,
+        //so after the delta most of the planes are zeros. Stored as alternating [literal count, literals, zero count] runs.
+        void EncodeByteTransposed(cspan<u8> bytes, u32 stride, vector<u8>& out)
+        {
+            auto count = bytes.size() / stride;
+            vector<u8> planes(bytes.size());
+            for (u32 b = 0; b < stride; ++b)
+            {
+                u8 prev = 0;
+                for (auto i : irange(count))
+                {
+                    auto v = bytes[i * stride + b];
+                    planes[b * count + i] = u8(v - prev);
+                    prev = v;
+                }
+            }
+            for (size_t i = 0; i < planes.size();)
+            {
+                auto literals = i;
+                //Runs shorter than 3 zeros aren't worth splitting a literal run for.
+                while (literals < planes.size() && !(planes[literals] == 0 && literals + 2 < planes.size() && planes[literals + 1] == 0 && planes[literals + 2] == 0))
+                    ++literals;
+                auto zeros = literals;
+                while (zeros < planes.size() && planes[zeros] == 0)
+                    ++zeros;
+                WriteVarint(out, literals - i);
+                out.insert(out.end(), planes.begin() + (ptrdiff_t)i, planes.begin() + (ptrdiff_t)literals);
+                WriteVarint(out, zeros - literals);
+                i = zeros;
+            }
+        }
+
+        void DecodeByteTransposed(cspan<u8> bytes, u32 stride, span<u8> out)
+        {
+            vector<u8> planes(out.size());
+            auto it = bytes.data(), end = it + bytes.size();
+            for (size_t i = 0; i < planes.size();)
+            {
+                auto literals = ReadVarint(it, end);
+                if (literals > planes.size() - i || literals > size_t(end - it))
+                    throw runtime_error("Literal run out of bounds in encoded section.");
+                std::memcpy(planes.data() + i, it, literals);
+                it += literals;
+                i += literals;
+                auto zeros = ReadVarint(it, end);
+                if (zeros > planes.size() - i)
+                    throw runtime_error("Zero run out of bounds in encoded section.");
+                i += zeros;
+            }
+            auto count = out.size() / stride;
+            for (u32 b = 0; b < stride; ++b)
+            {
+                u8 prev = 0;
+                for (auto i : irange(count))
+                    out[i * stride + b] = prev = u8(prev + planes[b * count + i]);
+            }
+        }
+
+        void Encode(cspan<u8> bytes, MeshFileCodec codec, u32 stride, vector<u8>& out)
+        {
+            out.clear();
+            switch (codec)
+            {
+            case MeshFileCodec::DeltaVarint:
+            {
+                if (stride == sizeof(u16))
+                    EncodeDeltaVarint<u16>(bytes, out);
+                else EncodeDeltaVarint<u32>(bytes, out);
+            }break;
+            case MeshFileCodec::Quantized16:    EncodeQuantized16(bytes, out);            break;
+            case MeshFileCodec::ByteTransposed: EncodeByteTransposed(bytes, stride, out); break;
+            default: throw invalid_argument("Invalid value for 'codec': {}"_f((u32)codec));
+            }
+        }
+
+        //Positions may be quantized, anything else is lossless.
+        pair<MeshFileCodec, u32> CodecOf(const MeshFileAttribute& at, const MeshFileWriteOptions& options)
+        {
+            using enum MeshFileCodec;
+            if (!options.Compress && !options.QuantizePositions)
+                return { Raw, 0 };
+            if (options.QuantizePositions && at.Type == Vec3 && at.Name == "position")
+                return { Quantized16, sizeof(f32) };
+            if (!options.Compress)
+                return { Raw, 0 };
+            if (at.Name == ".corner_vert" && (at.Type == UInt16 || at.Type == UInt32))
+                return { DeltaVarint, ByteSizeOfAttribute(at.Type) };
+            switch (at.Type)
+            {
+            case UInt16: case Vec2F16: case Vec3F16: case Vec4F16: case Vec3Oct: case Vec3Q16:
+                return { ByteTransposed, sizeof(f16) };
+            case UInt32: case Float: case Vec2: case Vec3: case Vec4: case Vec2Int: case Vec3Int: case Vec4Int:
+                return { ByteTransposed, sizeof(f32) };
+            default: return { Raw, 0 };
+            }
+        }
+
+        void Decode(cspan<u8> bytes, MeshFileCodec codec, u32 stride, span<u8> out)
+        {
+            switch (codec)
+            {
+            case MeshFileCodec::DeltaVarint:
+            {
+                if (stride == sizeof(u16))
+                    DecodeDeltaVarint<u16>(bytes, out);
+                else DecodeDeltaVarint<u32>(bytes, out);
+            }break;
+            case MeshFileCodec::Quantized16:    DecodeQuantized16(bytes, out);            break;
+            case MeshFileCodec::ByteTransposed: DecodeByteTransposed(bytes, stride, out); break;
+            default: throw runtime_error("Invalid codec in section: {}"_f((u32)codec));
+            }
+        }
+
+        struct MorphEntry
+        {
+            string Name;
+            string BaseName;
+            f32 Value, Min, Max;
+            FileSection Section;
+        };
+
+        struct AttributeEntry
+        {
+            string Name;
+            MeshAttributeDomain Domain;
+            MeshAttributeType Type;
+            FileSection Section;
+            vector<MorphEntry> Morphs;
+        };
+
+        struct LodEntry
+        {
+            f32 Error;
+            u32 FaceCount;
+            FileSection Corners;
+            vector<MeshFileMaterialRange> Materials;
+        };
+
+        struct MeshEntry
+        {
+            string     Name;
+            u32  PointCount;
+            u32   EdgeCount;
+            u32   FaceCount;
+            u32 CornerCount;
+            vector<AttributeEntry> Attributes;
+            vector<u32> UvIndices;
+            vector<MeshFileMaterialRange> Materials;
+            vector<LodEntry> Lods;
+            vector<FileSection> MorphIndices; //One per morph of every attribute, in order. Empty sections for dense morphs.
+            MeshFileBounds Bounds;
+            FileSection Meshlets;
+        };
+
+        class SectionWriter
+        {
+            ostream& stream;
+            u32 magic;
+            vector<u8> scratch;
+
+            void Align()
+            {
+                static constexpr char Padding[SectionAlignment]{};
+                auto offset = (u64)stream.tellp();
+                if (auto rem = offset % SectionAlignment; rem != 0)
+                    stream.write(Padding, streamsize(SectionAlignment - rem));
+            }
+
+        public:
+            SectionWriter(ostream& stream, u32 magic) : stream(stream), magic(magic)
+            {
+                Serialize(stream, ContainerHeader{ magic, ContainerVersion, 0, 0 });
+            }
+
+            FileSection Write(cspan<u8> bytes, MeshFileCodec codec = MeshFileCodec::Raw, u32 stride = 0)
+            {
+                Align();
+                auto offset = (u64)stream.tellp();
+                if (codec != MeshFileCodec::Raw)
+                {
+                    Encode(bytes, codec, stride, scratch);
+                    //Sections that don't shrink are better off raw.
+                    if (scratch.size() < bytes.size())
+                    {
+                        stream.write((const char*)scratch.data(), (streamsize)scratch.size());
+                        return { offset, scratch.size(), bytes.size(), codec, stride };
+                    }
+                }
+                stream.write((const char*)bytes.data(), (streamsize)bytes.size());
+                return { offset, bytes.size(), bytes.size(), MeshFileCodec::Raw, 0 };
+            }
+
+            template<class... Args>
+            void Finish(const Args&... table)
+            {
+                Align();
+                auto offset = (u64)stream.tellp();
+                Serialize(stream, table...);
+                auto size = (u64)stream.tellp() - offset;
+                stream.seekp(0);
+                Serialize(stream, ContainerHeader{ magic, ContainerVersion, offset, size });
+                stream.seekp(0, std::ios::end);
+            }
+
+        };
+
+        MeshEntry WriteMesh(SectionWriter& writer, const MeshFile& mf, const MeshFileWriteOptions& options)
+        {
+            vector<FileSection> morphIndices;
+            auto attributes = mf.Attributes | vs::transform([&](const MeshFileAttribute& at)
+            {
+                auto [codec, stride] = CodecOf(at, options);
+                auto section = writer.Write(at.Buffer.Bytes, codec, stride);
+                auto morphs = at.Morphs | vs::transform([&](const MeshFileMorph& m)
+                {
+                    auto section = writer.Write(m.Buffer.Bytes, codec, stride);
+                    morphIndices.emplace_back(writer.Write(m.Indices.Bytes, options.Compress ? MeshFileCodec::DeltaVarint : MeshFileCodec::Raw, sizeof(u32)));
+                    return MorphEntry{ m.Name, m.BaseName, m.Value, m.Min, m.Max, section };
+                }) | to_vector;
+                return AttributeEntry{ at.Name, at.Domain, at.Type, section, move(morphs) };
+            }) | to_vector;
+            auto [codec, stride] = options.Compress ? pair(MeshFileCodec::DeltaVarint, (u32)sizeof(u32)) : pair(MeshFileCodec::Raw, 0u);
+            auto lods = mf.Lods | vs::transform([&](const MeshFileLod& lod)
+            {
+                return LodEntry{ lod.Error, lod.FaceCount, writer.Write(lod.Corners.Bytes, codec, stride), lod.Materials };
+            }) | to_vector;
+            auto meshlets = writer.Write(span((const u8*)mf.Meshlets.data(), mf.Meshlets.size() * sizeof(MeshFileMeshlet)));
+            return { mf.Name, mf.PointCount, mf.EdgeCount, mf.FaceCount, mf.CornerCount, move(attributes), mf.UvIndices, mf.Materials, move(lods), move(morphIndices), mf.Bounds, meshlets };
+        }
+
+        //Scenes keep each MeshEntry in its own section, so the table is only an index and unused meshes are never parsed.
+        FileSection WriteEntry(SectionWriter& writer, const MeshEntry& entry)
+        {
+            auto os = std::ostringstream(std::ios::binary);
+            Serialize(os, entry);
+            auto str = move(os).str();
+            return writer.Write(span((const u8*)str.data(), str.size()));
+        }
+
+        cspan<u8> BytesOf(const MappedFile& file, const FileSection& s)
+        {
+            auto bytes = file.Bytes;
+            if (s.Offset > bytes.size() || s.Size > bytes.size() - s.Offset)
+                throw runtime_error("Section out of bounds: [{}, {}) in a file of {} bytes"_f(s.Offset, s.Offset + s.Size, bytes.size()));
+            return bytes.subspan(s.Offset, s.Size);
+        }
+
+        MeshEntry ReadEntry(const MappedFile& file, const FileSection& s)
+        {
+            auto bytes = BytesOf(file, s);
+            auto is = std::ispanstream(span((const char*)bytes.data(), bytes.size()));
+            MeshEntry entry;
+            UnSerialize(is, entry);
+            return entry;
+        }
+
+        MeshFile ReadMesh(MeshEntry& entry, const shared_ptr<const MappedFile>& file)
+        {
+            auto sectionOf = [&](const FileSection& s)
+            {
+                return MeshFileBuffer(file, BytesOf(*file, s), s.Codec, s.Stride, s.DecodedSize);
+            };
+            size_t morphCount = 0;
+            for (auto& at : entry.Attributes)
+                morphCount += at.Morphs.size();
+            if (entry.MorphIndices.size() != morphCount)
+                throw runtime_error("Mesh '{}' has {} morph index sections for {} morphs"_f(entry.Name, entry.MorphIndices.size(), morphCount));
+            auto morphIndex = size_t(0);
+            auto attributes = entry.Attributes | vs::transform([&](AttributeEntry& at)
+            {
+                auto morphs = at.Morphs | vs::transform([&](MorphEntry& m)
+                {
+                    auto indices = sectionOf(entry.MorphIndices[morphIndex++]);
+                    return MeshFileMorph{ move(m.Name), move(m.BaseName), m.Value, m.Min, m.Max, sectionOf(m.Section), move(indices) };
+                }) | to_vector;
+                return MeshFileAttribute{ move(at.Name), at.Domain, at.Type, sectionOf(at.Section), move(morphs) };
+            }) | to_vector;
+            auto lods = entry.Lods | vs::transform([&](LodEntry& lod)
+            {
+                return MeshFileLod{ lod.Error, lod.FaceCount, sectionOf(lod.Corners), move(lod.Materials) };
+            }) | to_vector;
+            //Small next to the rest, copied out so they can be used as is.
+            auto meshletBytes = BytesOf(*file, entry.Meshlets);
+            vector<MeshFileMeshlet> meshlets(meshletBytes.size() / sizeof(MeshFileMeshlet));
+            std::memcpy(meshlets.data(), meshletBytes.data(), meshlets.size() * sizeof(MeshFileMeshlet));
+            return { move(entry.Name), entry.PointCount, entry.EdgeCount, entry.FaceCount, entry.CornerCount, move(attributes), move(entry.UvIndices), move(entry.Materials), move(lods), move(meshlets), entry.Bounds };
+        }
+
+        //Checks the header, returns a stream over the table.
+        std::ispanstream TableOf(const MappedFile& file)
+        {
+            auto bytes = file.Bytes;
+            ContainerHeader header;
+            if (bytes.size() < sizeof(header))
+                throw runtime_error("File is too small to contain a header: {} bytes"_f(bytes.size()));
+            std::memcpy(&header, bytes.data(), sizeof(header));
+            if (header.Version != ContainerVersion)
+                throw runtime_error("Unsupported container version: expected '{}', found '{}'"_f(ContainerVersion, header.Version));
+            if (header.TableOffset > bytes.size() || header.TableSize > bytes.size() - header.TableOffset)
+                throw runtime_error("Table out of bounds: [{}, {}) in a file of {} bytes"_f(header.TableOffset, header.TableOffset + header.TableSize, bytes.size()));
+            return std::ispanstream(span((const char*)bytes.data() + header.TableOffset, header.TableSize));
+        }
+
+        u32 MagicOf(const MappedFile& file)
+        {
+            u32 magic = 0;
+            if (file.Size < sizeof(magic))
+                throw runtime_error("File is too small to contain a magic: {} bytes"_f(file.Size));
+            std::memcpy(&magic, file.Bytes.data(), sizeof(magic));
+            return magic;
+        }
+
+        auto StreamOf(const MappedFile& file)
+        {
+            auto bytes = file.Bytes.subspan(sizeof(u32));
+            return std::ispanstream(span((const char*)bytes.data(), bytes.size()));
+        }
+
+        void DecodeBuffers(MeshFile& mf)
+        {
+            for (auto& at : mf.Attributes)
+            {
+                at.Buffer.Decode();
+                for (auto& m : at.Morphs)
+                {
+                    m.Buffer.Decode();
+                    m.Indices.Decode();
+                }
+            }
+            for (auto& lod : mf.Lods)
+                lod.Corners.Decode();
+        }
+
+    }
+
+    void MeshFileBuffer::Decode()
+    {
+        if (codec == MeshFileCodec::Raw)
+            return;
+        vector<u8> decoded(decodedSize);
+        Renderer::Decode(view, codec, stride, decoded);
+        storage = move(decoded);
+        mapping.reset();
+        view = storage;
+        codec = MeshFileCodec::Raw;
+    }
+
+    MeshFileMorph MakePositionMorph(string name, string baseName, f32 value, f32 min, f32 max, cspan<Vector3> basis, cspan<Vector3> shape)
+    {
+        assert(basis.size() == shape.size());
+        vector<u32> indices;
+        vector<Vector3> deltas;
+        for (auto [i, v] : shape | uindexed32) if (std::memcmp(&v, &basis[i], sizeof(Vector3)) != 0)
+        {
+            indices.emplace_back(i);
+            deltas.emplace_back(v - basis[i]);
+        }
+        auto bytesOf = []<class T>(const vector<T>& v) { return span((const u8*)v.data(), v.size() * sizeof(T)) | to_vector; };
+        if (indices.size() * (sizeof(u32) + sizeof(Vector3)) >= shape.size_bytes())
+            return { move(name), move(baseName), value, min, max, span((const u8*)shape.data(), shape.size_bytes()) | to_vector, {} };
+        return { move(name), move(baseName), value, min, max, bytesOf(deltas), bytesOf(indices) };
     }
 
-    void MeshFile::Save(crpath path) const
+    void PackAttributes(MeshFile& mf)
     {
-        auto os = ofstream(path, std::ios::ate | std::ios::binary);
+        auto bytesOf = []<class T>(const vector<T>& v) { return span((const u8*)v.data(), v.size() * sizeof(T)) | to_vector; };
+        for (auto& at : mf.Attributes)
+        {
+            if (at.Name == "position" && at.Type == Vec3 && mf.PointCount > 0)
+            {
+                auto positions = span((const Vector3*)at.Buffer.data(), mf.PointCount);
+                auto& [min, max] = mf.Bounds;
+                min = max = positions[0];
+                for (auto& p : positions)
+                {
+                    min = { std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z) };
+                    max = { std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z) };
+                }
+                at.Buffer = bytesOf(positions | vs::transform([&](const Vector3& p) { return QuantizePosition(p, mf.Bounds); }) | to_vector);
+                at.Type = Vec3Q16;
+                continue;
+            }
+            auto unit = at.Name == CookedFaceNormal || at.Name == CookedPointNormal || at.Name.starts_with(CookedTangentPrefix);
+            if (!unit || at.Type != Vec3F16)
+                continue;
+            auto values = span((const Vector3F16*)at.Buffer.data(), at.Buffer.size() / sizeof(Vector3F16));
+            at.Buffer = bytesOf(values | vs::transform([](const Vector3F16& v) { return EncodeOctahedral({ (f32)v.x, (f32)v.y, (f32)v.z }); }) | to_vector);
+            at.Type = Vec3Oct;
+        }
+    }
+
+    void UnpackAttributes(MeshFile& mf, bool positions, bool unitVectors)
+    {
+        auto bytesOf = []<class T>(const vector<T>& v) { return span((const u8*)v.data(), v.size() * sizeof(T)) | to_vector; };
+        for (auto& at : mf.Attributes)
+        {
+            if (at.Type == Vec3Q16 && positions)
+            {
+                auto values = span((const Vector3Q16*)at.Buffer.data(), at.Buffer.size() / sizeof(Vector3Q16));
+                at.Buffer = bytesOf(values | vs::transform([&](const Vector3Q16& q) { return DequantizePosition(q, mf.Bounds); }) | to_vector);
+                at.Type = Vec3;
+            }
+            else if (at.Type == Vec3Oct && unitVectors)
+            {
+                auto values = span((const u32*)at.Buffer.data(), at.Buffer.size() / sizeof(u32));
+                at.Buffer = bytesOf(values | vs::transform([](u32 packed) { auto n = DecodeOctahedral(packed); return Vector3F16{ (f16)n.x, (f16)n.y, (f16)n.z }; }) | to_vector);
+                at.Type = Vec3F16;
+            }
+        }
+    }
+
+    void MeshFile::Save(crpath path, const MeshFileWriteOptions& options) const
+    {
+        auto os = ofstream(path, std::ios::binary);
         if (!os.is_open())
             return;
-        Serialize(os,
-            MeshFileMagic,
-            *this
-        );
+        auto writer = SectionWriter(os, MeshFileMagicV2);
+        writer.Finish(WriteMesh(writer, *this, options));
     }
 
     MeshFile MeshFile::Load(crpath path)
     {
-        auto is = ifstream(path, std::ios::binary);
-        if (!is.is_open())
-            throw std::system_error(errno, std::generic_category(), path.string());
-        u32 magic;
-        UnSerialize(is, magic);
-        if (magic != MeshFileMagic)
-            throw runtime_error("Invalid magic in file: expected '{:x}', found '{:x}'"_f(MeshFileMagic, magic));
-        MeshFile mf;
-        UnSerialize(is, mf);
-        return mf;
+        auto file = make_shared<const MappedFile>(path);
+        switch (auto magic = MagicOf(*file))
+        {
+        case MeshFileMagicV2:
+        {
+            auto is = TableOf(*file);
+            MeshEntry entry;
+            UnSerialize(is, entry);
+            auto mf = ReadMesh(entry, file);
+            DecodeBuffers(mf);
+            return mf;
+        }
+        case MeshFileMagic:
+        {
+            auto is = StreamOf(*file);
+            MeshFile mf;
+            UnSerialize(is, mf);
+            return mf;
+        }
+        default: throw runtime_error("Invalid magic in file: expected '{:x}', found '{:x}'"_f(MeshFileMagicV2, magic));
+        }
     }
 
-    void SceneFile::Save(crpath path) const
+    void SceneFile::Save(crpath path, const MeshFileWriteOptions& options) const
     {
-        auto os = ofstream(path, std::ios::ate | std::ios::binary);
+        auto os = ofstream(path, std::ios::binary);
         if (!os.is_open())
             return;
-        Serialize(os, SceneFileMagic);
-        Serialize(os, *this);
+        auto writer = SectionWriter(os, SceneFileMagicV2);
+        auto index = Meshes | vs::transform([&](const MeshFile& mf) { return WriteEntry(writer, WriteMesh(writer, mf, options)); }) | to_vector;
+        writer.Finish(index, Objects, Materials, Collection);
     }
 
-    SceneFile SceneFile::Load(crpath path)
+    namespace
     {
-        auto is = ifstream(path, std::ios::binary);
-        if (!is.is_open())
-            throw std::system_error(errno, std::generic_category(), path.string());
-        u32 magic;
-        UnSerialize(is, magic);
-        if (magic != SceneFileMagic)
-            throw runtime_error("Invalid magic in file: expected '{:x}', found '{:x}'"_f(SceneFileMagic, magic));
-        SceneFile sf;
-        UnSerialize(is, sf);
-        return sf;
+        vector<bool> SelectMeshes(const SceneFile& sf, size_t meshCount, const SceneFileSelection& selection)
+        {
+            vector<bool> selected(meshCount, false);
+            auto select = [&](this auto&& self, const Collection& col, bool inside) -> void
+            {
+                if (selection.RenderEnabledOnly && !col.RenderEnabled)
+                    return;
+                inside = inside || col.Name == selection.Collection;
+                if (inside)
+                    for (auto id : col.ObjectIds) if (id < sf.Objects.size() && sf.Objects[id].DataIndex < meshCount)
+                        selected[sf.Objects[id].DataIndex] = true;
+                for (auto& child : col.Children)
+                    self(*child, inside);
+            };
+            if (sf.Collection)
+                select(*sf.Collection, selection.Collection.empty());
+            return selected;
+        }
+
+        SceneFile LoadScene(crpath path, const SceneFileSelection* selection, bool decode)
+        {
+            auto file = make_shared<const MappedFile>(path);
+            SceneFile sf;
+            switch (auto magic = MagicOf(*file))
+            {
+            case SceneFileMagicV2:
+            {
+                vector<FileSection> index;
+                auto is = TableOf(*file);
+                UnSerialize(is, index, sf.Objects, sf.Materials, sf.Collection);
+                auto selected = selection ? SelectMeshes(sf, index.size(), *selection) : vector(index.size(), true);
+                sf.Meshes = index | uindexed32 | vs::transform([&](auto p)
+                {
+                    auto& [i, section] = p;
+                    if (!selected[i])
+                        return MeshFile{};
+                    auto entry = ReadEntry(*file, section);
+                    return ReadMesh(entry, file);
+                }) | to_vector;
+            }break;
+            case SceneFileMagic:
+            {
+                //v1 has no index, so everything has to be parsed anyway.
+                auto is = StreamOf(*file);
+                UnSerialize(is, sf);
+                if (selection)
+                    for (auto selected = SelectMeshes(sf, sf.Meshes.size(), *selection); auto [i, mf] : sf.Meshes | uindexed32)
+                        if (!selected[i])
+                            mf = {};
+            }break;
+            default: throw runtime_error("Invalid magic in file: expected '{:x}', found '{:x}'"_f(SceneFileMagicV2, magic));
+            }
+            if (decode)
+                for (auto& mf : sf.Meshes)
+                    DecodeBuffers(mf);
+            return sf;
+        }
+
+    }
+
+    SceneFile SceneFile::Load(crpath path, bool decode)
+    {
+        return LoadScene(path, nullptr, decode);
+    }
+
+    SceneFile SceneFile::Load(crpath path, const SceneFileSelection& selection, bool decode)
+    {
+        return LoadScene(path, &selection, decode);
+    }
+
+    struct SceneFileWriter::State
+    {
+        ofstream Stream;
+        SectionWriter Writer;
+        vector<FileSection> Meshes;
+        bool Finished = false;
+
+        State(crpath path) : Stream(OpenForWrite(path)), Writer(Stream, SceneFileMagicV2)
+        {
+
+        }
+
+        static ofstream OpenForWrite(crpath path)
+        {
+            auto os = ofstream(path, std::ios::binary);
+            if (!os.is_open())
+                throw std::system_error(errno, std::generic_category(), path.string());
+            return os;
+        }
+
+    };
+
+    SceneFileWriter::SceneFileWriter(crpath path) : state(make_unique<State>(path))
+    {
+
+    }
+
+    SceneFileWriter::~SceneFileWriter() noexcept = default;
+
+    void SceneFileWriter::AddMesh(const MeshFile& mf, const MeshFileWriteOptions& options)
+    {
+        if (state->Finished)
+            throw runtime_error("Can't add meshes to a finished scene file.");
+        state->Meshes.emplace_back(WriteEntry(state->Writer, WriteMesh(state->Writer, mf, options)));
+        state->Stream.flush();
+    }
+
+    void SceneFileWriter::Finish(const vector<ObjectInstance>& objects, const vector<MeshFileMaterial>& materials, const unique_ptr<Collection>& collection)
+    {
+        if (state->Finished)
+            throw runtime_error("Scene file was already finished.");
+        state->Writer.Finish(state->Meshes, objects, materials, collection);
+        state->Stream.close();
+        state->Finished = true;
+    }
+
+    KR_GETTER_DEF(SceneFileWriter, MeshCount)
+    {
+        return (u32)state->Meshes.size();
+    }
+
+    KR_GETTER_DEF(SceneFileWriter, IsFinished)
+    {
+        return state->Finished;
     }
 
 }
@@ -27,6 +27,8 @@ namespace Kaey::Renderer
         Vec2F16,
         Vec3F16,
         Vec4F16,
+        Vec3Oct, //Unit vector folded onto an octahedron, two unorm16 in a u32.
+        Vec3Q16, //unorm16 per component within the bounds of its mesh.
     };
 
     enum class MeshRotationMode : u8
@@ -40,12 +42,148 @@ namespace Kaey::Renderer
         ZYX,
     };
 
+    //How a section is stored on disk, buffers are decoded back to Raw before being used.
+    enum class MeshFileCodec : u32
+    {
+        Raw,
+        DeltaVarint,    //u16/u32 indices as zigzag encoded deltas in LEB128 varints.
+        Quantized16,    //Vec3 with 16 bits per component, relative to the bounds of the section. Lossy.
+        ByteTransposed, //Byte planes of every component, delta encoded with the zero runs collapsed.
+    };
+
+    struct MeshFileWriteOptions
+    {
+        bool Compress = false;          //Picks a lossless codec for every section that benefits from one.
+        bool QuantizePositions = false; //Also stores positions and their shape keys as Quantized16.
+    };
+
+    //Attributes baked by Cook, MeshData3D copies them instead of computing them on load.
+    //Tangents are stored per uv map, named CookedTangentPrefix followed by the uv map name.
+    constexpr string_view CookedFaceList      = ".cooked_face_list";
+    constexpr string_view CookedFaceIndex     = ".cooked_face_index";
+    constexpr string_view CookedFaceNormal    = ".cooked_face_normal";
+    constexpr string_view CookedPointNormal   = ".cooked_point_normal";
+    constexpr string_view CookedTangentPrefix = ".cooked_tangent:";
+
     u32 ByteSizeOfAttribute(MeshAttributeType type);
 
+    struct Vector3Q16
+    {
+        u16 x, y, z;
+    };
+
+    struct MeshFileBounds
+    {
+        Vector3 Min, Max;
+    };
+
+    //Zero vectors are kept as 0, which no unit vector encodes to.
+    u32 EncodeOctahedral(const Vector3& n);
+    Vector3 DecodeOctahedral(u32 packed);
+
+    Vector3Q16 QuantizePosition(const Vector3& p, const MeshFileBounds& bounds);
+    Vector3 DequantizePosition(const Vector3Q16& q, const MeshFileBounds& bounds);
+
 }
 
 namespace Kaey::Renderer
 {
+    class MappedFile
+    {
+        const u8* data;
+        size_t size;
+
+    public:
+        explicit MappedFile(crpath path);
+
+        KR_NO_COPY_MOVE(MappedFile);
+
+        ~MappedFile();
+
+        KR_GETTER(cspan<u8>, Bytes) { return { data, size }; }
+        KR_GETTER(size_t, Size) { return size; }
+
+    };
+
+    //Either owns its bytes or views a section of a MappedFile, which is kept alive for as long as the buffer is.
+    //Sections stored with a codec stay encoded until Decode is called, so that can be done wherever it's convenient.
+    class MeshFileBuffer
+    {
+        vector<u8> storage;
+        shared_ptr<const MappedFile> mapping;
+        cspan<u8> view;
+        MeshFileCodec codec = MeshFileCodec::Raw;
+        u32 stride = 0;
+        u64 decodedSize = 0;
+
+    public:
+        MeshFileBuffer() = default;
+
+        MeshFileBuffer(vector<u8> data) : storage(move(data)), view(storage)
+        {
+
+        }
+
+        MeshFileBuffer(shared_ptr<const MappedFile> mapping, cspan<u8> view, MeshFileCodec codec = MeshFileCodec::Raw, u32 stride = 0, u64 decodedSize = 0)
+            : mapping(move(mapping)), view(view), codec(codec), stride(stride), decodedSize(decodedSize)
+        {
+
+        }
+
+        MeshFileBuffer(const MeshFileBuffer& other)
+            : storage(other.storage), mapping(other.mapping), view(mapping ? other.view : cspan<u8>(storage)), codec(other.codec), stride(other.stride), decodedSize(other.decodedSize)
+        {
+
+        }
+
+        MeshFileBuffer(MeshFileBuffer&& other) noexcept
+            : storage(move(other.storage)), mapping(move(other.mapping)), view(std::exchange(other.view, {})),
+              codec(std::exchange(other.codec, MeshFileCodec::Raw)), stride(other.stride), decodedSize(other.decodedSize)
+        {
+
+        }
+
+        MeshFileBuffer& operator=(MeshFileBuffer other) noexcept
+        {
+            storage.swap(other.storage);
+            mapping.swap(other.mapping);
+            std::swap(view, other.view);
+            std::swap(codec, other.codec);
+            std::swap(stride, other.stride);
+            std::swap(decodedSize, other.decodedSize);
+            return *this;
+        }
+
+        const u8* data() const { assert(codec == MeshFileCodec::Raw); return view.data(); }
+        size_t size() const { assert(codec == MeshFileCodec::Raw); return view.size(); }
+        bool empty() const { return size() == 0; }
+
+        auto begin() const { return data(); }
+        auto end() const { return data() + size(); }
+
+        //Detaches from the mapping on first write, mapped files are read only.
+        u8* MutableData()
+        {
+            assert(codec == MeshFileCodec::Raw);
+            if (mapping)
+            {
+                storage.assign(view.begin(), view.end());
+                mapping.reset();
+                view = storage;
+            }
+            return storage.data();
+        }
+
+        //Thread safe as long as each buffer is only decoded by one thread.
+        void Decode();
+
+        KR_GETTER(cspan<u8>, Bytes) { assert(codec == MeshFileCodec::Raw); return view; }
+        KR_GETTER(bool, IsMapped) { return mapping != nullptr; }
+        KR_GETTER(bool, IsEncoded) { return codec != MeshFileCodec::Raw; }
+        KR_GETTER(MeshFileCodec, Codec) { return codec; }
+
+    };
+
     struct MeshFileMaterial
     {
         string Name;
@@ -63,18 +201,56 @@ namespace Kaey::Renderer
         string Name;
         string BaseName;
         f32 Value, Min, Max;
-        vector<u8> Buffer;
+        MeshFileBuffer Buffer;  //Every element of the attribute, or only the deltas from the first morph of the elements in Indices. Never packed.
+        MeshFileBuffer Indices; //u32 per element the morph moves, ascending. Only stored by v2 files.
+
+        //A sparse morph that moves nothing has neither buffer.
+        KR_GETTER(bool, IsSparse) { return !Indices.empty() || Buffer.empty(); }
     };
 
+    //Keeps only the points 'shape' moves away from 'basis', unless storing all of them is smaller.
+    //This is a storage encoding only, loaders expand it back into a full morph.
+    MeshFileMorph MakePositionMorph(string name, string baseName, f32 value, f32 min, f32 max, cspan<Vector3> basis, cspan<Vector3> shape);
+
     struct MeshFileAttribute
     {
         string Name;
         MeshAttributeDomain Domain;
         MeshAttributeType Type;
-        vector<u8> Buffer;
+        MeshFileBuffer Buffer;
         vector<MeshFileMorph> Morphs;
     };
 
+    //Coarser topology over the points of the full mesh, so point attributes and shape keys are shared with it.
+    struct MeshFileLod
+    {
+        f32 Error; //Distance to the full mesh it was allowed to deviate by, in mesh units.
+        u32 FaceCount;
+        MeshFileBuffer Corners; //u32 per corner, the corner of the full mesh its point and corner attributes come from.
+        vector<MeshFileMaterialRange> Materials;
+    };
+
+    //Run of consecutive faces with few enough points and triangles to be culled as a whole.
+    struct MeshFileMeshlet
+    {
+        Vector3 Center;
+        f32 Radius;         //Grown by how far shape keys can move the points.
+        Vector3 ConeAxis;   //Average outward normal of its faces.
+        f32 ConeCutoff;     //Sine of the widest angle between ConeAxis and a face normal, 1 when the cone can't be used.
+        u32 FaceOffset;
+        u32 FaceCount;
+        u32 PointCount;
+        u32 Padding;
+    };
+    static_assert(sizeof(MeshFileMeshlet) == 3 * sizeof(Vector4));
+
+    struct MeshLodOptions
+    {
+        u32 LevelCount = 4;
+        f32 FaceRatio = .5f;  //Faces each level keeps from the previous one.
+        f32 MaxError = .05f;  //No collapse may deviate more than this, in mesh units, which can end the chain early.
+    };
+
     struct MeshFile
     {
         string     Name;
@@ -85,10 +261,35 @@ namespace Kaey::Renderer
         vector<MeshFileAttribute> Attributes;
         vector<u32> UvIndices;
         vector<MeshFileMaterialRange> Materials;
-        void Save(crpath path) const;
+        vector<MeshFileLod> Lods; //Ordered from finest to coarsest, only stored by v2 files.
+        vector<MeshFileMeshlet> Meshlets; //Over the faces of the full mesh in their stored order, only stored by v2 files.
+        MeshFileBounds Bounds{};  //What Vec3Q16 attributes are relative to, only stored by v2 files.
+        void Save(crpath path, const MeshFileWriteOptions& options = {}) const;
         static MeshFile Load(crpath path);
     };
 
+    //Quadric error edge collapses of triangles onto existing points, points where a corner attribute or the
+    //material changes are kept in place, as are borders. 'cornerAttributes' hold one element per corner.
+    vector<MeshFileLod> BuildMeshLods(cspan<Vector3> positions, cspan<u32> pointsOfCorners, cspan<MeshFileMaterialRange> materials, cspan<cspan<u8>> cornerAttributes, const MeshLodOptions& options = {});
+
+    //Replaces the LODs of a triangulated mesh, other meshes are left without any.
+    void GenerateLods(MeshFile& mf, const MeshLodOptions& options = {});
+
+    //Splits the faces, in their current order, into meshlets. 'reach' is how far each point can get from 'positions'
+    //through shape keys, empty when none move it.
+    vector<MeshFileMeshlet> BuildMeshlets(cspan<Vector3> positions, cspan<u32> pointsOfCorners, u32 cornerPerFace, cspan<f32> reach, u32 maxPoints = 64, u32 maxTriangles = 124);
+
+    //Replaces the meshlets of a mesh from its rest positions and shape keys, faces can't be reordered afterwards.
+    //Positions have to be unpacked.
+    void GenerateMeshlets(MeshFile& mf, u32 maxPoints = 64, u32 maxTriangles = 124);
+
+    //Stores the positions as Vec3Q16 within Bounds and the cooked normals and tangents as Vec3Oct, which is lossy.
+    //Shape keys keep full precision. LODs have to be generated before, they need the full precision positions.
+    void PackAttributes(MeshFile& mf);
+
+    //Turns Vec3Q16 positions back into Vec3 and Vec3Oct unit vectors into Vec3F16, either kind can be left packed.
+    void UnpackAttributes(MeshFile& mf, bool positions = true, bool unitVectors = true);
+
     enum class ObjectType
     {
         Mesh,
@@ -129,14 +330,43 @@ namespace Kaey::Renderer
         KR_BITFIELD_PROP(RenderEnabled,    Flags, 3);
     };
 
+    //Part of a scene to load. Objects and collections are always loaded, meshes only when a selected object uses them.
+    struct SceneFileSelection
+    {
+        string Collection;              //Objects under the collection with this name, any if empty.
+        bool RenderEnabledOnly = false; //Skips collections without RenderEnabled, along with their children.
+    };
+
     struct SceneFile
     {
         vector<MeshFile> Meshes;
         vector<ObjectInstance> Objects;
         vector<MeshFileMaterial> Materials;
         unique_ptr<Collection> Collection;
-        void Save(crpath path) const;
-        static SceneFile Load(crpath path);
+        void Save(crpath path, const MeshFileWriteOptions& options = {}) const;
+        //Without 'decode', encoded buffers are left for the caller to decode, possibly in parallel.
+        static SceneFile Load(crpath path, bool decode = true);
+        //Meshes that aren't selected are left empty, so ObjectInstance::DataIndex stays valid.
+        static SceneFile Load(crpath path, const SceneFileSelection& selection, bool decode = true);
+    };
+
+    //Writes a SceneFile incrementally, mesh data goes to disk as soon as it's added and only the table is kept in memory.
+    //The table is written by Finish, a writer destroyed before it leaves a file that fails to load.
+    class SceneFileWriter
+    {
+        struct State;
+        unique_ptr<State> state;
+    public:
+        explicit SceneFileWriter(crpath path);
+        KR_NO_COPY_MOVE(SceneFileWriter);
+        ~SceneFileWriter() noexcept;
+
+        void AddMesh(const MeshFile& mf, const MeshFileWriteOptions& options = {});
+        void Finish(const vector<ObjectInstance>& objects, const vector<MeshFileMaterial>& materials, const unique_ptr<Collection>& collection);
+
+        KR_GETTER(u32, MeshCount);
+        KR_GETTER(bool, IsFinished);
+
     };
 
 }
@@ -368,6 +598,56 @@ namespace Kaey
 
     };
 
+    template<>
+    struct Serializer<Renderer::MeshFileBuffer>
+    {
+        void Serialize(ostream& stream, const Renderer::MeshFileBuffer& buffer) const
+        {
+            Kaey::Serialize(stream, buffer.size());
+            stream.write((const char*)buffer.data(), (streamsize)buffer.size());
+        }
+
+        void UnSerialize(istream& stream, Renderer::MeshFileBuffer& buffer) const
+        {
+            vector<u8> data;
+            Kaey::UnSerialize(stream, data);
+            buffer = move(data);
+        }
+
+    };
+
+    //v1 files predate sparse morphs and LODs, which v2 stores in its own tables.
+    template<>
+    struct Serializer<Renderer::MeshFileMorph>
+    {
+        void Serialize(ostream& stream, const Renderer::MeshFileMorph& m) const
+        {
+            assert(!m.IsSparse);
+            Kaey::Serialize(stream, m.Name, m.BaseName, m.Value, m.Min, m.Max, m.Buffer);
+        }
+
+        void UnSerialize(istream& stream, Renderer::MeshFileMorph& m) const
+        {
+            Kaey::UnSerialize(stream, m.Name, m.BaseName, m.Value, m.Min, m.Max, m.Buffer);
+        }
+
+    };
+
+    template<>
+    struct Serializer<Renderer::MeshFile>
+    {
+        void Serialize(ostream& stream, const Renderer::MeshFile& mf) const
+        {
+            Kaey::Serialize(stream, mf.Name, mf.PointCount, mf.EdgeCount, mf.FaceCount, mf.CornerCount, mf.Attributes, mf.UvIndices, mf.Materials);
+        }
+
+        void UnSerialize(istream& stream, Renderer::MeshFile& mf) const
+        {
+            Kaey::UnSerialize(stream, mf.Name, mf.PointCount, mf.EdgeCount, mf.FaceCount, mf.CornerCount, mf.Attributes, mf.UvIndices, mf.Materials);
+        }
+
+    };
+
     template<>
     struct Serializer<string_view>
     {
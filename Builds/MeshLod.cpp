@@ -0,0 +1,402 @@
+#include "MeshFile.hpp"
+
+namespace Kaey::Renderer
+{
+    using enum MeshAttributeDomain;
+    using enum MeshAttributeType;
+
+    namespace
+    {
+        constexpr u32 CornerPerFace = 3;
+        constexpr u32 MinFaceCount  = 16;
+        constexpr u32 None          = u32(-1);
+
+        Vector3 Cross(const Vector3& a, const Vector3& b)
+        {
+            return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+        }
+
+        f32 Dot(const Vector3& a, const Vector3& b)
+        {
+            return a.x * b.x + a.y * b.y + a.z * b.z;
+        }
+
+        //Sum of squared distances to a set of planes, as the upper triangle of a symmetric 4x4 matrix.
+        struct Quadric
+        {
+            f64 XX = 0, XY = 0, XZ = 0, XW = 0, YY = 0, YZ = 0, YW = 0, ZZ = 0, ZW = 0, WW = 0;
+
+            static Quadric Plane(const Vector3& n, f64 d)
+            {
+                return { n.x * n.x, n.x * n.y, n.x * n.z, n.x * d, n.y * n.y, n.y * n.z, n.y * d, n.z * n.z, n.z * d, d * d };
+            }
+
+            Quadric& operator+=(const Quadric& o)
+            {
+                XX += o.XX; XY += o.XY; XZ += o.XZ; XW += o.XW;
+                YY += o.YY; YZ += o.YZ; YW += o.YW;
+                ZZ += o.ZZ; ZW += o.ZW;
+                WW += o.WW;
+                return *this;
+            }
+
+            f64 Error(const Vector3& p) const
+            {
+                f64 x = p.x, y = p.y, z = p.z;
+                auto e = XX * x * x + YY * y * y + ZZ * z * z + WW + 2 * (XY * x * y + XZ * x * z + YZ * y * z + XW * x + YW * y + ZW * z);
+                return std::max(e, 0.0);
+            }
+        };
+
+        //Points that can't be moved without breaking something: borders, non-manifold edges, seams of corner attributes and material boundaries.
+        vector<bool> LockedPoints(u32 pointCount, cspan<u32> corners, cspan<u32> materialOfFaces, cspan<cspan<u8>> cornerAttributes)
+        {
+            vector<bool> locked(pointCount, false);
+            vector<u32> firstCorner(pointCount, None);
+            for (auto [c, p] : corners | uindexed32)
+            {
+                auto& first = firstCorner[p];
+                if (first == None)
+                {
+                    first = c;
+                    continue;
+                }
+                if (materialOfFaces[c / CornerPerFace] != materialOfFaces[first / CornerPerFace])
+                    locked[p] = true;
+                for (auto bytes : cornerAttributes)
+                {
+                    auto size = bytes.size() / corners.size();
+                    if (std::memcmp(bytes.data() + first * size, bytes.data() + c * size, size) != 0)
+                        locked[p] = true;
+                }
+            }
+            unordered_map<u64, u32> edgeFaces;
+            edgeFaces.reserve(corners.size());
+            for (auto face : irange(u32(corners.size() / CornerPerFace)))
+            for (auto k : irange(CornerPerFace))
+            {
+                auto a = corners[face * CornerPerFace + k], b = corners[face * CornerPerFace + (k + 1) % CornerPerFace];
+                ++edgeFaces[u64(std::min(a, b)) << 32 | std::max(a, b)];
+            }
+            for (auto [edge, count] : edgeFaces) if (count != 2)
+                locked[u32(edge >> 32)] = locked[u32(edge)] = true;
+            return locked;
+        }
+
+        struct Collapse
+        {
+            f64 Cost;
+            u32 From, To;
+        };
+
+    }
+
+    vector<MeshFileLod> BuildMeshLods(cspan<Vector3> positions, cspan<u32> pointsOfCorners, cspan<MeshFileMaterialRange> materials, cspan<cspan<u8>> cornerAttributes, const MeshLodOptions& options)
+    {
+        auto pointCount = (u32)positions.size();
+        auto faceCount = u32(pointsOfCorners.size() / CornerPerFace);
+        vector<MeshFileLod> lods;
+        if (faceCount < MinFaceCount || options.LevelCount == 0)
+            return lods;
+
+        vector<u32> materialOfFaces(faceCount, 0);
+        for (auto [i, r] : materials | uindexed32)
+            for (auto face = r.Offset; face < r.Offset + r.Count && face < faceCount; ++face)
+                materialOfFaces[face] = i;
+        auto locked = LockedPoints(pointCount, pointsOfCorners, materialOfFaces, cornerAttributes);
+
+        auto faceNormal = [&](cspan<u32> face) { return Cross(positions[face[1]] - positions[face[0]], positions[face[2]] - positions[face[0]]); };
+
+        vector<Quadric> quadrics(pointCount);
+        for (auto face : irange(faceCount))
+        {
+            auto fc = pointsOfCorners.subspan(face * CornerPerFace, CornerPerFace);
+            auto n = faceNormal(fc);
+            auto length = std::sqrt(Dot(n, n));
+            if (length == 0)
+                continue;
+            n = n * (1 / length);
+            auto q = Quadric::Plane(n, -Dot(n, positions[fc[0]]));
+            for (auto p : fc)
+                quadrics[p] += q;
+        }
+
+        //'sources' is the corner of the full mesh each corner now takes its point and attributes from.
+        auto corners = pointsOfCorners | to_vector;
+        auto sources = irange((u32)corners.size()) | to_vector;
+        vector<bool> alive(faceCount, true);
+        auto aliveCount = faceCount;
+        auto maxCost = f64(options.MaxError) * options.MaxError;
+        auto error = 0.0;
+
+        vector<u32> faceOffsets, facesOfPoints;
+        vector<bool> touched;
+        vector<Collapse> collapses;
+        for (u32 level = 0; level < options.LevelCount; ++level)
+        {
+            auto target = u32(aliveCount * options.FaceRatio);
+            if (target < MinFaceCount)
+                break;
+            auto before = aliveCount;
+            //Each pass collapses an independent set of edges, cheapest first, then the adjacency is rebuilt.
+            while (aliveCount > target)
+            {
+                faceOffsets.assign(pointCount + 1, 0);
+                for (auto face : irange(faceCount)) if (alive[face])
+                    for (auto k : irange(CornerPerFace))
+                        ++faceOffsets[corners[face * CornerPerFace + k] + 1];
+                std::partial_sum(faceOffsets.begin(), faceOffsets.end(), faceOffsets.begin());
+                facesOfPoints.resize(faceOffsets.back());
+                {
+                    auto cursor = faceOffsets;
+                    for (auto face : irange(faceCount)) if (alive[face])
+                        for (auto k : irange(CornerPerFace))
+                            facesOfPoints[cursor[corners[face * CornerPerFace + k]]++] = face;
+                }
+                auto facesOf = [&](u32 p) { return span(facesOfPoints).subspan(faceOffsets[p], faceOffsets[p + 1] - faceOffsets[p]); };
+
+                collapses.clear();
+                for (auto p : irange(pointCount)) if (!locked[p])
+                {
+                    auto best = Collapse{ maxCost, p, p };
+                    for (auto face : facesOf(p))
+                    for (auto to : span(corners).subspan(face * CornerPerFace, CornerPerFace)) if (to != p)
+                    {
+                        auto q = quadrics[p];
+                        q += quadrics[to];
+                        if (auto cost = q.Error(positions[to]); cost <= best.Cost)
+                            best = { cost, p, to };
+                    }
+                    if (best.To != p)
+                        collapses.emplace_back(best);
+                }
+                rn::sort(collapses, {}, &Collapse::Cost);
+
+                touched.assign(pointCount, false);
+                auto applied = u32(0);
+                for (auto& [cost, from, to] : collapses)
+                {
+                    if (aliveCount <= target)
+                        break;
+                    if (touched[from] || touched[to])
+                        continue;
+                    //Corners moving to 'to' take its attributes from a face on the collapsed edge, which is on their side of any seam at 'to'.
+                    auto source = None;
+                    auto flips = false;
+                    for (auto face : facesOf(from)) if (alive[face])
+                    {
+                        auto fc = span(corners).subspan(face * CornerPerFace, CornerPerFace);
+                        if (auto it = rn::find(fc, to); it != fc.end())
+                        {
+                            if (source == None)
+                                source = sources[face * CornerPerFace + u32(it - fc.begin())];
+                            continue;
+                        }
+                        u32 moved[CornerPerFace];
+                        rn::replace_copy(fc, moved, from, to);
+                        auto n0 = faceNormal(fc), n1 = faceNormal(moved);
+                        flips |= Dot(n0, n1) <= 0;
+                    }
+                    if (flips || source == None)
+                        continue;
+                    for (auto face : facesOf(from)) if (alive[face])
+                    {
+                        auto fc = span(corners).subspan(face * CornerPerFace, CornerPerFace);
+                        if (rn::contains(fc, to))
+                        {
+                            alive[face] = false;
+                            --aliveCount;
+                            continue;
+                        }
+                        for (auto k : irange(CornerPerFace)) if (fc[k] == from)
+                        {
+                            fc[k] = to;
+                            sources[face * CornerPerFace + k] = source;
+                        }
+                    }
+                    quadrics[to] += quadrics[from];
+                    touched[from] = touched[to] = true;
+                    error = std::max(error, cost);
+                    ++applied;
+                }
+                if (applied == 0)
+                    break;
+            }
+            //Levels that got stuck halfway, on locked points or MaxError, aren't worth storing.
+            if (aliveCount > target + (before - target) / 2)
+                break;
+
+            vector<u32> lodCorners, lodFaces;
+            lodCorners.reserve(aliveCount * CornerPerFace);
+            lodFaces.reserve(aliveCount);
+            for (auto face : irange(faceCount)) if (alive[face])
+            {
+                lodFaces.emplace_back(face);
+                lodCorners.insert_range(lodCorners.end(), span(sources).subspan(face * CornerPerFace, CornerPerFace));
+            }
+            //Faces keep their order, so every material is still a single range.
+            vector<MeshFileMaterialRange> lodMaterials;
+            for (u32 offset = 0; auto& r : materials)
+            {
+                auto count = (u32)rn::count_if(lodFaces, [&](u32 face) { return face >= r.Offset && face < r.Offset + r.Count; });
+                lodMaterials.emplace_back(r.MaterialIndex, offset, count);
+                offset += count;
+            }
+            auto bytesOf = [](const vector<u32>& v) { return span((const u8*)v.data(), v.size() * sizeof(u32)) | to_vector; };
+            lods.emplace_back((f32)std::sqrt(error), aliveCount, bytesOf(lodCorners), move(lodMaterials));
+        }
+        return lods;
+    }
+
+    void GenerateLods(MeshFile& mf, const MeshLodOptions& options)
+    {
+        mf.Lods.clear();
+        if (mf.FaceCount == 0 || mf.CornerCount != mf.FaceCount * CornerPerFace)
+            return;
+        auto find = [&](string_view name) { auto it = rn::find_if(mf.Attributes, [&](auto& at) { return at.Name == name; }); return it != mf.Attributes.end() ? &*it : nullptr; };
+        auto pos = find("position");
+        auto cvs = find(".corner_vert");
+        if (!pos || !cvs || pos->Type != Vec3)
+            return;
+        auto corners = cvs->Type == UInt16
+            ? span((const u16*)cvs->Buffer.data(), mf.CornerCount) | vs::transform([](u16 i) { return (u32)i; }) | to_vector
+            : span((const u32*)cvs->Buffer.data(), mf.CornerCount) | to_vector;
+        auto cornerAttributes = mf.Attributes
+            | vs::filter([&](auto& at) { return at.Domain == Corner && &at != cvs; })
+            | vs::transform([](auto& at) { return cspan<u8>(at.Buffer); })
+            | to_vector;
+        mf.Lods = BuildMeshLods(span((const Vector3*)pos->Buffer.data(), mf.PointCount), corners, mf.Materials, cornerAttributes, options);
+    }
+
+    vector<MeshFileMeshlet> BuildMeshlets(cspan<Vector3> positions, cspan<u32> pointsOfCorners, u32 cornerPerFace, cspan<f32> reach, u32 maxPoints, u32 maxTriangles)
+    {
+        auto trianglesPerFace = cornerPerFace - 2;
+        if (maxPoints < cornerPerFace || maxTriangles < trianglesPerFace)
+            throw invalid_argument("Meshlets must fit at least one face!");
+        auto pointCount = (u32)positions.size();
+        auto faceCount = u32(pointsOfCorners.size() / cornerPerFace);
+        auto pointsOf = [&](u32 face) { return pointsOfCorners.subspan(face * cornerPerFace, cornerPerFace); };
+        auto reachOf = [&](u32 p) { return reach.empty() ? 0.f : reach[p]; };
+        auto length = [](const Vector3& v) { return std::sqrt(Dot(v, v)); };
+        //Newell's method, negated since faces are clockwise in engine coordinates.
+        auto outwardNormal = [&](cspan<u32> face)
+        {
+            auto n = Vector3{ 0, 0, 0 };
+            for (auto i : irange((u32)face.size()))
+                n = n + Cross(positions[face[i]], positions[face[(i + 1) % face.size()]]);
+            return n * -1.f;
+        };
+
+        vector<MeshFileMeshlet> res;
+        vector<u32> stamp(pointCount, None);
+        vector<u32> points;
+        vector<Vector3> normals;
+        for (u32 face = 0; face < faceCount;)
+        {
+            auto id = (u32)res.size();
+            points.clear();
+            auto first = face;
+            for (; face < faceCount && (face - first + 1) * trianglesPerFace <= maxTriangles; ++face)
+            {
+                auto added = (u32)rn::count_if(pointsOf(face), [&](u32 p) { return stamp[p] != id; });
+                if (points.size() + added > maxPoints)
+                    break;
+                for (auto p : pointsOf(face)) if (stamp[p] != id)
+                {
+                    stamp[p] = id;
+                    points.emplace_back(p);
+                }
+            }
+
+            auto& m = res.emplace_back();
+            m.FaceOffset = first;
+            m.FaceCount  = face - first;
+            m.PointCount = (u32)points.size();
+            m.Padding    = 0;
+
+            auto min = positions[points[0]], max = min;
+            for (auto p : points)
+            {
+                auto& v = positions[p];
+                min = { std::min(min.x, v.x), std::min(min.y, v.y), std::min(min.z, v.z) };
+                max = { std::max(max.x, v.x), std::max(max.y, v.y), std::max(max.z, v.z) };
+            }
+            m.Center = (min + max) * .5f;
+            m.Radius = 0;
+            auto morphs = false;
+            for (auto p : points)
+            {
+                m.Radius = std::max(m.Radius, length(positions[p] - m.Center) + reachOf(p));
+                morphs |= reachOf(p) > 0;
+            }
+
+            //Shape keys can turn faces any way, so those meshlets are only frustum culled.
+            m.ConeAxis   = { 0, 0, 0 };
+            m.ConeCutoff = 1;
+            if (morphs)
+                continue;
+            normals.clear();
+            for (auto f : irange(m.FaceCount))
+            {
+                auto n = outwardNormal(pointsOf(first + f));
+                if (auto l = length(n); l > 0)
+                    normals.emplace_back(n * (1 / l));
+            }
+            auto axis = Vector3{ 0, 0, 0 };
+            for (auto& n : normals)
+                axis = axis + n;
+            auto l = length(axis);
+            if (l == 0)
+                continue;
+            m.ConeAxis = axis * (1 / l);
+            auto minDot = 1.f;
+            for (auto& n : normals)
+                minDot = std::min(minDot, Dot(n, m.ConeAxis));
+            if (minDot > 0)
+                m.ConeCutoff = std::sqrt(1 - minDot * minDot);
+        }
+        return res;
+    }
+
+    void GenerateMeshlets(MeshFile& mf, u32 maxPoints, u32 maxTriangles)
+    {
+        mf.Meshlets.clear();
+        if (mf.FaceCount == 0)
+            return;
+        auto find = [&](string_view name) { auto it = rn::find_if(mf.Attributes, [&](auto& at) { return at.Name == name; }); return it != mf.Attributes.end() ? &*it : nullptr; };
+        auto pos = find("position");
+        auto cvs = find(".corner_vert");
+        if (!pos || !cvs || pos->Type != Vec3)
+            return;
+        auto corners = cvs->Type == UInt16
+            ? span((const u16*)cvs->Buffer.data(), mf.CornerCount) | vs::transform([](u16 i) { return (u32)i; }) | to_vector
+            : span((const u32*)cvs->Buffer.data(), mf.CornerCount) | to_vector;
+
+        //Shape keys are applied over the first morph, which MeshData3D loads as the rest positions.
+        auto positions = span((const Vector3*)(pos->Morphs.size() > 1 ? pos->Morphs[0].Buffer : pos->Buffer).data(), mf.PointCount);
+        //How far each point can get from its rest position with every shape key at its extreme.
+        vector<f32> reach;
+        for (auto& morph : pos->Morphs | vs::drop(1))
+        {
+            if (reach.empty())
+                reach.assign(mf.PointCount, 0);
+            auto extreme = std::max(std::abs(morph.Min), std::abs(morph.Max));
+            auto distance = [](const Vector3& v) { return std::sqrt(Dot(v, v)); };
+            if (morph.IsSparse)
+            {
+                auto indices = span((const u32*)morph.Indices.data(), morph.Indices.size() / sizeof(u32));
+                auto deltas = span((const Vector3*)morph.Buffer.data(), indices.size());
+                for (auto [k, p] : indices | uindexed32)
+                    reach[p] += distance(deltas[k]) * extreme;
+            }
+            else
+            {
+                auto values = span((const Vector3*)morph.Buffer.data(), mf.PointCount);
+                for (auto p : irange(mf.PointCount))
+                    reach[p] += distance(values[p] - positions[p]) * extreme;
+            }
+        }
+        mf.Meshlets = BuildMeshlets(positions, corners, mf.CornerCount / mf.FaceCount, reach, maxPoints, maxTriangles);
+    }
+
+}
@@ -0,0 +1,58 @@
+#include "MeshTopology.hpp"
+#include "Parallel.hpp"
+
+namespace Kaey::Renderer
+{
+    //Chunks smaller than this don't pay for their task.
+    constexpr u32 MinChunkSize = 1 << 16;
+
+    template<class Index, class Face>
+    void BuildPointFaces(cspan<Index> pointsOfCorners, u32 cornerPerFace, span<u32> faceLists, span<Face> faceIndices, ThreadPool* threadPool)
+    {
+        assert(!faceLists.empty() && faceIndices.size() == pointsOfCorners.size());
+        auto pointCount = u32(faceLists.size() - 1);
+        auto cornerCount = (u32)pointsOfCorners.size();
+
+        //Histogram shifted by one, so the prefix sum leaves the offset of every point in place.
+        rn::fill(faceLists, 0);
+        ParallelChunks(threadPool, cornerCount, MinChunkSize, [&](u32 begin, u32 end)
+        {
+            for (auto c = begin; c < end; ++c)
+                std::atomic_ref(faceLists[pointsOfCorners[c] + 1]).fetch_add(1, std::memory_order_relaxed);
+        });
+
+        //Each chunk sums its counts, the sums are scanned, then each chunk scans its counts from its sum.
+        auto chunk = ChunkSizeOf(threadPool, pointCount + 1, MinChunkSize);
+        vector<u32> sums((pointCount + chunk) / chunk, 0);
+        ParallelChunks(threadPool, pointCount + 1, MinChunkSize, [&](u32 begin, u32 end)
+        {
+            sums[begin / chunk] = std::accumulate(faceLists.begin() + begin, faceLists.begin() + end, 0u);
+        });
+        std::exclusive_scan(sums.begin(), sums.end(), sums.begin(), 0u);
+        ParallelChunks(threadPool, pointCount + 1, MinChunkSize, [&](u32 begin, u32 end)
+        {
+            std::inclusive_scan(faceLists.begin() + begin, faceLists.begin() + end, faceLists.begin() + begin, std::plus(), sums[begin / chunk]);
+        });
+
+        auto cursors = faceLists.first(pointCount) | to_vector;
+        ParallelChunks(threadPool, cornerCount, MinChunkSize, [&](u32 begin, u32 end)
+        {
+            for (auto c = begin; c < end; ++c)
+                faceIndices[std::atomic_ref(cursors[pointsOfCorners[c]]).fetch_add(1, std::memory_order_relaxed)] = Face(c / cornerPerFace);
+        });
+        //Scattering from many threads leaves each list in any order, sorting them makes the result the same as a serial build.
+        if (ChunkSizeOf(threadPool, cornerCount, MinChunkSize) >= cornerCount)
+            return;
+        ParallelChunks(threadPool, pointCount, MinChunkSize, [&](u32 begin, u32 end)
+        {
+            for (auto p = begin; p < end; ++p)
+                std::sort(faceIndices.begin() + faceLists[p], faceIndices.begin() + faceLists[p + 1]);
+        });
+    }
+
+    template void BuildPointFaces<u16, u16>(cspan<u16>, u32, span<u32>, span<u16>, ThreadPool*);
+    template void BuildPointFaces<u16, u32>(cspan<u16>, u32, span<u32>, span<u32>, ThreadPool*);
+    template void BuildPointFaces<u32, u16>(cspan<u32>, u32, span<u32>, span<u16>, ThreadPool*);
+    template void BuildPointFaces<u32, u32>(cspan<u32>, u32, span<u32>, span<u32>, ThreadPool*);
+
+}
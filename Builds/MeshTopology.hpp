@@ -0,0 +1,13 @@
+#pragma once
+#include "Kaey/Renderer/ThreadPool.hpp"
+#include "Kaey/Renderer/Utility.hpp"
+
+namespace Kaey::Renderer
+{
+    //Faces around every point in CSR form, those of point p being faceIndices[faceLists[p], faceLists[p + 1]) in ascending order.
+    //'faceLists' holds one offset per point plus the total, 'faceIndices' one face per corner. Built as a counting sort,
+    //in parallel chunks on 'threadPool' when one is given. Instantiated for u16 and u32 in both.
+    template<class Index, class Face>
+    void BuildPointFaces(cspan<Index> pointsOfCorners, u32 cornerPerFace, span<u32> faceLists, span<Face> faceIndices, ThreadPool* threadPool = nullptr);
+
+}
@@ -0,0 +1,311 @@
+#include "ObjFile.hpp"
+#include "Parallel.hpp"
+
+#include <charconv>
+
+namespace Kaey::Renderer
+{
+    namespace
+    {
+        constexpr u32 None = u32(-1);
+        constexpr size_t MinChunkSize = 1 << 20;
+
+        enum class LineKind
+        {
+            Other,
+            Position,
+            Uv,
+            Face,
+            Group,
+        };
+
+        //Also strips the keyword from 'line'.
+        LineKind KindOf(string_view& line)
+        {
+            auto start = line.find_first_not_of(" \t");
+            if (start == string_view::npos)
+                return LineKind::Other;
+            line.remove_prefix(start);
+            auto keyword = line.substr(0, line.find_first_of(" \t"));
+            line.remove_prefix(keyword.size());
+            return
+                keyword == "v"                    ? LineKind::Position :
+                keyword == "vt"                   ? LineKind::Uv       :
+                keyword == "f"                    ? LineKind::Face     :
+                keyword == "o" || keyword == "g"  ? LineKind::Group    :
+                LineKind::Other;
+        }
+
+        //Calls 'fn' with every line of 'text', without its line break.
+        void ForEachLine(string_view text, auto&& fn)
+        {
+            while (!text.empty())
+            {
+                auto end = text.find('\n');
+                auto line = text.substr(0, end);
+                if (!line.empty() && line.back() == '\r')
+                    line.remove_suffix(1);
+                fn(line);
+                text.remove_prefix(end == string_view::npos ? text.size() : end + 1);
+            }
+        }
+
+        //Numbers go through from_chars, which doesn't allocate nor look at the locale.
+        template<class T>
+        bool Parse(string_view& s, T& value)
+        {
+            auto start = s.find_first_not_of(" \t");
+            if (start == string_view::npos)
+                return false;
+            s.remove_prefix(start);
+            if (s.front() == '+')
+                s.remove_prefix(1);
+            auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+            if (ec != std::errc())
+                return false;
+            s.remove_prefix(size_t(ptr - s.data()));
+            return true;
+        }
+
+        struct Group
+        {
+            string Name;
+            bool Named; //Started by an 'o' or 'g' line, otherwise it continues the last group of the previous chunk.
+            size_t CornerOffset;
+        };
+
+        struct Chunk
+        {
+            string_view Text;
+            size_t PositionCount = 0, PositionOffset = 0;
+            size_t UvCount = 0, UvOffset = 0;
+            vector<Group> Groups;
+            vector<u32> Corners;   //Index in the whole file of the position of every corner.
+            vector<u32> CornerUvs; //Same for texture coordinates, None when the corner has none.
+        };
+
+        //Splits at line breaks, so no line is cut in two.
+        vector<Chunk> SplitChunks(string_view text, size_t chunkCount)
+        {
+            auto size = std::max(MinChunkSize, text.size() / chunkCount + 1);
+            vector<Chunk> chunks;
+            while (!text.empty())
+            {
+                auto end = size < text.size() ? text.find('\n', size - 1) : string_view::npos;
+                end = end == string_view::npos ? text.size() : end + 1;
+                chunks.emplace_back().Text = text.substr(0, end);
+                text.remove_prefix(end);
+            }
+            return chunks;
+        }
+
+        //Open addressing with linear probing, from the points of the file to those of a shape.
+        class PointRemap
+        {
+            vector<pair<u32, u32>> slots;
+            u32 mask;
+            u32 count;
+
+            void Grow()
+            {
+                auto old = move(slots);
+                slots.assign(old.size() * 2, { None, None });
+                mask = u32(slots.size() - 1);
+                for (auto& [key, value] : old) if (key != None)
+                    for (auto i = Hash(key);; i = (i + 1) & mask) if (slots[i].first == None)
+                    {
+                        slots[i] = { key, value };
+                        break;
+                    }
+            }
+
+            u32 Hash(u32 key) const { return (key * 0x9E3779B1u) & mask; }
+
+        public:
+            explicit PointRemap(size_t expected) : mask(0), count(0)
+            {
+                slots.assign(std::bit_ceil(std::max<size_t>(expected * 2, 64)), { None, None });
+                mask = u32(slots.size() - 1);
+            }
+
+            //Index of 'key' in the shape, 'next' when it's new.
+            pair<u32, bool> Emplace(u32 key, u32 next)
+            {
+                if ((count + 1) * 2 > slots.size())
+                    Grow();
+                for (auto i = Hash(key);; i = (i + 1) & mask)
+                {
+                    auto& [k, v] = slots[i];
+                    if (k == key)
+                        return { v, false };
+                    if (k == None)
+                    {
+                        k = key;
+                        v = next;
+                        ++count;
+                        return { next, true };
+                    }
+                }
+            }
+
+        };
+
+        struct Shape
+        {
+            string Name;
+            vector<pair<const Chunk*, pair<size_t, size_t>>> Ranges; //Corners of each chunk that belong to the shape.
+            size_t CornerCount = 0;
+        };
+
+    }
+
+    vector<ObjMesh> LoadObjFile(crpath path, ThreadPool* threadPool)
+    {
+        auto file = MappedFile(path);
+        auto text = string_view((const char*)file.Bytes.data(), file.Size);
+        auto chunks = SplitChunks(text, threadPool ? std::max(1u, std::thread::hardware_concurrency()) * 4 : 1);
+
+        //Relative indices need to know how many positions came before, so those are counted first.
+        ParallelFor(threadPool, chunks.size(), [&](size_t i)
+        {
+            auto& chunk = chunks[i];
+            ForEachLine(chunk.Text, [&](string_view line)
+            {
+                switch (KindOf(line))
+                {
+                case LineKind::Position: ++chunk.PositionCount; break;
+                case LineKind::Uv:       ++chunk.UvCount;       break;
+                default: break;
+                }
+            });
+        });
+        auto positionCount = size_t(0), uvCount = size_t(0);
+        for (auto& chunk : chunks)
+        {
+            chunk.PositionOffset = std::exchange(positionCount, positionCount + chunk.PositionCount);
+            chunk.UvOffset       = std::exchange(uvCount, uvCount + chunk.UvCount);
+        }
+        if (positionCount >= None || uvCount >= None)
+            throw runtime_error("Too many vertices in '{}'"_f(path.string()));
+
+        vector<Vector3> positions(positionCount);
+        vector<Vector2> uvs(uvCount);
+        ParallelFor(threadPool, chunks.size(), [&](size_t i)
+        {
+            auto& chunk = chunks[i];
+            chunk.Groups.emplace_back(string(), false, 0);
+            auto position = chunk.PositionOffset;
+            auto uv = chunk.UvOffset;
+            vector<pair<u32, u32>> face;
+            auto resolve = [&](i64 index, size_t before, size_t total)
+            {
+                auto resolved = index > 0 ? index - 1 : i64(before) + index;
+                if (index == 0 || resolved < 0 || resolved >= i64(total))
+                    throw runtime_error("Invalid index '{}' in '{}'"_f(index, path.string()));
+                return u32(resolved);
+            };
+            ForEachLine(chunk.Text, [&](string_view line)
+            {
+                switch (KindOf(line))
+                {
+                case LineKind::Position:
+                {
+                    auto& p = positions[position++];
+                    if (!Parse(line, p.x) || !Parse(line, p.y) || !Parse(line, p.z))
+                        throw runtime_error("Invalid position in '{}'"_f(path.string()));
+                }break;
+                case LineKind::Uv:
+                {
+                    auto& t = uvs[uv++];
+                    if (!Parse(line, t.x))
+                        throw runtime_error("Invalid texture coordinate in '{}'"_f(path.string()));
+                    if (!Parse(line, t.y))
+                        t.y = 0;
+                }break;
+                case LineKind::Face:
+                {
+                    face.clear();
+                    for (i64 index; Parse(line, index);)
+                    {
+                        auto& [p, t] = face.emplace_back(resolve(index, position, positionCount), None);
+                        if (line.empty() || line.front() != '/')
+                            continue;
+                        line.remove_prefix(1);
+                        if (!line.empty() && line.front() != '/' && Parse(line, index))
+                            t = resolve(index, uv, uvCount);
+                        //Normals are skipped.
+                        if (!line.empty() && line.front() == '/')
+                        {
+                            line.remove_prefix(1);
+                            Parse(line, index);
+                        }
+                    }
+                    for (auto k = size_t(2); k < face.size(); ++k)
+                    for (auto c : { size_t(0), k - 1, k })
+                    {
+                        chunk.Corners.emplace_back(face[c].first);
+                        chunk.CornerUvs.emplace_back(face[c].second);
+                    }
+                }break;
+                case LineKind::Group:
+                {
+                    auto first = line.find_first_not_of(" \t");
+                    auto name = first == string_view::npos ? string_view() : line.substr(first, line.find_last_not_of(" \t") + 1 - first);
+                    chunk.Groups.emplace_back(string(name), true, chunk.Corners.size());
+                }break;
+                default: break;
+                }
+            });
+        });
+
+        vector<Shape> shapes;
+        for (auto& chunk : chunks)
+        for (auto [i, group] : chunk.Groups | indexed)
+        {
+            auto end = i + 1 < chunk.Groups.size() ? chunk.Groups[i + 1].CornerOffset : chunk.Corners.size();
+            if (group.Named || shapes.empty())
+                shapes.emplace_back().Name = group.Name;
+            auto& shape = shapes.back();
+            if (end > group.CornerOffset)
+            {
+                shape.Ranges.emplace_back(&chunk, pair(group.CornerOffset, end));
+                shape.CornerCount += end - group.CornerOffset;
+            }
+        }
+        //Groups without faces, like a 'g' right before an 'o', don't make a mesh.
+        std::erase_if(shapes, [](const Shape& shape) { return shape.CornerCount == 0; });
+
+        vector<ObjMesh> meshes(shapes.size());
+        ParallelFor(threadPool, shapes.size(), [&](size_t i)
+        {
+            auto& shape = shapes[i];
+            auto& mesh = meshes[i];
+            mesh.Name = move(shape.Name);
+            mesh.PointsOfCorners.reserve(shape.CornerCount);
+            if (uvCount > 0)
+                mesh.Uvs.reserve(shape.CornerCount);
+            auto remap = PointRemap(shape.CornerCount / 4);
+            for (auto& [chunk, range] : shape.Ranges)
+            for (auto c = range.first; c < range.second; ++c)
+            {
+                auto [point, inserted] = remap.Emplace(chunk->Corners[c], (u32)mesh.Positions.size());
+                if (inserted)
+                {
+                    auto& p = positions[chunk->Corners[c]];
+                    mesh.Positions.emplace_back(-p.x, p.y, p.z);
+                }
+                mesh.PointsOfCorners.emplace_back(point);
+                if (uvCount == 0)
+                    continue;
+                auto t = chunk->CornerUvs[c];
+                auto uv = t != None ? uvs[t] : Vector2{ 0, 0 };
+                f32 y;
+                uv.y = 1 - std::modf(uv.y, &y);
+                uv.y += y;
+                mesh.Uvs.emplace_back((f16)uv.x, (f16)uv.y);
+            }
+        });
+        return meshes;
+    }
+
+}
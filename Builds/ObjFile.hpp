@@ -0,0 +1,21 @@
+#pragma once
+#include "Kaey/Renderer/ThreadPool.hpp"
+
+#include "MeshFile.hpp"
+
+namespace Kaey::Renderer
+{
+    //A shape of an OBJ file, with only the points it uses. Faces are fan triangulated, x is mirrored and v flipped.
+    struct ObjMesh
+    {
+        string Name;
+        vector<Vector3> Positions;
+        vector<u32> PointsOfCorners;
+        vector<Vector2F16> Uvs; //One per corner, empty when the file has no texture coordinates.
+    };
+
+    //The file is split into line aligned chunks, parsed in parallel on 'threadPool' when one is given.
+    //Shapes start at every 'o' or 'g' line, normals, materials and smoothing groups are ignored.
+    vector<ObjMesh> LoadObjFile(crpath path, ThreadPool* threadPool = nullptr);
+
+}
@@ -13,6 +13,8 @@
 #include <Slang/OutlinePipeline.hpp>
 
 #include "Mesh.hpp"
+#include "ObjFile.hpp"
+#include "TextureFile.hpp"
 
 namespace Kaey::Renderer
 {
@@ -98,117 +100,28 @@ extern const auto Shaders = fs::path(SHADERS_PATH);
 namespace
 {
     
-    vector<unique_ptr<MeshData3D>> LoadObj(const tinyobj::ObjReader& reader, SceneData* sceneData)
+    vector<unique_ptr<MeshData3D>> LoadObj(crpath path, SceneData* sceneData, ThreadPool* threadPool = nullptr)
     {
-        auto& at = reader.GetAttrib();
-        auto posSpan = span{ (const Vector3*)at.vertices.data(),   at.vertices.size() / 3 };
-        auto uvSpan  = span{ (const Vector2*)at.texcoords.data(), at.texcoords.size() / 2 };
-        u32 vertexDelta = 0;
-        auto load = [&](const tinyobj::shape_t& shape) -> unique_ptr<MeshData3D>
+        auto load = [&](ObjMesh& mesh) -> unique_ptr<MeshData3D>
         {
-            auto& mesh = shape.mesh;
+            auto cornerCount = (u32)mesh.PointsOfCorners.size();
+            if (mesh.Uvs.empty())
+                mesh.Uvs.assign(cornerCount, { (f16)0, (f16)1 });
 
-            auto cornerCount = mesh.indices.size();
-
-            vector<u32> pointsOfCorners; pointsOfCorners.reserve(cornerCount);
-            vector<Vector2F16> uvs; uvs.reserve(cornerCount);
-
-            u32 vertexCount = 0;
-            for (auto faceIt = mesh.indices.data(); auto faceCount : mesh.num_face_vertices)
-            {
-                for (auto faceId : irange(faceCount))
-                {
-                    auto& [vIndex, nIndex, uvIndex] = faceIt[faceId];
-                    auto index = pointsOfCorners.emplace_back(vIndex - vertexDelta);
-                    vertexCount = std::max(vertexCount, index + 1);
-                    {
-                        auto uv = uvIndex != -1 ? uvSpan[uvIndex] : 0_xy;
-                        float y;
-                        uv.y = 1 - std::modf(uv.y, &y);
-                        uv.y += y;
-                        uvs.emplace_back((f16)uv.x, (f16)uv.y);
-                    }
-                }
-                faceIt += faceCount;
-            }
-            vertexDelta += vertexCount;
-
-            auto meshData = make_unique<MeshData3D>(sceneData, string(), vertexCount, (u32)cornerCount / 3, (u32)cornerCount);
+            auto meshData = make_unique<MeshData3D>(sceneData, move(mesh.Name), (u32)mesh.Positions.size(), cornerCount / 3, cornerCount);
 
             if (meshData->PointOfCorner->Type == UInt32)
-                rn::copy(pointsOfCorners, meshData->PointsOfCorners32.data());
-            else rn::copy(pointsOfCorners, meshData->PointsOfCorners16.data());
+                rn::copy(mesh.PointsOfCorners, meshData->PointsOfCorners32.data());
+            else rn::copy(mesh.PointsOfCorners, meshData->PointsOfCorners16.data());
 
-            rn::copy(posSpan.subspan(0, vertexCount) | vs::multiplied(-1_x + 1_y), meshData->Positions.data());
-            posSpan = posSpan.subspan(vertexCount);
+            rn::copy(mesh.Positions, meshData->Positions.data());
 
-            auto uvAtt = meshData->AddAttribute("UVMap", Corner, Vec2F16);
-            rn::copy(uvs, (Vector2F16*)uvAtt->Buffer.data());
+            auto uvAtt = meshData->AddUvMap("UVMap");
+            rn::copy(mesh.Uvs, (Vector2F16*)uvAtt->Buffer.data());
 
             return meshData;
         };
-        return reader.GetShapes() | vs::transform(load) | to_vector;
-    }
-
-    vector<unique_ptr<MeshData3D>> LoadObj(crpath path, SceneData* sceneData)
-    {
-        tinyobj::ObjReader reader;
-        tinyobj::ObjReaderConfig config;
-        config.triangulate = true;
-        if (!reader.ParseFromFile(path.string(), config))
-            throw runtime_error("!");
-        return LoadObj(reader, sceneData);
-    }
-
-}
-
-namespace
-{
-    template<class T>
-    T saturate(T v)
-    {
-        return std::clamp(v, T(0), T(1));
-    }
-
-    Vector2 OctWrap(Vector2 v)
-    {
-        auto c = Vector2(v.x >= 0 ? 1 : -1, v.y >= 0 ? 1 : -1);
-        return (1_xy - Vector2(abs(v.y), abs(v.x))) * c;
-    }
-
-    Vector2 Encode(Vector3 n)
-    {
-        n /= abs(n.x) + abs(n.y) + abs(n.z);
-        n.xy = n.z >= 0.0 ? n.xy : OctWrap(n.xy);
-        n.xy = n.xy * 0.5 + 0.5_xy;
-        return n.xy;
-    }
-
-    Vector3 Decode(Vector2 f)
-    {
-        f = f * 2 - 1_xy;
-        auto n = Vector3(f.x, f.y, 1.f - abs(f.x) - abs(f.y));
-        auto t = saturate(-n.z);
-        n.x += n.x >= 0 ? -t : t;
-        n.y += n.y >= 0 ? -t : t;
-        return n.Normalized;
-    }
-
-    u32 EncodeU(Vector3 n)
-    {
-        auto [x, y] = Encode(n);
-        auto lo = u32(u16(x * 65535)) <<  0;
-        auto hi = u32(u16(y * 65535)) << 16;
-        return lo | hi;
-    }
-
-    Vector3 DecodeU(u32 u)
-    {
-        auto lo = u32(u & 0x0000FFFF) >>  0;
-        auto hi = u32(u & 0xFFFF0000) >> 16;
-        auto x = f32(lo) / 65535;
-        auto y = f32(hi) / 65535;
-        return Decode({ x, y });
+        return LoadObjFile(path, threadPool) | vs::transform(load) | to_vector;
     }
 
 }
@@ -344,27 +257,44 @@ int main(int argc, char* argv[])
 
         static constexpr auto& TexPath = ASSETS_PATH "/Textures/Genesis 9/Characters/Naoimhe 9/Naoimhe";
         static constexpr auto& TexExt  = "jpg";
+        //Textures cooked next to the originals come with their mips, they're used when every one of them was cooked.
+        auto cookedPaths
+            = irange(10)
+            | vs::transform([&](auto i) { return fs::path("{}{}_100{}.{}"_f(TexPath, i < 5 ? "D" : "N", i % 5 + 1, TexExt)).replace_extension(TextureFileExtension); })
+            | to_vector
+            ;
+        auto useCooked = rn::all_of(cookedPaths, [](auto& p) { return fs::exists(p); });
+        vector<unique_ptr<Texture>> cookedTextures;
+        if (useCooked)
+        {
+            auto tasks = cookedPaths | vs::transform([&](auto& p) { return threadPool.Submit([&] { return CreateTexture(device, TextureFile::Load(p)); }); }) | to_vector;
+            for (auto& task : tasks)
+                cookedTextures.emplace_back(task.get());
+        }
+
         auto futureTextures
-            = irange(5)
+            = irange(useCooked ? 0 : 5)
             | vs::transform([&](auto i) { return Texture::LoadUniqueAsync(&threadPool, device, "{}D_100{}.{}"_f(TexPath, i + 1, TexExt), { .Format = eR8G8B8A8Srgb, .MaxMipLevel = 0 }); })
             | to_vector
             ;
 
         futureTextures.insert_range(futureTextures.end(),
-            irange(5) | vs::transform([&](auto i) { return Texture::LoadUniqueAsync(&threadPool, device, "{}N_100{}.{}"_f(TexPath, i + 1, TexExt), { .Format = eR8G8B8A8Unorm, .MaxMipLevel = 0 }); })
+            irange(useCooked ? 0 : 5) | vs::transform([&](auto i) { return Texture::LoadUniqueAsync(&threadPool, device, "{}N_100{}.{}"_f(TexPath, i + 1, TexExt), { .Format = eR8G8B8A8Unorm, .MaxMipLevel = 0 }); })
         );
 
         auto sampler = Sampler(device, { .LODBias = -1.5f, .MaxAnisotropy = 16.f });
 
-        //auto objMeshes = LoadObj(Assets / "Verity.obj", &sceneData);
+        //auto objMeshes = LoadObj(Assets / "Verity.obj", &sceneData, &threadPool);
         //auto objMeshes = LoadSceneFile(&sceneData, Assets / "Genesis 9 Merged None Tri.ksc");
-        auto loadedScene = LoadSceneFile(&sceneData, Assets / "G9 Shapes.ksc");
+        auto loadedScene = LoadSceneFile(&sceneData, Assets / "G9 Shapes.ksc", &threadPool);
 
         auto normalTask = threadPool.Submit(KR_FN_OBJ(device->ExecuteSingleTimeCommands), [&](Frame* frame)
         {
             auto meshes = loadedScene.MeshDatas | vs::filter([](auto& p) { return p != nullptr; }) | vs::transform(&unique_ptr<MeshData3D>::get) | to_vector;
             for (auto& m : meshes) m->Write(frame);
             frame->WaitForCommands();
+            //Cooked meshes were loaded with their normals and tangents already computed.
+            std::erase_if(meshes, [](MeshData3D* m) { return m->CookedShading; });
             for (auto& m : meshes) m->CalcMorphs(frame);
             frame->WaitForCommands();
             for (auto& m : meshes) m->CalcFaceNormals(frame);
@@ -373,7 +303,10 @@ int main(int argc, char* argv[])
             for (auto& m : meshes) m->CalcPointNormals(frame);
         });
 
-        auto stextures = futureTextures | vs::keys | vs::recast<ITexture*>() | vs::transform([&](auto tex) { return pair(tex, &sampler); }) | to_vector;
+        auto textures = futureTextures | vs::keys | vs::recast<ITexture*>() | to_vector;
+        for (auto& tex : cookedTextures)
+            textures.emplace_back(tex.get());
+        auto stextures = textures | vs::transform([&](auto tex) { return pair(tex, &sampler); }) | to_vector;
 
         updateCamera();
 
@@ -431,6 +364,9 @@ int main(int argc, char* argv[])
             updateCamera();
         }, true);
         
+        auto meshletCulling = false;
+        auto coneCulling    = false;
+
         auto gtaoEnabled   = true;
         auto gtaoSmooth    = true;
         auto gtaoPrefilter = GTAO::PrefilterDepths16x16Pipeline(device);
@@ -620,26 +556,41 @@ int main(int argc, char* argv[])
             tg.Index->ClearColorInt(Vector4U32{ u32(-1) }, frame);
             frame->WaitForCommands();
 
+            auto pixelsPerUnit = ((Vector2)window.Size).y * std::abs(uniformCamera.Projection[1, 1]) / 2;
             tp.Begin(frame);
             for (auto [i, o] : loadedScene.Objects | uindexed32)
             {
                 auto& m = loadedScene.MeshDatas[o.DataIndex];
                 if (m == nullptr)
                     continue;
+                auto scale = std::max({ o.Scale.x, o.Scale.y, o.Scale.z });
+                auto lod = m->SelectLod((o.Location - cameraPosition).Magnitude / scale, pixelsPerUnit);
                 tp.Topology = m->CornerPerFace == 3 ? FaceTopology::Tri : FaceTopology::Quad;
-                tp.MeshIndex = m->MeshIndex;
+                tp.MeshIndex = lod ? lod->MeshIndex : m->MeshIndex;
                 auto& transform = *frame->NewObject<AllocatedObject<Matrix4>>(sceneData.SceneAllocator, 2);
                 transform[0] = Matrix4::Transformation(o.Location, o.RotationQuat, o.Scale);
                 transform[1] = transform[0].Inverse.Transposed;
                 tp.TransformIndex = transform.Index;
                 tp.InstanceIndex = i;
+                if (meshletCulling && !lod && !m->Meshlets.empty())
+                {
+                    //Planes of the clip volume in object space, from the columns of the full transform. Near and far are left out.
+                    auto mvp = transform[0] * uniformCamera.View * uniformCamera.Projection;
+                    auto column = [&](u32 c) { return Vector4{ mvp[0, c], mvp[1, c], mvp[2, c], mvp[3, c] }; };
+                    Vector4 planes[] = { column(3) + column(0), column(3) - column(0), column(3) + column(1), column(3) - column(1) };
+                    auto inv = transform[0].Inverse;
+                    auto camera = inv[3].xyz + inv[0].xyz * cameraPosition.x + inv[1].xyz * cameraPosition.y + inv[2].xyz * cameraPosition.z;
+                    for (auto& [offset, count] : m->VisibleFaceRanges(planes, coneCulling ? &camera : nullptr))
+                        tp.Draw({ .VertexCount = count * m->CornerPerFace, .VertexOffset = offset * m->CornerPerFace });
+                    continue;
+                }
                 //if (!m->MaterialRanges.empty() && materialIndex < (int)m->MaterialRanges.size())
                 //{
                 //    auto& [offset, count] = m->MaterialRanges[materialIndex];
                 //    tp.Draw({ .VertexCount = count * m->CornerPerFace, .VertexOffset = offset * m->CornerPerFace });
                 //}
                 //else
-                    tp.Draw({ .VertexCount = m->CornerCount, .VertexOffset = 0 });
+                    tp.Draw({ .VertexCount = lod ? lod->CornerCount : m->CornerCount, .VertexOffset = 0 });
             }
             tp.End();
             frame->WaitForCommands();
@@ -940,6 +891,10 @@ int main(int argc, char* argv[])
                     SameLine();
                     Checkbox("Smooth", &gtaoSmooth);
 
+                    Checkbox("Meshlet Culling", &meshletCulling);
+                    SameLine();
+                    Checkbox("Cone Culling", &coneCulling);
+
                     DragFloat("EffectRadius",             &consts.EffectRadius,             0.1f);
                     DragFloat("EffectFalloffRange",       &consts.EffectFalloffRange,       0.1f);
                     DragFloat("RadiusMultiplier",         &consts.RadiusMultiplier,         0.1f);
@@ -0,0 +1,42 @@
+#pragma once
+#include "Kaey/Renderer/ThreadPool.hpp"
+#include "Kaey/Renderer/Utility.hpp"
+
+namespace Kaey::Renderer
+{
+    //Runs fn(i) for every i in [0, count) on 'threadPool' and waits for them, inline without a pool.
+    //Must not be called from a task of the same pool, it blocks the worker until the others are done.
+    void ParallelFor(ThreadPool* threadPool, size_t count, auto&& fn)
+    {
+        if (!threadPool)
+        {
+            for (size_t i = 0; i < count; ++i)
+                fn(i);
+            return;
+        }
+        threadPool->ParallelSubmit(count, fn).get();
+    }
+
+    //Ranges ParallelChunks splits [0, count) into, one per thread and none smaller than 'minChunk'. Without a pool everything is one range.
+    inline u32 ChunkSizeOf(ThreadPool* threadPool, u32 count, u32 minChunk)
+    {
+        if (!threadPool)
+            return std::max(1u, count);
+        auto threads = std::max(1u, std::thread::hardware_concurrency());
+        return std::max(minChunk, (count + threads - 1) / threads);
+    }
+
+    //Runs fn(begin, end) on each range of ChunkSizeOf, small inputs aren't worth a task so a single range runs inline.
+    void ParallelChunks(ThreadPool* threadPool, u32 count, u32 minChunk, auto&& fn)
+    {
+        auto chunk = ChunkSizeOf(threadPool, count, minChunk);
+        if (count <= chunk)
+            return fn(0u, count);
+        ParallelFor(threadPool, (count + chunk - 1) / chunk, [&](size_t i)
+        {
+            auto begin = u32(i) * chunk;
+            fn(begin, std::min(count, begin + chunk));
+        });
+    }
+
+}
@@ -0,0 +1,103 @@
+#include "Kaey/Engine/SyncQueue.hpp"
+
+using namespace Kaey::Engine;
+using namespace Kaey;
+
+namespace
+{
+    static_assert(!std::is_constructible_v<SyncTask, SyncTask&>, "A SyncTask lvalue must not be wrapped in another SyncTask!");
+
+    constexpr u32 ProducerCount = 8;
+    constexpr u32 TasksPerProducer = 200000;
+    constexpr u32 BatchSize = 32; //Every other producer pushes through batches of this size.
+
+    //Producers push their sequence numbers while the consumer takes and runs them, every thread's tasks must run once and in order.
+    void StressSyncQueue()
+    {
+        SyncQueue queue;
+        //Only touched by the tasks, which all run on the consumer.
+        array<u32, ProducerCount> nextSeq{};
+        u64 ran = 0;
+        u32 misordered = 0;
+        auto run = [&](u32 producer, u32 seq)
+        {
+            if (nextSeq[producer] != seq)
+                ++misordered;
+            nextSeq[producer] = seq + 1;
+            ++ran;
+        };
+
+        std::atomic<u32> finished = 0;
+        vector<std::thread> producers;
+        for (u32 p = 0; p < ProducerCount; ++p)
+            producers.emplace_back([&, p]
+            {
+                if (p % 2 == 0)
+                {
+                    for (u32 seq = 0; seq < TasksPerProducer; ++seq)
+                        queue.Push([&run, p, seq] { run(p, seq); });
+                }
+                else
+                {
+                    //Padded past the inline size, so these go through the heap.
+                    array<u8, SyncTask::InlineSize> pad{};
+                    for (u32 seq = 0; seq < TasksPerProducer;)
+                    {
+                        auto batch = SyncQueue::Batch(&queue);
+                        for (auto end = std::min(seq + BatchSize, TasksPerProducer); seq < end; ++seq)
+                            batch.Add([&run, p, seq, pad] { run(p, seq + pad[0]); });
+                        queue.Push(move(batch));
+                    }
+                }
+                finished.fetch_add(1, std::memory_order_release);
+            });
+
+        while (finished.load(std::memory_order_acquire) != ProducerCount)
+            queue.Run(queue.Take());
+        queue.Run(queue.Take());
+        for (auto& t : producers)
+            t.join();
+
+        if (misordered)
+            throw runtime_error("SyncQueue ran {} tasks out of the order their thread pushed them!"_f(misordered));
+        if (ran != u64(ProducerCount) * TasksPerProducer)
+            throw runtime_error("SyncQueue ran {} tasks, {} were pushed!"_f(ran, u64(ProducerCount) * TasksPerProducer));
+        for (u32 p = 0; p < ProducerCount; ++p)
+            if (nextSeq[p] != TasksPerProducer)
+                throw runtime_error("SyncQueue ran {} of the {} tasks of thread {}!"_f(nextSeq[p], TasksPerProducer, p));
+        std::cout << "SyncQueue ran {} tasks from {} threads in order\n"_f(ran, ProducerCount);
+    }
+
+    //Tasks taken but never run are destroyed with their captures.
+    void DropSyncQueue()
+    {
+        auto alive = make_shared<u32>(0);
+        {
+            SyncQueue queue;
+            queue.Push([alive] {});
+            auto batch = SyncQueue::Batch(&queue);
+            batch.Add([alive] {});
+            queue.Push(move(batch));
+            auto dropped = SyncQueue::Batch(&queue);
+            dropped.Add([alive] {});
+        }
+        if (alive.use_count() != 1)
+            throw runtime_error("SyncQueue leaked {} tasks that never ran!"_f(alive.use_count() - 1));
+    }
+
+}
+
+int main()
+{
+    try
+    {
+        StressSyncQueue();
+        DropSyncQueue();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
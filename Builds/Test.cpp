@@ -5,9 +5,13 @@
 #include "Kaey/Renderer/Time.hpp"
 #include "Kaey/Renderer/Window.hpp"
 
+#include "Parallel.hpp"
+
 #include <RenderTexPipeline.hpp>
 #include <EnvBRDFPipeline.hpp>
 
+#include <emmintrin.h>
+
 #include "Kaey/Renderer/Utility.hpp"
 
 using namespace Kaey::Renderer;
@@ -202,11 +206,159 @@ namespace
         scene->SetMeshMaterial(ball, 0, carbonMat);
     }
 
-    void LoadScene(Scene3D* scene, const tinygltf::Model& model)
+    //Images are handed to stb on the thread pool as soon as tinygltf finds them, so they decode while the rest of the file is parsed and
+    //the geometry is imported.
+    struct GltfImage
+    {
+        u32 Width = 0, Height = 0;
+        vector<u8> Pixels;
+    };
+
+    struct GltfImageLoader
+    {
+        ThreadPool* Pool;
+        unordered_map<int, std::shared_future<GltfImage>> Images;
+
+        static bool Load(tinygltf::Image* image, const int imageIndex, string* err, string*, int, int, const unsigned char* bytes, int size, void* userData)
+        {
+            auto loader = (GltfImageLoader*)userData;
+            loader->Images.emplace(imageIndex, loader->Pool->Submit([encoded = vector<u8>(bytes, bytes + size), name = image->name]
+            {
+                int width, height, channels;
+                auto pixels = stbi_load_from_memory(encoded.data(), (int)encoded.size(), &width, &height, &channels, STBI_rgb_alpha);
+                if (!pixels)
+                    throw runtime_error("Failed to decode image '{}': {}"_f(name, stbi_failure_reason()));
+                auto result = GltfImage{ (u32)width, (u32)height, vector<u8>(pixels, pixels + size_t(width) * height * 4) };
+                stbi_image_free(pixels);
+                return result;
+            }).share());
+            return true;
+        }
+    };
+
+    //Bulk conversions out of strided accessors, four elements of the destination at a time through SSE2.
+    //Positions and directions get x flipped, like GltfTransform does, to go from glTF's right handed space to ours.
+    void ReadVectors(const GltfBufferView<Vector3>& src, span<Vector4> dst, f32 w, bool normalize)
+    {
+        if (src.Count > 0 && src.ComponentType != TINYGLTF_COMPONENT_TYPE_FLOAT)
+            throw runtime_error("Invalid vector component type: {}"_f(src.ComponentType));
+        auto flipX = _mm_castsi128_ps(_mm_setr_epi32(INT_MIN, 0, 0, 0));
+        auto maskW = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+        auto setW  = _mm_setr_ps(0, 0, 0, w);
+        auto store = [&](size_t i, __m128 v)
+        {
+            v = _mm_and_ps(_mm_xor_ps(v, flipX), maskW);
+            if (normalize)
+            {
+                auto sq = _mm_mul_ps(v, v);
+                sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 3, 0, 1)));
+                sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 0, 3, 2)));
+                v = _mm_and_ps(_mm_div_ps(v, _mm_sqrt_ps(sq)), _mm_cmpgt_ps(sq, _mm_setzero_ps()));
+            }
+            _mm_storeu_ps((f32*)&dst[i], _mm_or_ps(v, setW));
+        };
+        //Reading four floats runs into the next element, which the last one doesn't have.
+        auto bytes = (const u8*)src.Pointer;
+        for (size_t i = 0; i + 1 < src.Count; ++i)
+            store(i, _mm_loadu_ps((const f32*)(bytes + i * src.ByteStride)));
+        if (src.Count > 0)
+        {
+            auto& last = src[src.Count - 1];
+            store(src.Count - 1, _mm_setr_ps(last.x, last.y, last.z, 0));
+        }
+    }
+
+    //Weights are either floats or normalized unsigned bytes and shorts, joints unsigned integers of any size.
+    template<class To>
+    void ReadQuads(const GltfBufferView<Vector4>& src, span<To> dst, bool normalized)
+    {
+        static_assert(sizeof(To) == sizeof(__m128));
+        auto bytes = (const u8*)src.Pointer;
+        auto convert = [&](auto load, f32 scale)
+        {
+            auto factor = _mm_set1_ps(scale);
+            for (auto i : irange(src.Count))
+            {
+                auto v = load(bytes + i * src.ByteStride);
+                if constexpr (std::is_same_v<To, Vector4>)
+                    _mm_storeu_ps((f32*)&dst[i], normalized ? _mm_mul_ps(_mm_cvtepi32_ps(v), factor) : _mm_cvtepi32_ps(v));
+                else _mm_storeu_si128((__m128i*)&dst[i], v);
+            }
+        };
+        auto zero = _mm_setzero_si128();
+        switch (src.ComponentType)
+        {
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+            return convert([&](const u8* p) { i32 v; std::memcpy(&v, p, sizeof(v)); return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero), zero); }, 1.f / 255);
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+            return convert([&](const u8* p) { return _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)p), zero); }, 1.f / 65535);
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+            if constexpr (!std::is_same_v<To, Vector4>)
+                return convert([](const u8* p) { return _mm_loadu_si128((const __m128i*)p); }, 1);
+            break;
+        case TINYGLTF_COMPONENT_TYPE_FLOAT:
+            if constexpr (std::is_same_v<To, Vector4>)
+            {
+                for (auto i : irange(src.Count))
+                    _mm_storeu_ps((f32*)&dst[i], _mm_loadu_ps((const f32*)(bytes + i * src.ByteStride)));
+                return;
+            }
+            break;
+        default: break;
+        }
+        throw runtime_error("Invalid component type: {}"_f(src.ComponentType));
+    }
+
+    void ReadUvs(const GltfBufferView<Vector2>& src, span<Vector2> dst)
+    {
+        auto bytes = (const u8*)src.Pointer;
+        auto convert = [&]<class T>(T, f32 scale)
+        {
+            for (auto i : irange(src.Count))
+            {
+                T v[2];
+                std::memcpy(v, bytes + i * src.ByteStride, sizeof(v));
+                dst[i] = { v[0] * scale, v[1] * scale };
+            }
+        };
+        switch (src.ComponentType)
+        {
+        case TINYGLTF_COMPONENT_TYPE_FLOAT:          return convert(f32(), 1);
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:  return convert(u8(),  1.f / 255);
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: return convert(u16(), 1.f / 65535);
+        default: throw runtime_error("Invalid texture coordinate component type: {}"_f(src.ComponentType));
+        }
+    }
+
+    void ReadIndices(const GltfBufferView<u8>& src, span<u32> dst, u32 offset)
+    {
+        auto bytes = (const u8*)src.Pointer;
+        auto convert = [&]<class T>(T)
+        {
+            for (auto i : irange(src.Count))
+            {
+                T v;
+                std::memcpy(&v, bytes + i * src.ByteStride, sizeof(v));
+                dst[i] = offset + v;
+            }
+        };
+        switch (src.ComponentType)
+        {
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:  return convert(u8());
+        case TINYGLTF_COMPONENT_TYPE_SHORT:
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: return convert(u16());
+        case TINYGLTF_COMPONENT_TYPE_INT:
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:   return convert(u32());
+        default: throw runtime_error("Invalid argument 'indices.componentType'!");
+        }
+    }
+
+    void LoadScene(Scene3D* scene, const tinygltf::Model& model, GltfImageLoader& images)
     {
         if (model.defaultScene == -1)
             return;
         auto root = model.scenes[model.defaultScene];
+        auto threadPool = images.Pool;
 
         auto writer = BufferQueue(scene->Device);
         auto textureMap = unordered_map<int, TextureId>{ { -1, nullid } };
@@ -216,12 +368,18 @@ namespace
             if (!check)
                 return it->second;
             auto& tex = model.textures[texId];
-            auto& img = model.images[tex.source];
-            auto shared = make_shared<Texture>(scene->Device, TextureArgs{ .Size = { (u32)img.width, (u32)img.height }, .Format = nonColor ? vk::Format::eR8G8B8A8Unorm : vk::Format::eR8G8B8A8Srgb, .MaxMipLevel = 0 });
-            writer.QueueWrite(shared.get(), img.image);
+            //Images tinygltf couldn't find never reach the loader, and textures may have no source at all.
+            auto source = images.Images.find(tex.source);
+            if (source == images.Images.end())
+                throw runtime_error("Texture {} '{}' has no loaded image, its source is {}!"_f(texId, tex.name, tex.source));
+            auto& img = source->second.get();
+            auto shared = make_shared<Texture>(scene->Device, TextureArgs{ .Size = { img.Width, img.Height }, .Format = nonColor ? vk::Format::eR8G8B8A8Unorm : vk::Format::eR8G8B8A8Srgb, .MaxMipLevel = 0 });
+            writer.QueueWrite(shared.get(), img.Pixels);
             return it->second = scene->AddTexture(move(shared));
         };
 
+        //Textures are bound once the geometry is imported, giving the images more time to decode.
+        vector<std::function<void()>> textureBindings;
         auto materialMap = unordered_map<int, MaterialId>{ { -1, nullid } };
         auto loadMaterial = [&](int matId) -> MaterialId
         {
@@ -231,8 +389,11 @@ namespace
             auto& material = model.materials[matId];
             auto& pbr = material.pbrMetallicRoughness;
             auto& id = it->second = scene->CreateMaterial();
-            scene->SetMaterialAlbedoMetallicTexture(id, loadTexture(pbr.baseColorTexture.index, false));
-            scene->SetMaterialNormalSpecularRoughness(id, loadTexture(material.normalTexture.index, true));
+            textureBindings.emplace_back([&, id, albedo = pbr.baseColorTexture.index, normal = material.normalTexture.index]
+            {
+                scene->SetMaterialAlbedoMetallicTexture(id, loadTexture(albedo, false));
+                scene->SetMaterialNormalSpecularRoughness(id, loadTexture(normal, true));
+            });
             scene->SetMaterialAlbedoMultiplier(id, { (f32)pbr.baseColorFactor[0], (f32)pbr.baseColorFactor[1], (f32)pbr.baseColorFactor[2] });
             scene->SetMaterialMetallicMultiplier(id, (f32)pbr.metallicFactor);
             return id;
@@ -289,141 +450,129 @@ namespace
             return skId;
         };
 
-        auto meshMap = unordered_map<int, MeshDataId>{ { -1, nullid } };
-        auto loadMeshData = [&](int meshId, int skinId) -> MeshDataId
+        //Every mesh is sized up front, in the order the nodes use them, so its primitives can be imported in parallel into their own ranges.
+        struct MeshImport
         {
-            if (meshId == -1)
-                return nullid;
-            auto [it, check] = meshMap.emplace(meshId, nullid);
-            if (!check)
-                return it->second;
-
-            auto vec3 = [](const Vector3& v) -> Vector3 { return { -v.x, v.y, v.z }; };
-
-            auto& mesh = model.meshes[meshId];
-
-            size_t indexCount = 0;
-            size_t vertexCount = 0;
-            size_t shapeCount = mesh.weights.size();
-
-            vector<MeshPrimitive> primitives;
-            primitives.reserve(mesh.primitives.size());
-            for (auto& primitive : mesh.primitives)
-            {
-                auto iCount = model.accessors[primitive.indices].count;
-                auto vCount = model.accessors[primitive.attributes.at("POSITION")].count;
-                auto matId = loadMaterial(primitive.material);
-                primitives.emplace_back(indexCount, iCount, matId);
-                indexCount += iCount;
-                vertexCount += vCount;
-            }
-
-            MeshWriteData vertices;
-            auto& inds = vertices.Indices;
-            inds.reserve(indexCount);
-            vertices.Reserve(vertexCount, shapeCount);
-            if (skinId != -1)
-            {
-                vertices.BoneIndices.reserve(vertexCount);
-                vertices.BoneWeights.reserve(vertexCount);
-            }
-
-            for (auto [pId, primitive] : mesh.primitives | uindexed32)
+            int MeshId;
+            int SkinId;
+            size_t IndexCount = 0;
+            size_t VertexCount = 0;
+            size_t ShapeCount = 0;
+            vector<MeshPrimitive> Primitives;
+            vector<pair<size_t, size_t>> Offsets; //Of the indices and vertices of each primitive.
+            MeshWriteData Vertices;
+        };
+        auto imports = vector<unique_ptr<MeshImport>>();
+        auto importMap = unordered_map<int, MeshImport*>();
+        rn::for_each(root.nodes, [&](this auto& self, int nodeId) -> void
+        {
+            auto& node = model.nodes[nodeId];
+            if (node.mesh != -1 && !importMap.contains(node.mesh))
             {
-                auto indices = GltfBufferView<u16>(&model, primitive.indices);
-                switch (indices.ComponentType)
-                {
-                case TINYGLTF_COMPONENT_TYPE_SHORT:
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-                    for (auto i : indices)
-                        inds.emplace_back(u32(vertices.Points.size() + i));
-                    break;
-                case TINYGLTF_COMPONENT_TYPE_INT:
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+                auto& im = *importMap.emplace(node.mesh, imports.emplace_back(make_unique<MeshImport>(node.mesh, node.skin)).get()).first->second;
+                auto& mesh = model.meshes[node.mesh];
+                im.ShapeCount = mesh.weights.size();
+                im.Primitives.reserve(mesh.primitives.size());
+                for (auto& primitive : mesh.primitives)
                 {
-                    for (auto i : indices.As<u32>())
-                        inds.emplace_back(u32(vertices.Points.size() + i));
-                }break;
-                default: throw runtime_error("Invalid argument 'indices.componentType'!");
+                    auto iCount = model.accessors[primitive.indices].count;
+                    auto vCount = model.accessors[primitive.attributes.at("POSITION")].count;
+                    im.Primitives.emplace_back(im.IndexCount, iCount, loadMaterial(primitive.material));
+                    im.Offsets.emplace_back(im.IndexCount, im.VertexCount);
+                    im.IndexCount += iCount;
+                    im.VertexCount += vCount;
                 }
-
-                auto positions = GltfBufferView<Vector3>(&model, primitive.attributes.at("POSITION"));
-                auto normals = GltfBufferView<Vector3>(&model, primitive.attributes.at("NORMAL"));
-                auto uvs = GltfBufferView<Vector2>(&model, primitive.attributes.at("TEXCOORD_0"));
-
-                for (auto i : irange(positions.Count))
+                auto& vertices = im.Vertices;
+                vertices.Reserve(im.VertexCount, im.ShapeCount);
+                vertices.Indices.resize(im.IndexCount);
+                vertices.Points.resize(im.VertexCount);
+                vertices.Normals.resize(im.VertexCount);
+                vertices.Uvs.resize(im.VertexCount);
+                if (im.SkinId != -1)
                 {
-                    vertices.Points.emplace_back(vec3(positions[i]) + 1_w);
-                    vertices.Normals.emplace_back(vec3(normals[i]).Normalized + 0_w);
-                    vertices.Uvs.emplace_back(uvs[i]);
+                    vertices.BoneIndices.resize(im.VertexCount);
+                    vertices.BoneWeights.resize(im.VertexCount);
                 }
-
-                if (skinId != -1)
+                if (im.ShapeCount > 0)
                 {
-                    auto& skin = model.skins[skinId];
-                    auto fillWeights = [&](auto boneIndices)
-                    {
-                        auto boneWeights = GltfBufferView<Vector4>(&model, primitive.attributes.at("WEIGHTS_0"));
-                        assert(boneWeights.ComponentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
-                        for (auto i : irange(positions.Count))
-                        {
-                            auto& w = vertices.BoneWeights.emplace_back(boneWeights[i]);
-                            for (auto [j, boneIndex] : vertices.BoneIndices.emplace_back() | indexed) if (w[j] > 0)
-                                boneIndex = boneIndices[i][j];
-                            //boneIndex = boneMap.at(skin.joints[boneIndices[i][j]]);
-                        }
-                    };
-                    auto boneIndices = GltfBufferView<array<u8, 4>>(&model, primitive.attributes.at("JOINTS_0"));
-                    switch (boneIndices.ComponentType)
-                    {
-                    case TINYGLTF_COMPONENT_TYPE_BYTE:
-                    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:  fillWeights(boneIndices); break;
-                    case TINYGLTF_COMPONENT_TYPE_SHORT:
-                    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: fillWeights(boneIndices.As<array<u16, 4>>()); break;
-                    case TINYGLTF_COMPONENT_TYPE_INT:
-                    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:   fillWeights(boneIndices.As<array<u32, 4>>()); break;
-                    default: throw runtime_error("Invalid bone indices component type!");
-                    }
+                    vertices.DeltaPoints.resize(im.VertexCount * (im.ShapeCount + 1));
+                    vertices.DeltaNormals.resize(im.VertexCount * (im.ShapeCount + 1));
                 }
             }
+            rn::for_each(node.children, self);
+        });
 
-            if (shapeCount > 0)
-            {
-                auto& dpoints = vertices.DeltaPoints;
-                auto& dnormals = vertices.DeltaNormals;
+        auto importPrimitive = [&](MeshImport& im, u32 pId)
+        {
+            auto& primitive = model.meshes[im.MeshId].primitives[pId];
+            auto [indexOffset, vertexOffset] = im.Offsets[pId];
+            auto& vertices = im.Vertices;
 
-                dpoints.insert_range(dpoints.end(), vertices.Points);
-                dnormals.insert_range(dnormals.end(), vertices.Normals);
+            auto indices = GltfBufferView<u8>(&model, primitive.indices);
+            ReadIndices(indices, span(vertices.Indices).subspan(indexOffset, indices.Count), (u32)vertexOffset);
 
-                for (auto shapeIndex : irange(shapeCount))
-                for (auto& primitive : mesh.primitives)
+            auto positions = GltfBufferView<Vector3>(&model, primitive.attributes.at("POSITION"));
+            auto points  = span(vertices.Points).subspan(vertexOffset, positions.Count);
+            auto normals = span(vertices.Normals).subspan(vertexOffset, positions.Count);
+            ReadVectors(positions, points, 1, false);
+            ReadVectors(GltfBufferView<Vector3>(&model, primitive.attributes.at("NORMAL")), normals, 0, true);
+            ReadUvs(GltfBufferView<Vector2>(&model, primitive.attributes.at("TEXCOORD_0")), span(vertices.Uvs).subspan(vertexOffset, positions.Count));
+
+            if (im.SkinId != -1)
+            {
+                auto weights = span(vertices.BoneWeights).subspan(vertexOffset, positions.Count);
+                ReadQuads(GltfBufferView<Vector4>(&model, primitive.attributes.at("WEIGHTS_0")), weights, true);
+                vector<array<u32, 4>> joints(positions.Count);
+                ReadQuads(GltfBufferView<Vector4>(&model, primitive.attributes.at("JOINTS_0")), span(joints), false);
+                for (auto [i, boneIndices] : span(vertices.BoneIndices).subspan(vertexOffset, positions.Count) | indexed)
+                for (auto [j, boneIndex] : boneIndices | indexed) if (weights[i][j] > 0)
+                    boneIndex = joints[i][j];
+                    //boneIndex = boneMap.at(skin.joints[joints[i][j]]);
+            }
+
+            if (im.ShapeCount > 0)
+            {
+                rn::copy(points, vertices.DeltaPoints.begin() + vertexOffset);
+                rn::copy(normals, vertices.DeltaNormals.begin() + vertexOffset);
+                for (auto shapeIndex : irange(im.ShapeCount))
                 {
                     auto& target = primitive.targets[shapeIndex];
-
+                    auto offset = (shapeIndex + 1) * im.VertexCount + vertexOffset;
                     auto spoints = GltfBufferView<Vector3>(&model, target.at("POSITION"));
-                    auto snormals = GltfBufferView<Vector3>(&model, target.at("NORMAL"));
-
-                    for (auto i : irange(spoints.Count))
-                    {
-                        dpoints.emplace_back(vec3(spoints[i]) + 1_w);
-                        dnormals.emplace_back(vec3(snormals[i]) + 0_w);
-                    }
+                    ReadVectors(spoints, span(vertices.DeltaPoints).subspan(offset, spoints.Count), 1, false);
+                    ReadVectors(GltfBufferView<Vector3>(&model, target.at("NORMAL")), span(vertices.DeltaNormals).subspan(offset, spoints.Count), 0, false);
                 }
             }
+        };
 
-            vertices.CalcVertexTangs();
-
-            it->second = scene->CreateMeshData(indexCount, vertexCount, shapeCount, primitives);
+        vector<pair<MeshImport*, u32>> primitiveJobs;
+        for (auto& im : imports)
+            for (auto pId : irange((u32)im->Primitives.size()))
+                primitiveJobs.emplace_back(im.get(), pId);
+        ParallelFor(threadPool, primitiveJobs.size(), [&](size_t i) { importPrimitive(*primitiveJobs[i].first, primitiveJobs[i].second); });
+        ParallelFor(threadPool, imports.size(), [&](size_t i) { imports[i]->Vertices.CalcVertexTangs(); });
 
-            scene->WriteMesh(it->second, vertices);
+        for (auto& bind : textureBindings)
+            bind();
 
+        auto meshMap = unordered_map<int, MeshDataId>{ { -1, nullid } };
+        auto loadMeshData = [&](int meshId) -> MeshDataId
+        {
+            if (meshId == -1)
+                return nullid;
+            auto [it, check] = meshMap.emplace(meshId, nullid);
+            if (!check)
+                return it->second;
+            auto& im = *importMap.at(meshId);
+            it->second = scene->CreateMeshData(im.IndexCount, im.VertexCount, im.ShapeCount, im.Primitives);
+            scene->WriteMesh(it->second, im.Vertices);
             return it->second;
         };
 
         auto loadMesh = [&](int nodeId) -> MeshInstanceId
         {
             auto& node = model.nodes[nodeId];
-            auto mdId = loadMeshData(node.mesh, node.skin);
+            auto mdId = loadMeshData(node.mesh);
             if (mdId == nullid)
                 return nullid;
             auto meshId = scene->CreateMeshInstance(mdId);
@@ -454,23 +603,25 @@ namespace
         });
     }
 
-    void LoadGltf(Scene3D* scene, crpath path, bool isBinary)
+    void LoadGltf(Scene3D* scene, crpath path, bool isBinary, ThreadPool* threadPool)
     {
         tinygltf::TinyGLTF loader;
         tinygltf::Model model;
         string err, warn;
-        auto ext = path.extension();
+        auto images = GltfImageLoader{ threadPool };
+        loader.SetImageLoader(&GltfImageLoader::Load, &images);
         auto res = isBinary ? loader.LoadBinaryFromFile(&model, &err, &warn, path.string()) : loader.LoadASCIIFromFile(&model, &err, &warn, path.string());
-        return res ? LoadScene(scene, model) : throw runtime_error(err);
+        return res ? LoadScene(scene, model, images) : throw runtime_error(err);
     }
 
-    void LoadGltf(Scene3D* scene, crpath path)
+    void LoadGltf(Scene3D* scene, crpath path, ThreadPool* threadPool)
     {
         auto ext = path.extension();
         return LoadGltf(scene, path,
             ext == ".glb" ? true :
             ext == ".gltf" ? false :
-            throw runtime_error("Invalid file extension, expected gltf or glb, was {}"_f(ext.string()))
+            throw runtime_error("Invalid file extension, expected gltf or glb, was {}"_f(ext.string())),
+            threadPool
         );
     }
 
@@ -511,11 +662,11 @@ int main(int argc, char* argv[])
 
         //scene->AmbientLight = 0.15_xyz + 1_w;
 
-        LoadGltf(scene.get(), Assets / "Monkey.glb");
+        LoadGltf(scene.get(), Assets / "Monkey.glb", &threadPool);
         LoadSceneMaterials(scene.get(), &threadPool);
 
-        //LoadGltf(scene.get(), Assets / "glTF-Sample-Models/2.0/Sponza/glTF/Sponza.gltf");
-        //LoadGltf(scene.get(), Assets / "glTF-Sample-Models/2.0/ABeautifulGame/glTF/ABeautifulGame.gltf");
+        //LoadGltf(scene.get(), Assets / "glTF-Sample-Models/2.0/Sponza/glTF/Sponza.gltf", &threadPool);
+        //LoadGltf(scene.get(), Assets / "glTF-Sample-Models/2.0/ABeautifulGame/glTF/ABeautifulGame.gltf", &threadPool);
 
         auto camId       = scene->CreateCamera();
         auto cam         = &scene->Cameras[camId];
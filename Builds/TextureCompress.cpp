@@ -0,0 +1,419 @@
+#include "TextureCompress.hpp"
+
+#include <emmintrin.h>
+
+namespace Kaey::Renderer
+{
+    namespace
+    {
+        using Rgba  = array<u8, 4>;
+        using Block = array<Rgba, 16>;
+
+        //Interpolation weights of the 4 bit indices of BC7, out of 64.
+        constexpr array<u32, 16> Bc7Weights = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+        Block LoadBlock(cspan<u8> rgba, u32 width, u32 height, u32 blockX, u32 blockY)
+        {
+            Block block;
+            for (u32 i = 0; i < 16; ++i)
+            {
+                auto x = std::min(blockX * 4 + i % 4, width - 1);
+                auto y = std::min(blockY * 4 + i / 4, height - 1);
+                std::memcpy(block[i].data(), rgba.data() + (size_t(y) * width + x) * 4, sizeof(Rgba));
+            }
+            return block;
+        }
+
+        //Picks the closest color of 'palette' for every texel, by squared distance over all four channels.
+        //Two colors are compared per instruction, widened to 16 bits so their squares can be summed with madd.
+        template<size_t N>
+        u32 ClosestIndices(const Block& block, const array<Rgba, N>& palette, array<u8, 16>& indices)
+        {
+            static_assert(N % 2 == 0);
+            auto zero = _mm_setzero_si128();
+            array<__m128i, N / 2> pairs;
+            for (size_t i = 0; i < N / 2; ++i)
+                pairs[i] = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)palette[i * 2].data()), zero);
+            u32 total = 0;
+            for (size_t t = 0; t < 16; ++t)
+            {
+                i32 texel;
+                std::memcpy(&texel, block[t].data(), sizeof(texel));
+                auto p = _mm_unpacklo_epi8(_mm_set1_epi32(texel), zero);
+                auto best = UINT32_MAX;
+                u8 bestIndex = 0;
+                for (size_t i = 0; i < N / 2; ++i)
+                {
+                    auto d = _mm_sub_epi16(pairs[i], p);
+                    auto sq = _mm_madd_epi16(d, d);
+                    sq = _mm_add_epi32(sq, _mm_shuffle_epi32(sq, _MM_SHUFFLE(2, 3, 0, 1)));
+                    auto e0 = (u32)_mm_cvtsi128_si32(sq);
+                    auto e1 = (u32)_mm_cvtsi128_si32(_mm_srli_si128(sq, 8));
+                    if (e0 < best)
+                        best = e0, bestIndex = u8(i * 2);
+                    if (e1 < best)
+                        best = e1, bestIndex = u8(i * 2 + 1);
+                }
+                indices[t] = bestIndex;
+                total += best;
+            }
+            return total;
+        }
+
+        template<size_t C>
+        using Color = array<f32, C>;
+
+        //Ends of the segment through the texels along their principal axis, found by power iteration on the covariance.
+        template<size_t C>
+        pair<Color<C>, Color<C>> PrincipalEndpoints(const Block& block)
+        {
+            Color<C> mean{}, lo, hi;
+            lo.fill(255);
+            hi.fill(0);
+            for (auto& texel : block)
+            for (size_t c = 0; c < C; ++c)
+            {
+                mean[c] += texel[c];
+                lo[c] = std::min(lo[c], (f32)texel[c]);
+                hi[c] = std::max(hi[c], (f32)texel[c]);
+            }
+            for (auto& m : mean)
+                m /= 16;
+
+            array<array<f32, C>, C> cov{};
+            for (auto& texel : block)
+            for (size_t i = 0; i < C; ++i)
+            for (size_t j = 0; j < C; ++j)
+                cov[i][j] += (texel[i] - mean[i]) * (texel[j] - mean[j]);
+
+            auto axis = Color<C>{};
+            for (size_t c = 0; c < C; ++c)
+                axis[c] = hi[c] - lo[c];
+            for (auto iteration = 0; iteration < 8; ++iteration)
+            {
+                Color<C> next{};
+                for (size_t i = 0; i < C; ++i)
+                for (size_t j = 0; j < C; ++j)
+                    next[i] += cov[i][j] * axis[j];
+                auto length = std::sqrt(std::inner_product(next.begin(), next.end(), next.begin(), 0.f));
+                if (length < 1e-6f)
+                    break;
+                for (size_t c = 0; c < C; ++c)
+                    axis[c] = next[c] / length;
+            }
+            auto length = std::sqrt(std::inner_product(axis.begin(), axis.end(), axis.begin(), 0.f));
+            if (length < 1e-6f)
+                return { mean, mean };
+            for (auto& a : axis)
+                a /= length;
+
+            auto minT = 0.f, maxT = 0.f;
+            for (auto& texel : block)
+            {
+                auto t = 0.f;
+                for (size_t c = 0; c < C; ++c)
+                    t += (texel[c] - mean[c]) * axis[c];
+                minT = std::min(minT, t);
+                maxT = std::max(maxT, t);
+            }
+            pair<Color<C>, Color<C>> result;
+            for (size_t c = 0; c < C; ++c)
+            {
+                result.first[c]  = std::clamp(mean[c] + axis[c] * minT, 0.f, 255.f);
+                result.second[c] = std::clamp(mean[c] + axis[c] * maxT, 0.f, 255.f);
+            }
+            return result;
+        }
+
+        //Least squares endpoints for the indices that were picked, 'weights' being how far each index is towards the second endpoint.
+        template<size_t C, size_t N>
+        bool FitEndpoints(const Block& block, const array<u8, 16>& indices, const array<f32, N>& weights, Color<C>& a, Color<C>& b)
+        {
+            f32 aa = 0, ab = 0, bb = 0;
+            Color<C> xa{}, xb{};
+            for (size_t t = 0; t < 16; ++t)
+            {
+                auto w = weights[indices[t]];
+                aa += (1 - w) * (1 - w);
+                ab += (1 - w) * w;
+                bb += w * w;
+                for (size_t c = 0; c < C; ++c)
+                {
+                    xa[c] += (1 - w) * block[t][c];
+                    xb[c] += w * block[t][c];
+                }
+            }
+            auto det = aa * bb - ab * ab;
+            if (std::abs(det) < 1e-6f)
+                return false;
+            for (size_t c = 0; c < C; ++c)
+            {
+                a[c] = std::clamp((bb * xa[c] - ab * xb[c]) / det, 0.f, 255.f);
+                b[c] = std::clamp((aa * xb[c] - ab * xa[c]) / det, 0.f, 255.f);
+            }
+            return true;
+        }
+
+        struct BitWriter
+        {
+            array<u8, 16> Bytes{};
+            u32 Offset = 0;
+
+            void Write(u32 value, u32 count)
+            {
+                for (u32 i = 0; i < count; ++i, ++Offset) if (value >> i & 1)
+                    Bytes[Offset / 8] |= u8(1 << Offset % 8);
+            }
+        };
+
+        u16 To565(const Color<3>& c)
+        {
+            auto q = [](f32 v, u32 max) { return (u32)std::lround(v * max / 255); };
+            return u16(q(c[0], 31) << 11 | q(c[1], 63) << 5 | q(c[2], 31));
+        }
+
+        Rgba From565(u16 v)
+        {
+            u32 r = v >> 11, g = v >> 5 & 63, b = v & 31;
+            return { u8(r << 3 | r >> 2), u8(g << 2 | g >> 4), u8(b << 3 | b >> 2), 255 };
+        }
+
+        void EncodeBC1(Block block, u8* out)
+        {
+            //Alpha is ignored, keeping it at the palette's value leaves it out of the distances.
+            for (auto& texel : block)
+                texel[3] = 255;
+            //Index 2 and 3 sit at a third and two thirds of the way from the first endpoint to the second.
+            constexpr array<f32, 4> weights = { 0, 1, 1.f / 3, 2.f / 3 };
+
+            auto encode = [&](const Color<3>& a, const Color<3>& b)
+            {
+                u16 e0 = To565(a), e1 = To565(b);
+                //The four color mode needs the first endpoint to be the greater one.
+                if (e0 < e1)
+                    std::swap(e0, e1);
+                array<u8, 16> idx{};
+                u32 error;
+                if (e0 == e1)
+                {
+                    auto p = From565(e0);
+                    error = ClosestIndices<2>(block, { p, p }, idx);
+                    idx.fill(0);
+                }
+                else
+                {
+                    auto p0 = From565(e0), p1 = From565(e1);
+                    array<Rgba, 4> palette = { p0, p1, p0, p1 };
+                    for (size_t c = 0; c < 3; ++c)
+                    {
+                        palette[2][c] = u8((2 * p0[c] + p1[c]) / 3);
+                        palette[3][c] = u8((p0[c] + 2 * p1[c]) / 3);
+                    }
+                    error = ClosestIndices(block, palette, idx);
+                }
+                return tuple(error, e0, e1, idx);
+            };
+
+            auto [a, b] = PrincipalEndpoints<3>(block);
+            auto [error, c0, c1, indices] = encode(a, b);
+            //The indices follow the endpoints as they were ordered by 'encode', which may have swapped 'a' and 'b'.
+            Color<3> fa, fb;
+            for (auto step = 0; step < 3 && error > 0 && c0 != c1 && FitEndpoints(block, indices, weights, fa, fb); ++step)
+            {
+                auto [refined, r0, r1, ridx] = encode(fa, fb);
+                if (refined >= error)
+                    break;
+                tie(error, c0, c1, indices) = tie(refined, r0, r1, ridx);
+            }
+
+            u32 bits = 0;
+            for (size_t t = 0; t < 16; ++t)
+                bits |= u32(indices[t]) << t * 2;
+            std::memcpy(out, &c0, 2);
+            std::memcpy(out + 2, &c1, 2);
+            std::memcpy(out + 4, &bits, 4);
+        }
+
+        //Always the eight value mode, the extremes of the block are its endpoints.
+        void EncodeBC4(const Block& block, size_t channel, u8* out)
+        {
+            u8 lo = 255, hi = 0;
+            for (auto& texel : block)
+            {
+                lo = std::min(lo, texel[channel]);
+                hi = std::max(hi, texel[channel]);
+            }
+            u64 bits = 0;
+            if (hi > lo)
+            {
+                array<i32, 8> palette = { hi, lo };
+                for (i32 i = 2; i < 8; ++i)
+                    palette[i] = ((8 - i) * hi + (i - 1) * lo) / 7;
+                for (size_t t = 0; t < 16; ++t)
+                {
+                    auto v = (i32)block[t][channel];
+                    u64 best = 0;
+                    for (u64 i = 1; i < 8; ++i) if (std::abs(palette[i] - v) < std::abs(palette[best] - v))
+                        best = i;
+                    bits |= best << t * 3;
+                }
+            }
+            out[0] = hi;
+            out[1] = lo;
+            for (size_t i = 0; i < 6; ++i)
+                out[2 + i] = u8(bits >> i * 8);
+        }
+
+        //Mode 6 only: one subset with RGBA endpoints of 7 bits plus a shared low bit each, and 4 bit indices.
+        void EncodeBC7(const Block& block, u8* out)
+        {
+            constexpr auto weights = []
+            {
+                array<f32, 16> result;
+                for (size_t i = 0; i < 16; ++i)
+                    result[i] = Bc7Weights[i] / 64.f;
+                return result;
+            }();
+
+            struct Endpoint
+            {
+                array<u32, 4> Q; //7 bits per channel.
+                u32 P;
+                u8 Value(size_t c) const { return u8(Q[c] << 1 | P); }
+            };
+
+            auto quantize = [](const Color<4>& color)
+            {
+                Endpoint best{};
+                auto bestError = std::numeric_limits<f32>::max();
+                for (u32 p = 0; p < 2; ++p)
+                {
+                    Endpoint e{ {}, p };
+                    auto error = 0.f;
+                    for (size_t c = 0; c < 4; ++c)
+                    {
+                        e.Q[c] = (u32)std::clamp(std::lround((color[c] - p) / 2), 0l, 127l);
+                        auto d = e.Value(c) - color[c];
+                        error += d * d;
+                    }
+                    if (error < bestError)
+                        best = e, bestError = error;
+                }
+                return best;
+            };
+
+            auto encode = [&](const Color<4>& a, const Color<4>& b)
+            {
+                auto e0 = quantize(a), e1 = quantize(b);
+                array<Rgba, 16> palette;
+                for (size_t i = 0; i < 16; ++i)
+                for (size_t c = 0; c < 4; ++c)
+                    palette[i][c] = u8(((64 - Bc7Weights[i]) * e0.Value(c) + Bc7Weights[i] * e1.Value(c) + 32) >> 6);
+                array<u8, 16> indices;
+                auto error = ClosestIndices(block, palette, indices);
+                return tuple(error, e0, e1, indices);
+            };
+
+            auto [a, b] = PrincipalEndpoints<4>(block);
+            auto [error, e0, e1, indices] = encode(a, b);
+            //Refitting converges in a few steps, it stops as soon as one doesn't help.
+            for (auto step = 0; step < 3 && error > 0 && FitEndpoints(block, indices, weights, a, b); ++step)
+            {
+                auto [refined, r0, r1, ridx] = encode(a, b);
+                if (refined >= error)
+                    break;
+                tie(error, e0, e1, indices) = tie(refined, r0, r1, ridx);
+            }
+
+            //The high bit of the first index is implied to be zero.
+            if (indices[0] & 8)
+            {
+                std::swap(e0, e1);
+                for (auto& i : indices)
+                    i = u8(15 - i);
+            }
+
+            BitWriter writer;
+            writer.Write(1 << 6, 7);
+            for (size_t c = 0; c < 4; ++c)
+            {
+                writer.Write(e0.Q[c], 7);
+                writer.Write(e1.Q[c], 7);
+            }
+            writer.Write(e0.P, 1);
+            writer.Write(e1.P, 1);
+            writer.Write(indices[0], 3);
+            for (size_t t = 1; t < 16; ++t)
+                writer.Write(indices[t], 4);
+            std::memcpy(out, writer.Bytes.data(), 16);
+        }
+
+    }
+
+    u32 BlockSizeOf(BlockFormat format)
+    {
+        switch (format)
+        {
+        case BlockFormat::BC1: return 8;
+        case BlockFormat::BC4: return 8;
+        case BlockFormat::BC5: return 16;
+        case BlockFormat::BC7: return 16;
+        default: throw invalid_argument("Invalid value for 'format': {}"_f((u32)format));
+        }
+    }
+
+    u64 CompressedSizeOf(BlockFormat format, u32 width, u32 height)
+    {
+        return u64((width + 3) / 4) * ((height + 3) / 4) * BlockSizeOf(format);
+    }
+
+    vk::Format VkFormatOf(BlockFormat format, bool srgb)
+    {
+        using enum vk::Format;
+        switch (format)
+        {
+        case BlockFormat::BC1: return srgb ? eBc1RgbSrgbBlock : eBc1RgbUnormBlock;
+        case BlockFormat::BC4: return eBc4UnormBlock;
+        case BlockFormat::BC5: return eBc5UnormBlock;
+        case BlockFormat::BC7: return srgb ? eBc7SrgbBlock : eBc7UnormBlock;
+        default: throw invalid_argument("Invalid value for 'format': {}"_f((u32)format));
+        }
+    }
+
+    vector<u8> CompressImage(cspan<u8> rgba, u32 width, u32 height, BlockFormat format, ThreadPool* threadPool)
+    {
+        if (width == 0 || height == 0)
+            throw invalid_argument("Can't compress an empty image.");
+        if (rgba.size() < size_t(width) * height * 4)
+            throw invalid_argument("Expected {} bytes of RGBA texels, found {}."_f(size_t(width) * height * 4, rgba.size()));
+
+        auto blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+        auto blockSize = BlockSizeOf(format);
+        vector<u8> result(CompressedSizeOf(format, width, height));
+        auto encodeRow = [&](u32 y)
+        {
+            auto out = result.data() + size_t(y) * blocksX * blockSize;
+            for (u32 x = 0; x < blocksX; ++x, out += blockSize)
+            {
+                auto block = LoadBlock(rgba, width, height, x, y);
+                switch (format)
+                {
+                case BlockFormat::BC1: EncodeBC1(block, out); break;
+                case BlockFormat::BC4: EncodeBC4(block, 0, out); break;
+                case BlockFormat::BC5: EncodeBC4(block, 0, out); EncodeBC4(block, 1, out + 8); break;
+                case BlockFormat::BC7: EncodeBC7(block, out); break;
+                }
+            }
+        };
+
+        if (!threadPool || blocksY == 1)
+        {
+            for (u32 y = 0; y < blocksY; ++y)
+                encodeRow(y);
+            return result;
+        }
+        threadPool->ParallelSubmit(blocksY, [&](size_t y) { encodeRow((u32)y); }).get();
+        return result;
+    }
+
+}
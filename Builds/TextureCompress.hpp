@@ -0,0 +1,26 @@
+#pragma once
+#include "Kaey/Renderer/ThreadPool.hpp"
+#include "Kaey/Renderer/Utility.hpp"
+
+namespace Kaey::Renderer
+{
+    enum class BlockFormat : u8
+    {
+        BC1, //RGB at 4 bits per texel, alpha is dropped.
+        BC4, //Red at 4 bits per texel.
+        BC5, //Red and green at 8 bits per texel, for tangent space normals whose z is rebuilt when sampled.
+        BC7, //RGBA at 8 bits per texel.
+    };
+
+    //Bytes of every 4x4 block.
+    u32 BlockSizeOf(BlockFormat format);
+
+    u64 CompressedSizeOf(BlockFormat format, u32 width, u32 height);
+
+    vk::Format VkFormatOf(BlockFormat format, bool srgb);
+
+    //Encodes 'rgba', 4 bytes per texel row after row, as 4x4 blocks row after row. Blocks past the edges repeat the last row and column.
+    //Rows of blocks are spread over 'threadPool' when one is given, so it must not be called from one of its tasks.
+    vector<u8> CompressImage(cspan<u8> rgba, u32 width, u32 height, BlockFormat format, ThreadPool* threadPool = nullptr);
+
+}
@@ -0,0 +1,435 @@
+#include "TextureFile.hpp"
+
+#include "MeshFile.hpp"
+
+#include <emmintrin.h>
+#include <xmmintrin.h>
+
+namespace Kaey::Renderer
+{
+    namespace
+    {
+        constexpr array<u8, 12> Ktx2Identifier = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+        struct Ktx2Header
+        {
+            array<u8, 12> Identifier;
+            u32 VkFormat;
+            u32 TypeSize;
+            u32 PixelWidth;
+            u32 PixelHeight;
+            u32 PixelDepth;
+            u32 LayerCount;
+            u32 FaceCount;
+            u32 LevelCount;
+            u32 SupercompressionScheme;
+            u32 DfdByteOffset;
+            u32 DfdByteLength;
+            u32 KvdByteOffset;
+            u32 KvdByteLength;
+            u64 SgdByteOffset;
+            u64 SgdByteLength;
+        };
+        static_assert(sizeof(Ktx2Header) == 80);
+
+        struct Ktx2Level
+        {
+            u64 ByteOffset;
+            u64 ByteLength;
+            u64 UncompressedByteLength;
+        };
+
+        struct FormatInfo
+        {
+            u8 ColorModel;    //KHR_DF_MODEL_BC*
+            u8 Transfer;      //1 linear, 2 sRGB.
+            u32 BlockSize;
+            u32 ChannelCount; //Samples in the descriptor, each one a channel of its own 64 bits.
+        };
+
+        FormatInfo InfoOf(vk::Format format)
+        {
+            using enum vk::Format;
+            switch (format)
+            {
+            case eBc1RgbUnormBlock: return { 128, 1,  8, 1 };
+            case eBc1RgbSrgbBlock:  return { 128, 2,  8, 1 };
+            case eBc4UnormBlock:    return { 131, 1,  8, 1 };
+            case eBc5UnormBlock:    return { 132, 1, 16, 2 };
+            case eBc7UnormBlock:    return { 134, 1, 16, 1 };
+            case eBc7SrgbBlock:     return { 134, 2, 16, 1 };
+            default: throw runtime_error("Unsupported texture format: {}"_f(vk::to_string(format)));
+            }
+        }
+
+        template<class T>
+        void Append(vector<u8>& bytes, const T& value)
+        {
+            auto ptr = (const u8*)&value;
+            bytes.insert(bytes.end(), ptr, ptr + sizeof(T));
+        }
+
+        //Basic data format descriptor, the one block every KTX2 file needs.
+        vector<u8> DataFormatDescriptor(const FormatInfo& info)
+        {
+            auto blockSize = 24 + 16 * info.ChannelCount;
+            vector<u8> bytes;
+            Append(bytes, u32(4 + blockSize));
+            Append(bytes, u32(0));                //Khronos vendor, basic descriptor type.
+            Append(bytes, u16(2));                //Version.
+            Append(bytes, u16(blockSize));
+            Append(bytes, info.ColorModel);
+            Append(bytes, u8(1));                 //BT.709 primaries.
+            Append(bytes, info.Transfer);
+            Append(bytes, u8(0));                 //Straight alpha.
+            Append(bytes, array<u8, 4>{ 3, 3, 0, 0 }); //4x4 texels, minus one.
+            Append(bytes, array<u8, 8>{ u8(info.BlockSize) });
+            for (u32 i = 0; i < info.ChannelCount; ++i)
+            {
+                auto bits = info.BlockSize * 8 / info.ChannelCount;
+                Append(bytes, u16(i * bits));     //Bit offset.
+                Append(bytes, u8(bits - 1));
+                Append(bytes, u8(i));             //Channel: color for BC1 and BC7, red then green for BC4 and BC5.
+                Append(bytes, array<u8, 4>{});    //Sample position.
+                Append(bytes, u32(0));
+                Append(bytes, UINT32_MAX);
+            }
+            return bytes;
+        }
+
+        u64 AlignUp(u64 value, u64 alignment)
+        {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        const auto SrgbToLinear = []
+        {
+            array<f32, 256> result;
+            for (u32 i = 0; i < 256; ++i)
+            {
+                auto v = i / 255.f;
+                result[i] = v <= .04045f ? v / 12.92f : std::pow((v + .055f) / 1.055f, 2.4f);
+            }
+            return result;
+        }();
+
+        u8 ToUnorm8(f32 v)
+        {
+            return u8(std::lround(std::clamp(v, 0.f, 1.f) * 255));
+        }
+
+        u8 LinearToSrgb(f32 v)
+        {
+            v = std::clamp(v, 0.f, 1.f);
+            return ToUnorm8(v <= .0031308f ? v * 12.92f : 1.055f * std::pow(v, 1 / 2.4f) - .055f);
+        }
+
+        //Zeroth order modified Bessel function of the first kind, by its power series.
+        f32 BesselI0(f32 x)
+        {
+            f32 sum = 1, term = 1;
+            for (auto k = 1; k < 32 && term > sum * 1e-8f; ++k)
+            {
+                term *= (x / (2 * k)) * (x / (2 * k));
+                sum += term;
+            }
+            return sum;
+        }
+
+        constexpr f32 KaiserWidth = 3;
+        constexpr f32 KaiserAlpha = 4;
+
+        f32 FilterWeight(MipFilter filter, f32 t)
+        {
+            t = std::abs(t);
+            if (filter == MipFilter::Box)
+                return t < .5f ? 1.f : 0.f;
+            if (t >= KaiserWidth)
+                return 0;
+            auto x = t / KaiserWidth;
+            auto sinc = t < 1e-5f ? 1 : std::sin(std::numbers::pi_v<f32> * t) / (std::numbers::pi_v<f32> * t);
+            return sinc * BesselI0(KaiserAlpha * std::sqrt(1 - x * x)) / BesselI0(KaiserAlpha);
+        }
+
+        //Source texels and their weights for each texel of a smaller row or column. Texels past the edges are clamped.
+        vector<vector<pair<u32, f32>>> TapsOf(u32 srcSize, u32 dstSize, MipFilter filter)
+        {
+            auto ratio = f32(srcSize) / dstSize;
+            auto support = (filter == MipFilter::Box ? .5f : KaiserWidth) * ratio;
+            vector<vector<pair<u32, f32>>> result(dstSize);
+            for (u32 i = 0; i < dstSize; ++i)
+            {
+                auto center = (i + .5f) * ratio;
+                auto& taps = result[i];
+                auto sum = 0.f;
+                for (auto j = (i32)std::floor(center - support); j <= (i32)std::ceil(center + support); ++j)
+                {
+                    auto w = FilterWeight(filter, (j + .5f - center) / ratio);
+                    if (w == 0)
+                        continue;
+                    taps.emplace_back((u32)std::clamp(j, 0, i32(srcSize) - 1), w);
+                    sum += w;
+                }
+                for (auto& [index, w] : taps)
+                    w /= sum;
+            }
+            return result;
+        }
+
+        //Four floats per texel, so every texel is one SSE register.
+        struct LinearImage
+        {
+            u32 Width, Height;
+            vector<f32> Texels;
+        };
+
+        void ForEachRow(ThreadPool* threadPool, u32 rows, u32 rowSize, auto&& fn)
+        {
+            constexpr u32 MinTexelsPerTask = 1 << 16;
+            auto rowsPerTask = std::max(1u, MinTexelsPerTask / std::max(1u, rowSize));
+            if (!threadPool || rows <= rowsPerTask)
+            {
+                for (u32 y = 0; y < rows; ++y)
+                    fn(y);
+                return;
+            }
+            threadPool->ParallelSubmit((rows + rowsPerTask - 1) / rowsPerTask, [&](size_t task)
+            {
+                auto begin = u32(task) * rowsPerTask;
+                for (auto y = begin; y < std::min(rows, begin + rowsPerTask); ++y)
+                    fn(y);
+            }).get();
+        }
+
+        //Separable, rows first then columns.
+        LinearImage Downsample(const LinearImage& src, MipFilter filter, ThreadPool* threadPool)
+        {
+            auto width = std::max(1u, src.Width / 2), height = std::max(1u, src.Height / 2);
+            auto tapsX = TapsOf(src.Width, width, filter);
+            auto tapsY = TapsOf(src.Height, height, filter);
+
+            LinearImage rows{ width, src.Height, vector<f32>(size_t(width) * src.Height * 4) };
+            ForEachRow(threadPool, src.Height, width, [&](u32 y)
+            {
+                auto in = src.Texels.data() + size_t(y) * src.Width * 4;
+                auto out = rows.Texels.data() + size_t(y) * width * 4;
+                for (u32 x = 0; x < width; ++x)
+                {
+                    auto sum = _mm_setzero_ps();
+                    for (auto& [i, w] : tapsX[x])
+                        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w), _mm_loadu_ps(in + size_t(i) * 4)));
+                    _mm_storeu_ps(out + size_t(x) * 4, sum);
+                }
+            });
+
+            LinearImage result{ width, height, vector<f32>(size_t(width) * height * 4) };
+            ForEachRow(threadPool, height, width, [&](u32 y)
+            {
+                auto out = result.Texels.data() + size_t(y) * width * 4;
+                for (u32 x = 0; x < width; ++x)
+                {
+                    auto sum = _mm_setzero_ps();
+                    for (auto& [i, w] : tapsY[y])
+                        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w), _mm_loadu_ps(rows.Texels.data() + (size_t(i) * width + x) * 4)));
+                    _mm_storeu_ps(out + size_t(x) * 4, sum);
+                }
+            });
+            return result;
+        }
+
+    }
+
+    void TextureFile::Save(crpath path) const
+    {
+        auto info = InfoOf(Format);
+        if (Levels.empty())
+            throw runtime_error("Texture has no levels.");
+
+        auto dfd = DataFormatDescriptor(info);
+        auto levelIndexOffset = sizeof(Ktx2Header);
+        auto dfdOffset = levelIndexOffset + Levels.size() * sizeof(Ktx2Level);
+
+        //Levels are laid out smallest first, each aligned to its block size.
+        vector<Ktx2Level> levelIndex(Levels.size());
+        auto offset = u64(dfdOffset + dfd.size());
+        for (auto i = Levels.size(); i-- > 0;)
+        {
+            offset = AlignUp(offset, info.BlockSize);
+            levelIndex[i] = { offset, Levels[i].size(), Levels[i].size() };
+            offset += Levels[i].size();
+        }
+
+        Ktx2Header header
+        {
+            .Identifier = Ktx2Identifier,
+            .VkFormat = (u32)Format,
+            .TypeSize = 1,
+            .PixelWidth = Width,
+            .PixelHeight = Height,
+            .PixelDepth = 0,
+            .LayerCount = 0,
+            .FaceCount = 1,
+            .LevelCount = (u32)Levels.size(),
+            .SupercompressionScheme = 0,
+            .DfdByteOffset = (u32)dfdOffset,
+            .DfdByteLength = (u32)dfd.size(),
+            .KvdByteOffset = 0,
+            .KvdByteLength = 0,
+            .SgdByteOffset = 0,
+            .SgdByteLength = 0,
+        };
+
+        vector<u8> bytes;
+        bytes.reserve(offset);
+        Append(bytes, header);
+        for (auto& level : levelIndex)
+            Append(bytes, level);
+        bytes.insert_range(bytes.end(), dfd);
+        for (auto i = Levels.size(); i-- > 0;)
+        {
+            bytes.resize(levelIndex[i].ByteOffset);
+            bytes.insert_range(bytes.end(), Levels[i]);
+        }
+
+        auto os = ofstream(path, std::ios::binary);
+        if (!os.is_open())
+            throw runtime_error("Failed to open file: {}"_f(path.string()));
+        os.write((const char*)bytes.data(), (streamsize)bytes.size());
+    }
+
+    TextureFile TextureFile::Load(crpath path)
+    {
+        auto file = MappedFile(path);
+        auto bytes = file.Bytes;
+        Ktx2Header header;
+        if (bytes.size() < sizeof(header))
+            throw runtime_error("File is too small to be a KTX2 texture: {}"_f(path.string()));
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        if (header.Identifier != Ktx2Identifier)
+            throw runtime_error("Invalid KTX2 identifier in file: {}"_f(path.string()));
+        if (header.SupercompressionScheme != 0)
+            throw runtime_error("Unsupported KTX2 supercompression scheme: {}"_f(header.SupercompressionScheme));
+        if (header.PixelDepth > 1 || header.LayerCount > 1 || header.FaceCount != 1)
+            throw runtime_error("Only 2D textures are supported: {}"_f(path.string()));
+
+        TextureFile result{ vk::Format(header.VkFormat), header.PixelWidth, header.PixelHeight, {} };
+        auto levelCount = std::max(1u, header.LevelCount);
+        if (sizeof(header) + levelCount * sizeof(Ktx2Level) > bytes.size())
+            throw runtime_error("Truncated KTX2 level index in file: {}"_f(path.string()));
+        for (u32 i = 0; i < levelCount; ++i)
+        {
+            Ktx2Level level;
+            std::memcpy(&level, bytes.data() + sizeof(header) + i * sizeof(Ktx2Level), sizeof(level));
+            if (level.ByteOffset > bytes.size() || level.ByteLength > bytes.size() - level.ByteOffset)
+                throw runtime_error("Level {} is out of bounds in file: {}"_f(i, path.string()));
+            result.Levels.emplace_back(bytes.subspan(level.ByteOffset, level.ByteLength) | to_vector);
+        }
+        return result;
+    }
+
+    vector<vector<u8>> GenerateMipChain(cspan<u8> rgba, u32 width, u32 height, bool srgb, MipFilter filter, ThreadPool* threadPool)
+    {
+        if (rgba.size() < size_t(width) * height * 4)
+            throw invalid_argument("Expected {} bytes of RGBA texels, found {}."_f(size_t(width) * height * 4, rgba.size()));
+
+        LinearImage image{ width, height, vector<f32>(size_t(width) * height * 4) };
+        ForEachRow(threadPool, height, width, [&](u32 y)
+        {
+            for (auto i = size_t(y) * width * 4; i < size_t(y + 1) * width * 4; ++i)
+                image.Texels[i] = srgb && i % 4 != 3 ? SrgbToLinear[rgba[i]] : rgba[i] / 255.f;
+        });
+
+        vector<vector<u8>> levels;
+        while (image.Width > 1 || image.Height > 1)
+        {
+            image = Downsample(image, filter, threadPool);
+            auto& level = levels.emplace_back(image.Texels.size());
+            ForEachRow(threadPool, image.Height, image.Width, [&](u32 y)
+            {
+                for (auto i = size_t(y) * image.Width * 4; i < size_t(y + 1) * image.Width * 4; ++i)
+                    level[i] = srgb && i % 4 != 3 ? LinearToSrgb(image.Texels[i]) : ToUnorm8(image.Texels[i]);
+            });
+        }
+        return levels;
+    }
+
+    //PVP's textures, the N ones are its normal maps.
+    static_assert(IsNormalMapName("NaoimheN_1001") && IsNormalMapName("NaoimheN_1005") && !IsNormalMapName("NaoimheD_1001"));
+    static_assert(IsNormalMapName("N_Rock") && IsNormalMapName("rock_n") && IsNormalMapName("Rock_Normal_2") && !IsNormalMapName("SKIN") && !IsNormalMapName("Brown_1001"));
+
+    TextureCookOptions DefaultCookOptions(crpath path, std::optional<bool> normalMap)
+    {
+        //Not BC5, the shaders sample all three channels of a normal map instead of rebuilding z.
+        if (normalMap.value_or(IsNormalMapName(path.stem().string())))
+            return { BlockFormat::BC7, false };
+        int width, height, channels;
+        if (!stbi_info(path.string().c_str(), &width, &height, &channels))
+            throw runtime_error("Failed to read image '{}': {}"_f(path.string(), stbi_failure_reason()));
+        if (channels == 1)
+            return { BlockFormat::BC4, false };
+        return { BlockFormat::BC7, true };
+    }
+
+    TextureFile CookTexture(crpath path, ThreadPool* threadPool)
+    {
+        return CookTexture(path, DefaultCookOptions(path), threadPool);
+    }
+
+    TextureFile CookTexture(crpath path, const TextureCookOptions& options, ThreadPool* threadPool)
+    {
+        int width, height, channels;
+        auto pixels = stbi_load(path.string().c_str(), &width, &height, &channels, STBI_rgb_alpha);
+        if (!pixels)
+            throw runtime_error("Failed to decode image '{}': {}"_f(path.string(), stbi_failure_reason()));
+        auto rgba = vector(pixels, pixels + size_t(width) * height * 4);
+        stbi_image_free(pixels);
+
+        TextureFile result{ VkFormatOf(options.Format, options.Srgb), (u32)width, (u32)height, {} };
+        result.Levels.emplace_back(CompressImage(rgba, result.Width, result.Height, options.Format, threadPool));
+        if (!options.Mips)
+            return result;
+        auto mips = GenerateMipChain(rgba, result.Width, result.Height, options.Srgb, options.Filter, threadPool);
+        for (auto [i, mip] : mips | indexed)
+            result.Levels.emplace_back(CompressImage(mip, std::max(1u, result.Width >> (i + 1)), std::max(1u, result.Height >> (i + 1)), options.Format, threadPool));
+        return result;
+    }
+
+    unique_ptr<Texture> CreateTexture(RenderDevice* device, const TextureFile& file)
+    {
+        auto info = InfoOf(file.Format);
+        vector<u64> offsets;
+        u64 size = 0;
+        for (auto& level : file.Levels)
+        {
+            size = AlignUp(size, info.BlockSize);
+            offsets.emplace_back(size);
+            size += level.size();
+        }
+
+        auto staging = MemoryBuffer(device, size, vk::BufferUsageFlagBits::eTransferSrc, { .DeviceLocal = false, .HostVisible = true });
+        auto data = (u8*)staging.MapMemory();
+        for (auto [i, level] : file.Levels | indexed)
+            std::memcpy(data + offsets[i], level.data(), level.size());
+        staging.UnmapMemory();
+
+        auto texture = make_unique<Texture>(device, TextureArgs{ Vector2U32{ file.Width, file.Height }, file.Format, (u32)file.Levels.size() });
+        vector<vk::BufferImageCopy> regions;
+        for (auto i : irange((u32)file.Levels.size()))
+        {
+            regions.emplace_back(
+                offsets[i],
+                0,
+                0,
+                vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, i, 0, 1 },
+                vk::Offset3D{ 0, 0, 0 },
+                vk::Extent3D{ std::max(1u, file.Width >> i), std::max(1u, file.Height >> i), 1 }
+            );
+        }
+        device->ExecuteSingleTimeCommands([&](Frame* fr)
+        {
+            fr->CommandBuffer.copyBufferToImage(staging.Instance, texture->Instance, vk::ImageLayout::eGeneral, regions);
+        });
+        return texture;
+    }
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include "Kaey/Renderer/Renderer.hpp"
+
+#include "TextureCompress.hpp"
+
+namespace Kaey::Renderer
+{
+    constexpr string_view TextureFileExtension = ".ktx2";
+
+    //A cooked texture, stored as KTX2 without supercompression so every level can be copied to the GPU as it is.
+    struct TextureFile
+    {
+        vk::Format Format = vk::Format::eUndefined;
+        u32 Width = 0;
+        u32 Height = 0;
+        vector<vector<u8>> Levels; //Largest first, each half the size of the previous one down to 1x1.
+
+        void Save(crpath path) const;
+        static TextureFile Load(crpath path);
+    };
+
+    enum class MipFilter : u8
+    {
+        Box,    //Average of the texels each one covers.
+        Kaiser, //Kaiser windowed sinc, keeps more detail at the cost of a wider footprint.
+    };
+
+    struct TextureCookOptions
+    {
+        BlockFormat Format = BlockFormat::BC7;
+        bool Srgb = true;
+        bool Mips = true;
+        MipFilter Filter = MipFilter::Kaiser;
+    };
+
+    //Every level after 'rgba' down to 1x1, each filtered from the previous one in linear space.
+    //With 'srgb' color is decoded before filtering and encoded after, alpha is always linear.
+    vector<vector<u8>> GenerateMipChain(cspan<u8> rgba, u32 width, u32 height, bool srgb, MipFilter filter, ThreadPool* threadPool = nullptr);
+
+    //Whether an image stem names a normal map, after dropping a trailing UDIM tile or number like '_1001'.
+    //Either it starts with 'N_', ends with '_N', ends with a capital N after a lowercase letter like 'NaoimheN', or contains 'normal'.
+    constexpr bool IsNormalMapName(string_view stem)
+    {
+        if (auto i = stem.find_last_not_of("0123456789"); i != string_view::npos && i + 1 < stem.size() && stem[i] == '_')
+            stem = stem.substr(0, i);
+        auto lower = [](char c) { return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c; };
+        auto equals = [&](string_view a, string_view b) { return rn::equal(a, b, {}, lower, lower); };
+        if (stem.size() >= 2 && (equals(stem.substr(0, 2), "n_") || equals(stem.substr(stem.size() - 2), "_n")))
+            return true;
+        if (stem.size() >= 2 && stem.back() == 'N' && stem[stem.size() - 2] >= 'a' && stem[stem.size() - 2] <= 'z')
+            return true;
+        for (size_t i = 0; i + 6 <= stem.size(); ++i)
+            if (equals(stem.substr(i, 6), "normal"))
+                return true;
+        return false;
+    }
+
+    //Normal maps go to linear BC7, single channel images to BC4 and everything else to sRGB BC7.
+    //Without 'normalMap' it's taken from the name, see IsNormalMapName.
+    TextureCookOptions DefaultCookOptions(crpath path, std::optional<bool> normalMap = std::nullopt);
+
+    //Decodes any image stb_image reads and block compresses it.
+    TextureFile CookTexture(crpath path, ThreadPool* threadPool = nullptr);
+    TextureFile CookTexture(crpath path, const TextureCookOptions& options, ThreadPool* threadPool = nullptr);
+
+    //Uploads every level through one staging buffer and a single copy, so nothing is generated on the GPU.
+    unique_ptr<Texture> CreateTexture(RenderDevice* device, const TextureFile& file);
+
+}
@@ -55,6 +55,7 @@
 #include <semaphore>
 #include <set>
 #include <span>
+#include <spanstream>
 #include <sstream>
 #include <stack>
 #include <stdexcept>
@@ -68,7 +69,9 @@
 
 #include <cassert>
 #include <climits>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 
 #include "Kaey/Renderer/Vulkan_FMT.hpp"
@@ -0,0 +1,78 @@
+#include "AssetGraph.hpp"
+#include "All.hpp"
+
+namespace Kaey::Engine
+{
+    void AssetGraph::Add(function<void()> load)
+    {
+        {
+            lock_guard l(mut);
+            ++total;
+            if (!threadPool)
+            {
+                waiting.emplace_back(move(load));
+                return;
+            }
+        }
+        Start(move(load));
+    }
+
+    future<void> AssetGraph::Run(Engine::ThreadPool* threadPool)
+    {
+        vector<function<void()>> ready;
+        auto result = finished.get_future();
+        {
+            lock_guard l(mut);
+            assert(!this->threadPool);
+            this->threadPool = threadPool;
+            if (total == 0)
+            {
+                finished.set_value();
+                return result;
+            }
+            ready = move(waiting);
+        }
+        for (auto& load : ready)
+            Start(move(load));
+        return result;
+    }
+
+    void AssetGraph::Start(function<void()> load)
+    {
+        threadPool->Submit([this, load = move(load)]
+        {
+            try
+            {
+                load();
+            }
+            catch (...)
+            {
+                lock_guard l(mut);
+                if (!error)
+                    error = std::current_exception();
+            }
+            Finish();
+        });
+    }
+
+    void AssetGraph::Finish()
+    {
+        //Counted last, whoever waits on the future may destroy the graph as soon as it's ready.
+        std::promise<void> promise;
+        std::exception_ptr e;
+        {
+            lock_guard l(mut);
+            ++done;
+            if (progressCallback)
+                progressCallback(done, total);
+            if (done != total)
+                return;
+            promise = move(finished);
+            e = error;
+        }
+        if (e)
+            promise.set_exception(e);
+        else promise.set_value();
+    }
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "Utils.hpp"
+
+namespace Kaey::Engine
+{
+    //Loads run on the thread pool, each one adds the loads it finds it needs as soon as it knows them,
+    //so a prefab's meshes start while its siblings are still being read instead of waiting on the whole level.
+    struct AssetGraph
+    {
+        AssetGraph() = default;
+
+        AssetGraph(const AssetGraph&) = delete;
+        AssetGraph(AssetGraph&&) = delete;
+
+        AssetGraph& operator=(const AssetGraph&) = delete;
+        AssetGraph& operator=(AssetGraph&&) = delete;
+
+        ~AssetGraph() = default;
+
+        //Loads added before Run wait for it, after it they start right away. Can be called from a running load.
+        void Add(function<void()> load);
+
+        //Called after every load that finishes with how many are done and how many there are so far.
+        //Called under the graph's lock so the counts never go backwards, it must not call into the graph.
+        void SetProgressCallback(function<void(u32, u32)> callback) { progressCallback = move(callback); }
+
+        //Ready once every load ran, holds the first exception a load threw, if any.
+        //The graph must be kept until the future is ready.
+        future<void> Run(Engine::ThreadPool* threadPool);
+
+    private:
+        Engine::ThreadPool* threadPool = nullptr;
+        mutex mut;
+        vector<function<void()>> waiting; //Added before Run.
+        u32 total = 0;
+        u32 done = 0;
+        std::exception_ptr error;
+        std::promise<void> finished;
+        function<void(u32, u32)> progressCallback;
+
+        void Start(function<void()> load);
+        void Finish();
+    };
+
+}
@@ -1,142 +1,396 @@
 #pragma once
 #include "Utils.hpp"
+#include "ResidencyManager.hpp"
 
 #define KAEY_ENGINE_ASSET_MAP(type, map) \
     template<class AssetType = type, class... Args> shared_ptr<AssetType> FindOrCreate##type(fs::path path, Args&&... args) { return map.FindOrCreateShared<AssetType>(move(path), std::forward<Args>(args)...); } \
     const fs::path& PathOf(type* asset) const { return map.PathOf(asset); } \
     string_view NameOf(type* asset) const { return map.NameOf(asset); } \
-    shared_ptr<type> SharedOf(type* asset) const { return map.SharedOf(asset); }
+    shared_ptr<type> SharedOf(type* asset) const { return map.SharedOf(asset); } \
+    AssetHandle<type> HandleOf(type* asset) const { return map.HandleOf(asset); } \
+    shared_ptr<type> SharedOf(AssetHandle<type> handle) const { return map.SharedOf(handle); }
 
 namespace Kaey::Engine
 {
+    //Slot of an asset in its map, the generation tells apart the assets a slot held over time.
+    template<class Asset>
+    struct AssetHandle
+    {
+        u32 Index = u32(-1);
+        u32 Generation = 0;
+
+        explicit operator bool() const { return Index != u32(-1); }
+        bool operator==(const AssetHandle&) const = default;
+    };
+
+    //Assets by path, split in shards so threads loading different assets rarely wait on each other.
+    //Requests for an asset that is still loading wait on its future instead of loading it again.
+    //The pointers handed out count their own references, the last one to go queues the asset for release.
     template<class Asset>
     struct AssetMap
     {
+        static constexpr size_t ShardCount = 16;
+        static constexpr size_t ReleaseBatchSize = 64; //Most releases handled by one Update.
+
         struct AssetItem
         {
             Asset* Ptr;
             const string* NamePtr;
-            const fs::path* PathPtr;
-            shared_ptr<Asset> Shared;
-            i32 Index;
+            const fs::path* PathPtr;  //Key of the item in its shard, so each path is stored once.
+            shared_ptr<Asset> Shared; //Keeps the asset between its last pointer going and its release.
+            weak_ptr<Asset> External; //Pointers handed out, they share one count per lease.
+            u32 Lease;                //Bumped every time the handed out pointers start over.
+            AssetHandle<Asset> Handle;
+            bool Registered;          //In Assets, after SubmitSyncronized ran.
+            bool Released;
+            std::shared_future<void> Ready;
+            u64 Size;                 //Resident bytes, as accounted to the residency manager.
+            u64 Ticket;               //Retained by the residency manager while nothing references it, 0 otherwise.
         };
 
+        AssetMap() = default;
+
+        AssetMap(const AssetMap&) = delete;
+        AssetMap(AssetMap&&) = delete;
+
+        AssetMap& operator=(const AssetMap&) = delete;
+        AssetMap& operator=(AssetMap&&) = delete;
+
+        //Assets nothing references are kept until the residency manager evicts them, instead of being released right away.
+        //Assets accounted at zero bytes, like materials, are still released right away.
+        //Must be set before the first asset is created.
+        void SetResidency(ResidencyManager* manager, ResidencyClass cls)
+        {
+            residency = manager;
+            residencyClass = cls;
+        }
+
         template<class AssetType = Asset, class... Args>
         shared_ptr<AssetType> FindOrCreateShared(fs::path path, Args&&... args)
         {
-            auto it = assetList.end();
-            bool load = false;
-            {
-                path = absolute(path);
-                auto l = lock_guard(mut);
-                it = rn::find_if(assetList, [=](auto& t) { return *t.PathPtr == path; });
-                load = it == assetList.end();
-                if (load)
-                {
-                    auto namePtr = AddUniqueName(path);
-                    auto pathPtr = AddPath(move(path));
-                    it = assetList.insert(it, AssetItem{ nullptr, namePtr, pathPtr, {  }, -1 });
-                    pathMap.emplace(pathPtr, &*it);
-                    nameMap.emplace(*namePtr, &*it);
-                }
-            }
-            if (load)
+            path = absolute(path);
+            auto& shard = ShardOf(path);
+            for (;;)
             {
-                auto ptr = make_shared<AssetType>(forward<Args>(args)...);
-                ptr->Engine->SubmitSyncronized([&, ptr, it]
+                AssetItem* item = nullptr;
+                std::promise<void> promise;
+                std::shared_future<void> ready;
                 {
-                    auto l = lock_guard(mut);
-                    auto vIt = rn::find(assets, nullptr);
-                    if (vIt != assets.end())
+                    auto l = lock_guard(shard.Mutex);
+                    if (auto it = shard.Items.find(path); it != shard.Items.end())
                     {
-                        it->Index = i32(vIt - assets.begin());
-                        assets[it->Index] = ptr.get();
+                        item = it->second.get();
+                        ready = item->Ready;
                     }
                     else
                     {
-                        it->Index = i32(assets.size());
-                        assets.emplace_back(ptr.get());
+                        auto [iIt, added] = shard.Items.emplace(path, make_unique<AssetItem>(nullptr, nullptr, nullptr, nullptr, weak_ptr<Asset>(), 0, AssetHandle<Asset>(), false, false, promise.get_future().share(), 0, 0));
+                        item = iIt->second.get();
+                        item->PathPtr = &iIt->first;
                     }
-                    assetMap.emplace(ptr.get(), &*it);
-                    it->Shared = ptr;
-                    it->Ptr = ptr.get();
-                });
-                return ptr;
+                }
+                if (!ready.valid())
+                    return Create<AssetType>(shard, item, move(promise), forward<Args>(args)...);
+                ready.get();
+                {
+                    //Under the lock, so Update can't release the asset while it's being taken.
+                    auto l = lock_guard(shard.Mutex);
+                    if (auto it = shard.Items.find(path); it != shard.Items.end() && it->second->Shared)
+                        return CastTo<AssetType>(LeaseUnlocked(it->second.get()));
+                }
+                //Released between being loaded and asked for, or being loaded again.
             }
-            while (!it->Ptr)
-                std::this_thread::sleep_for(1ns);
-            if constexpr (std::is_same_v<AssetType, Asset>)
-                return it->Shared;
-            else return std::static_pointer_cast<AssetType>(it->Shared);
         }
 
         const fs::path& PathOf(Asset* asset) const
         {
-            auto l = lock_guard(mut);
-            auto it = assetMap.find(asset);
-            return it != assetMap.end() ? *it->second->PathPtr : emptyPath;
+            auto item = ItemOf(asset);
+            return item ? *item->PathPtr : emptyPath;
         }
 
         string_view NameOf(Asset* asset) const
         {
-            auto l = lock_guard(mut);
-            auto it = assetMap.find(asset);
-            return it != assetMap.end() ? *it->second->NamePtr : string_view();
+            auto item = ItemOf(asset);
+            return item ? *item->NamePtr : string_view();
         }
 
         shared_ptr<Asset> SharedOf(Asset* asset) const
         {
+            auto& shard = ShardOf(asset);
+            auto l = lock_guard(shard.Mutex);
+            auto it = shard.Assets.find(asset);
+            return it != shard.Assets.end() ? Lease(it->second) : nullptr;
+        }
+
+        //Null once the asset of the handle was released.
+        shared_ptr<Asset> SharedOf(AssetHandle<Asset> handle) const
+        {
+            //Held throughout, so the slot can't be freed while its item is looked at.
             auto l = lock_guard(mut);
-            auto it = assetMap.find(asset);
-            return it != assetMap.end() ? it->second->Shared : nullptr;
+            if (handle.Index >= slots.size() || slots[handle.Index].Generation != handle.Generation)
+                return nullptr;
+            return Lease(slots[handle.Index].Item);
+        }
+
+        AssetHandle<Asset> HandleOf(Asset* asset) const
+        {
+            auto item = ItemOf(asset);
+            return item ? item->Handle : AssetHandle<Asset>();
         }
 
         i32 IndexOf(Asset* asset) const
         {
-            auto l = lock_guard(mut);
-            auto it = assetMap.find(asset);
-            return it != assetMap.end() ? it->second->Index : -1;
+            auto item = ItemOf(asset);
+            return item ? i32(item->Handle.Index) : -1;
         }
 
+        //Releases the assets whose last pointer went, or hands them to the residency manager, from the thread SubmitSyncronized runs on.
+        //Work is bounded by ReleaseBatchSize, whatever is left waits for the next call.
         void Update()
         {
-            auto l = lock_guard(mut);
-            vector<Asset*> toRemove;
-            for (auto& item : assetList) if (item.Shared.use_count() == 1)
-                toRemove.emplace_back(item.Ptr);
-            for (auto asset : toRemove)
-                UnRegisterUnlocked(asset);
+            vector<pair<AssetHandle<Asset>, u32>> batch;
+            {
+                auto& queue = *releaseQueue;
+                auto l = lock_guard(queue.Mutex);
+                auto count = std::min(queue.Events.size(), ReleaseBatchSize);
+                batch.assign(queue.Events.begin(), queue.Events.begin() + count);
+                queue.Events.erase(queue.Events.begin(), queue.Events.begin() + count);
+            }
+            for (auto& [handle, lease] : batch)
+            {
+                if (!residency)
+                {
+                    Release(handle, lease);
+                    continue;
+                }
+                AssetItem* item;
+                {
+                    auto l = lock_guard(mut);
+                    if (slots[handle.Index].Generation != handle.Generation)
+                        continue;
+                    item = slots[handle.Index].Item;
+                }
+                {
+                    auto& shard = ShardOf(*item->PathPtr);
+                    auto l = lock_guard(shard.Mutex);
+                    if (item->Lease != lease || !item->External.expired() || item->Ticket)
+                        continue;
+                    //Evicted with the lease it was retained with, leasing it again makes the eviction a no-op.
+                    if (item->Size)
+                    {
+                        item->Ticket = residency->Retain(residencyClass, item->Size, [this, handle, lease] { Release(handle, lease); });
+                        continue;
+                    }
+                }
+                //Nothing accounted never goes over budget, retained it would never be evicted and keep what it references loaded.
+                Release(handle, lease);
+            }
         }
 
         KAEY_ENGINE_GETTER(cspan<Asset*>, Assets) { return assets; }
 
     private:
-        list<AssetItem> assetList;
+        struct Shard
+        {
+            mutable mutex Mutex;
+            unordered_map<fs::path, unique_ptr<AssetItem>> Items; //By path, the owner of the items.
+            unordered_map<Asset*, AssetItem*> Assets;             //By asset, once registered.
+        };
+
+        struct Slot
+        {
+            AssetItem* Item;
+            u32 Generation;
+        };
 
-        vector<Asset*> assets;
+        //Outlives the map while pointers it handed out are around.
+        struct ReleaseQueue
+        {
+            mutex Mutex;
+            vector<pair<AssetHandle<Asset>, u32>> Events;
+        };
 
+        array<Shard, ShardCount> pathShards;
+        array<Shard, ShardCount> assetShards;
+
+        vector<Slot> slots;
+        vector<u32> freeSlots;
+        vector<Asset*> assets; //Same indices as the slots, null until registered. Only changed on the thread SubmitSyncronized runs on, which reads it unlocked.
         unordered_set<string> names;
-        unordered_set<fs::path> paths;
 
-        unordered_map<string_view, const AssetItem*> nameMap;
-        unordered_map<const fs::path*, const AssetItem*> pathMap;
-        unordered_map<Asset*, const AssetItem*> assetMap;
+        shared_ptr<ReleaseQueue> releaseQueue = make_shared<ReleaseQueue>();
 
         fs::path emptyPath;
 
-        mutable mutex mut;
+        mutable mutex mut; //Guards slots and names.
+
+        ResidencyManager* residency = nullptr;
+        ResidencyClass residencyClass = ResidencyClass::Count;
+
+        Shard& ShardOf(const fs::path& path) { return pathShards[hash_value(path) % ShardCount]; }
+        const Shard& ShardOf(const fs::path& path) const { return pathShards[hash_value(path) % ShardCount]; }
+        Shard& ShardOf(Asset* asset) { return assetShards[std::hash<Asset*>()(asset) % ShardCount]; }
+        const Shard& ShardOf(Asset* asset) const { return assetShards[std::hash<Asset*>()(asset) % ShardCount]; }
 
-        void UnRegisterUnlocked(Asset* asset)
+        const AssetItem* ItemOf(Asset* asset) const
         {
-            auto it = assetMap.find(asset);
-            assert(it != assetMap.end());
-            auto& [ptr, namePtr, pathPtr, shared, index] = *it->second;
-            assets[index] = nullptr;
-            nameMap.erase(*namePtr);
-            pathMap.erase(pathPtr);
-            names.erase(*namePtr);
-            paths.erase(*pathPtr);
-            assetList.erase(rn::find_if(assetList, [=](auto& item) { return item.Ptr == asset; }));
+            auto& shard = ShardOf(asset);
+            auto l = lock_guard(shard.Mutex);
+            auto it = shard.Assets.find(asset);
+            return it != shard.Assets.end() ? it->second : nullptr;
+        }
+
+        template<class AssetType>
+        static shared_ptr<AssetType> CastTo(shared_ptr<Asset> ptr)
+        {
+            if constexpr (std::is_same_v<AssetType, Asset>)
+                return ptr;
+            else return std::static_pointer_cast<AssetType>(move(ptr));
+        }
+
+        shared_ptr<Asset> Lease(AssetItem* item) const
+        {
+            auto& shard = ShardOf(*item->PathPtr);
+            auto l = lock_guard(shard.Mutex);
+            return item->Released ? nullptr : LeaseUnlocked(item);
+        }
+
+        //The path shard of the item must be locked.
+        shared_ptr<Asset> LeaseUnlocked(AssetItem* item) const
+        {
+            if (auto ptr = item->External.lock())
+                return ptr;
+            if (item->Ticket)
+            {
+                residency->Reclaim(item->Ticket);
+                item->Ticket = 0;
+            }
+            auto lease = ++item->Lease;
+            auto ptr = shared_ptr<Asset>(item->Shared.get(), [queue = releaseQueue, owner = item->Shared, handle = item->Handle, lease](Asset*)
+            {
+                auto l = lock_guard(queue->Mutex);
+                queue->Events.emplace_back(handle, lease);
+            });
+            item->External = ptr;
+            return ptr;
+        }
+
+        //From Update or an eviction, both on the thread SubmitSyncronized runs on.
+        void Release(AssetHandle<Asset> handle, u32 lease)
+        {
+            AssetItem* item;
+            {
+                auto l = lock_guard(mut);
+                if (slots[handle.Index].Generation != handle.Generation)
+                    return;
+                item = slots[handle.Index].Item;
+            }
+            unique_ptr<AssetItem> removed;
+            {
+                auto& shard = ShardOf(*item->PathPtr);
+                auto l = lock_guard(shard.Mutex);
+                //Taken again since the event was queued, it's the next lease's to release.
+                if (item->Lease != lease || !item->External.expired())
+                    return;
+                item->Released = true;
+                item->Ticket = 0;
+                auto it = shard.Items.find(*item->PathPtr);
+                removed = move(it->second);
+                shard.Items.erase(it);
+            }
+            if (removed->Registered)
+            {
+                assets[removed->Handle.Index] = nullptr;
+                auto& shard = ShardOf(removed->Ptr);
+                auto l = lock_guard(shard.Mutex);
+                shard.Assets.erase(removed->Ptr);
+            }
+            {
+                auto l = lock_guard(mut);
+                FreeSlotUnlocked(removed->Handle);
+                names.erase(*removed->NamePtr);
+            }
+            if (residency)
+                residency->Remove(residencyClass, removed->Size);
+        }
+
+        AssetHandle<Asset> AllocateSlotUnlocked(AssetItem* item)
+        {
+            if (freeSlots.empty())
+            {
+                slots.emplace_back(item, 0);
+                return { u32(slots.size() - 1), 0 };
+            }
+            auto index = freeSlots.back();
+            freeSlots.pop_back();
+            slots[index].Item = item;
+            return { index, slots[index].Generation };
+        }
+
+        void FreeSlotUnlocked(AssetHandle<Asset> handle)
+        {
+            auto& slot = slots[handle.Index];
+            slot.Item = nullptr;
+            ++slot.Generation;
+            freeSlots.emplace_back(handle.Index);
+        }
+
+        template<class AssetType, class... Args>
+        shared_ptr<AssetType> Create(Shard& shard, AssetItem* item, std::promise<void> promise, Args&&... args)
+        {
+            {
+                auto l = lock_guard(mut);
+                item->NamePtr = AddUniqueName(*item->PathPtr);
+                item->Handle = AllocateSlotUnlocked(item);
+            }
+            shared_ptr<Asset> ptr;
+            try
+            {
+                auto shared = make_shared<AssetType>(forward<Args>(args)...);
+                auto size = ResidentSizeOf(static_cast<const Asset&>(*shared));
+                if (residency)
+                    residency->Add(residencyClass, size);
+                auto l = lock_guard(shard.Mutex);
+                item->Size = size;
+                item->Ptr = shared.get();
+                item->Shared = move(shared);
+                ptr = LeaseUnlocked(item);
+            }
+            catch (...)
+            {
+                //Dropped so the next request tries again, the ones waiting get the exception.
+                promise.set_exception(std::current_exception());
+                {
+                    auto l = lock_guard(mut);
+                    FreeSlotUnlocked(item->Handle);
+                    names.erase(*item->NamePtr);
+                }
+                auto path = *item->PathPtr;
+                auto l = lock_guard(shard.Mutex);
+                shard.Items.erase(path);
+                throw;
+            }
+            promise.set_value();
+            ptr->Engine->SubmitSyncronized([this, asset = item->Ptr, handle = item->Handle]
+            {
+                AssetItem* item;
+                {
+                    auto l = lock_guard(mut);
+                    //Released before it got here.
+                    if (slots[handle.Index].Generation != handle.Generation)
+                        return;
+                    item = slots[handle.Index].Item;
+                }
+                //Grown here rather than with the slots, loader threads allocate those while this thread reads Assets.
+                if (handle.Index >= assets.size())
+                    assets.resize(handle.Index + 1);
+                assets[handle.Index] = asset;
+                auto& shard = ShardOf(asset);
+                auto l = lock_guard(shard.Mutex);
+                shard.Assets.emplace(asset, item);
+                item->Registered = true;
+            });
+            return CastTo<AssetType>(move(ptr));
         }
 
         const string* AddUniqueName(string name)
@@ -157,11 +411,6 @@ namespace Kaey::Engine
             return AddUniqueName(path.stem().string());
         }
 
-        const fs::path* AddPath(fs::path path = {})
-        {
-            return &*paths.emplace(move(path)).first;
-        }
-
     };
 
-}
\ No newline at end of file
+}
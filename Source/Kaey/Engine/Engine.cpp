@@ -86,21 +86,10 @@ namespace Engine
 
     void KaeyEngine::Update()
     {
-        decltype(syncFns) fns;
-        {
-            auto l = lock_guard(syncMutex);
-            fns = move(syncFns);
-        }
+        auto tasks = syncQueue.Take();
         glfwPollEvents();
         time->Update();
-        for (auto& fn : fns)
-            fn();
-    }
-
-    void KaeyEngine::SubmitSyncronized(function<void()> fn)
-    {
-        auto l = lock_guard(syncMutex);
-        syncFns.emplace_back(move(fn));
+        syncQueue.Run(move(tasks));
     }
 
     RenderEngine::RenderEngine(KaeyEngine* engine, bool debugEnabled) :
@@ -410,6 +399,10 @@ namespace Engine
     RenderDevice::RenderDevice(Engine::RenderEngine* renderEngine, vk::PhysicalDevice physicalDevice) :
         renderEngine(renderEngine),
         physicalDevice(physicalDevice),
+        memoryBudgetSupported(rn::any_of(physicalDevice.enumerateDeviceExtensionProperties(), [](const vk::ExtensionProperties& ext)
+        {
+            return string_view(ext.extensionName) == VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+        })),
         device([&]
         {
             auto familyProperties = physicalDevice.getQueueFamilyProperties();
@@ -427,6 +420,8 @@ namespace Engine
                 VK_KHR_SWAPCHAIN_EXTENSION_NAME,
                 VK_KHR_UNIFORM_BUFFER_STANDARD_LAYOUT_EXTENSION_NAME,
             };
+            if (memoryBudgetSupported)
+                extensions.emplace_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
             return physicalDevice.createDeviceUnique({
                 {},
                 queueInfos,
@@ -607,11 +602,48 @@ namespace Engine
         attributeMap.erase(index);
     }
 
+    MemoryBudget RenderDevice::QueryMemoryBudget() const
+    {
+        vk::PhysicalDeviceMemoryBudgetPropertiesEXT heapBudgets;
+        vk::PhysicalDeviceMemoryProperties2 props2;
+        if (memoryBudgetSupported)
+        {
+            //Through the instance extension, the instance is created for Vulkan 1.0.
+            auto ptr = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(RenderEngine->Instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+            assert(ptr);
+            props2.pNext = &heapBudgets;
+            ptr(physicalDevice, (VkPhysicalDeviceMemoryProperties2*)&props2);
+        }
+        else props2.memoryProperties = physicalDevice.getMemoryProperties();
+        auto& props = props2.memoryProperties;
+        MemoryBudget result{};
+        for (u32 i = 0; i < props.memoryHeapCount; ++i)
+        {
+            auto budget = memoryBudgetSupported ? heapBudgets.heapBudget[i] : props.memoryHeaps[i].size;
+            auto usage = memoryBudgetSupported ? heapBudgets.heapUsage[i] : 0;
+            if (props.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+            {
+                result.Budget += budget;
+                result.Usage += usage;
+            }
+        }
+        return result;
+    }
+
     Project::Project(Engine::RenderDevice* renderDevice, fs::path rootPath) :
         renderDevice(renderDevice),
         rootPath(move(rootPath))
     {
         fs::current_path(RootPath);
+        if (auto packPath = fs::current_path() / PackFileName; exists(packPath))
+            packFile = make_unique<Engine::PackFile>(packPath);
+        u64 deviceBudgetMB = 0; //Zero takes it from the device.
+        if (auto& config = Engine->Config; config.is_object())
+            deviceBudgetMB = config.value("DeviceBudgetMB", deviceBudgetMB);
+        residencyManager = make_unique<Engine::ResidencyManager>(renderDevice, deviceBudgetMB << 20);
+        meshMap.SetResidency(residencyManager.get(), ResidencyClass::Mesh);
+        materialMap.SetResidency(residencyManager.get(), ResidencyClass::Material);
+        textureMap.SetResidency(residencyManager.get(), ResidencyClass::Texture);
     }
 
     void Project::Update()
@@ -619,6 +651,68 @@ namespace Engine
         meshMap.Update();
         materialMap.Update();
         textureMap.Update();
+        residencyManager->Update();
+    }
+
+    FileBytes Project::ReadFile(const fs::path& path) const
+    {
+        if (auto bytes = FindPacked(path))
+            return FileBytes(*bytes);
+        return ReadFileBytes(path);
+    }
+
+    bool Project::FileExists(const fs::path& path) const
+    {
+        return FindPacked(path) || exists(path);
+    }
+
+    optional<cspan<u8>> Project::FindPacked(const fs::path& path) const
+    {
+        if (!packFile)
+            return nullopt;
+        //Lexical only, so looking a file up costs no system call.
+        return packFile->Find(path.is_absolute() ? path.lexically_relative(packFile->Path.parent_path()) : path);
+    }
+
+    void Project::Pack(const fs::path& output) const
+    {
+        WritePackFile(output, fs::current_path());
+    }
+
+    shared_ptr<const json> Project::FindOrLoadPrefab(const fs::path& path)
+    {
+        auto key = absolute(path);
+        //Packed files can't change, so they aren't checked for a newer write time.
+        auto packed = FindPacked(key);
+        fs::file_time_type writeTime;
+        if (!packed)
+        {
+            std::error_code ec;
+            writeTime = fs::last_write_time(key, ec);
+            if (ec)
+                throw runtime_error("Failed to open file: {}"_f(path.string()));
+        }
+        {
+            auto l = lock_guard(prefabMutex);
+            if (auto it = prefabMap.find(key); it != prefabMap.end() && it->second.first == writeTime)
+                return it->second.second;
+        }
+        auto j = make_shared<json>();
+        if (packed)
+            *j = json::parse(packed->begin(), packed->end());
+        else
+        {
+            ifstream f(key);
+            if (!f.is_open())
+                throw runtime_error("Failed to open file: {}"_f(path.string()));
+            f >> *j;
+        }
+        auto l = lock_guard(prefabMutex);
+        auto& entry = prefabMap[move(key)];
+        if (entry.second && entry.first == writeTime) //Another instance parsed it meanwhile.
+            return entry.second;
+        entry = { writeTime, move(j) };
+        return entry.second;
     }
 
 }
@@ -1,5 +1,8 @@
 #pragma once
 #include "Utils.hpp"
+#include "PackFile.hpp"
+#include "ResidencyManager.hpp"
+#include "SyncQueue.hpp"
 
 namespace Kaey::Engine
 {
@@ -17,7 +20,12 @@ namespace Kaey::Engine
 
         void Update();
 
-        void SubmitSyncronized(function<void()> fn);
+        //Runs on the main thread at the start of the next Update, from any thread without taking a lock.
+        template<class Fn> requires std::invocable<std::decay_t<Fn>&>
+        void SubmitSyncronized(Fn&& fn) { syncQueue.Push(forward<Fn>(fn)); }
+        //Tasks added to a batch go in at once, for loaders publishing many results.
+        SyncQueue::Batch CreateSyncBatch() { return SyncQueue::Batch(&syncQueue); }
+        void SubmitSyncronized(SyncQueue::Batch batch) { syncQueue.Push(move(batch)); }
 
         KAEY_ENGINE_GETTER(Engine::ThreadPool*, ThreadPool) { return threadPool.get(); }
         KAEY_ENGINE_GETTER(Engine::RenderEngine*, RenderEngine) { return renderEngine.get(); }
@@ -35,8 +43,7 @@ namespace Kaey::Engine
         fs::path configPath;
         fs::path projectsPath;
         fs::path shaderPath;
-        mutex syncMutex;
-        vector<function<void()>> syncFns;
+        SyncQueue syncQueue;
     };
 
     struct RenderEngine
@@ -243,6 +250,13 @@ namespace Kaey::Engine
         vk::UniqueFence fence;
     };
 
+    //Bytes of the device local heaps.
+    struct MemoryBudget
+    {
+        u64 Budget;
+        u64 Usage;
+    };
+
     struct RenderDevice
     {
         RenderDevice(RenderEngine* renderEngine, vk::PhysicalDevice physicalDevice);
@@ -272,12 +286,16 @@ namespace Kaey::Engine
         u32 AllocateAttribute(u32 count);
         void DeallocateAttribute(u32 index);
 
+        //What every process may use and uses with VK_EXT_memory_budget, only the heap sizes without it.
+        MemoryBudget QueryMemoryBudget() const;
+
         KAEY_ENGINE_GETTER(KaeyEngine*, Engine) { return renderEngine->Engine; }
         KAEY_ENGINE_GETTER(Engine::RenderEngine*, RenderEngine) { return renderEngine; }
         KAEY_ENGINE_GETTER(Engine::ThreadPool*, ThreadPool) { return Engine->ThreadPool; }
         KAEY_ENGINE_GETTER(Engine::Time*, Time) { return Engine->Time; }
 
         KAEY_ENGINE_GETTER(vk::PhysicalDevice, PhysicalDevice) { return physicalDevice; }
+        KAEY_ENGINE_GETTER(bool, MemoryBudgetSupported) { return memoryBudgetSupported; }
         KAEY_ENGINE_GETTER(vk::Device, Instance) { return device.get(); }
         KAEY_ENGINE_GETTER(vk::DescriptorPool, DescriptorPool) { return descriptorPool.get(); }
         KAEY_ENGINE_GETTER(vk::RenderPass, RenderPass) { return renderPass.get(); }
@@ -298,6 +316,7 @@ namespace Kaey::Engine
     private:
         Engine::RenderEngine* renderEngine;
         vk::PhysicalDevice physicalDevice;
+        bool memoryBudgetSupported;
         vk::UniqueDevice device;
         vk::UniqueDescriptorPool descriptorPool;
 
@@ -344,6 +363,18 @@ namespace Kaey::Engine
 
         void Update();
 
+        //From the project's pack when it has the file, from disk otherwise. Relative paths are relative to the root.
+        FileBytes ReadFile(const fs::path& path) const;
+        bool FileExists(const fs::path& path) const;
+        //Bytes of a file in the pack, they stay valid for as long as the project does.
+        optional<cspan<u8>> FindPacked(const fs::path& path) const;
+
+        //Writes every file under the root into a pack, shipped as PackFileName next to the project's files.
+        void Pack(const fs::path& output) const;
+
+        //Parsed once and shared by every instance, the file is parsed again only when its write time changes.
+        shared_ptr<const json> FindOrLoadPrefab(const fs::path& path);
+
         KAEY_ENGINE_ASSET_MAP(Texture, textureMap);
         KAEY_ENGINE_ASSET_MAP(Material, materialMap);
         KAEY_ENGINE_ASSET_MAP(MeshData, meshMap);
@@ -353,6 +384,8 @@ namespace Kaey::Engine
         KAEY_ENGINE_GETTER(Engine::RenderEngine*, RenderEngine) { return RenderDevice->RenderEngine; }
         KAEY_ENGINE_GETTER(Engine::ThreadPool*, ThreadPool) { return Engine->ThreadPool; }
         KAEY_ENGINE_GETTER(Engine::Time*, Time) { return Engine->Time; }
+        KAEY_ENGINE_GETTER(Engine::PackFile*, PackFile) { return packFile.get(); }
+        KAEY_ENGINE_GETTER(Engine::ResidencyManager*, ResidencyManager) { return residencyManager.get(); }
 
         KAEY_ENGINE_GETTER(const fs::path&, RootPath) { return rootPath; }
 
@@ -363,10 +396,15 @@ namespace Kaey::Engine
     private:
         Engine::RenderDevice* renderDevice;
         fs::path rootPath;
+        unique_ptr<Engine::PackFile> packFile;
+        unique_ptr<Engine::ResidencyManager> residencyManager; //Before the maps, their retained assets hold evictions into them.
 
         AssetMap<MeshData> meshMap;
         AssetMap<Material> materialMap;
         AssetMap<Texture> textureMap;
+
+        unordered_map<fs::path, pair<fs::file_time_type, shared_ptr<const json>>> prefabMap;
+        mutex prefabMutex;
     };
 
 }
@@ -0,0 +1,229 @@
+#include "PackFile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Kaey::Engine
+{
+    namespace
+    {
+        constexpr u32 PackFileMagic = 'K' << 0u | 'P' << 8u | 'K' << 16u | '\0' << 24u;
+        constexpr u32 PackFileVersion = 1;
+
+        constexpr string_view PackExtension = ".kpak";
+        constexpr string_view KeyExtension = ".key"; //Left next to cooked files by Cook.
+
+        //Followed by the entries' data, then the index at IndexOffset and the paths at NamesOffset.
+        struct PackHeader
+        {
+            u32 Magic;
+            u32 Version;
+            u64 EntryCount;
+            u64 IndexOffset;
+            u64 NamesOffset;
+            u64 NamesSize;
+        };
+
+        u64 AlignUp(u64 value, u64 alignment)
+        {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+    }
+
+    FileBytes ReadFileBytes(const fs::path& path)
+    {
+        ifstream f(path, std::ios::binary | std::ios::ate);
+        if (!f.is_open())
+            throw runtime_error("Failed to open file: {}"_f(path.string()));
+        vector<u8> storage(f.tellg());
+        f.seekg(0);
+        f.read((char*)storage.data(), (streamsize)storage.size());
+        return FileBytes(move(storage));
+    }
+
+    MappedFile::MappedFile(const fs::path& path)
+    {
+#ifdef _WIN32
+        auto file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            throw std::system_error((int)GetLastError(), std::system_category(), path.string());
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize))
+        {
+            auto err = (int)GetLastError();
+            CloseHandle(file);
+            throw std::system_error(err, std::system_category(), path.string());
+        }
+        size = (size_t)fileSize.QuadPart;
+        if (size > 0)
+        {
+            auto mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping)
+            {
+                data = (const u8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping); //The view keeps the mapping alive.
+            }
+        }
+        auto err = (int)GetLastError();
+        CloseHandle(file);
+        if (size > 0 && !data)
+            throw std::system_error(err, std::system_category(), path.string());
+#else
+        auto fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+            throw std::system_error(errno, std::generic_category(), path.string());
+        struct stat st;
+        if (fstat(fd, &st) == -1)
+        {
+            auto err = errno;
+            close(fd);
+            throw std::system_error(err, std::generic_category(), path.string());
+        }
+        size = (size_t)st.st_size;
+        if (size > 0)
+        {
+            auto ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr == MAP_FAILED)
+            {
+                auto err = errno;
+                close(fd);
+                throw std::system_error(err, std::generic_category(), path.string());
+            }
+            data = (const u8*)ptr;
+        }
+        close(fd); //The mapping keeps the file alive.
+#endif
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (!data)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap((void*)data, size);
+#endif
+    }
+
+    PackFile::PackFile(const fs::path& path) : path(path), file(path)
+    {
+        auto data = file.Bytes.data();
+        auto size = file.Bytes.size();
+        PackHeader header;
+        if (size < sizeof header)
+            throw runtime_error("Invalid pack file '{}'"_f(path.string()));
+        memcpy(&header, data, sizeof header);
+        if (header.Magic != PackFileMagic)
+            throw runtime_error("Invalid pack file '{}'"_f(path.string()));
+        if (header.Version != PackFileVersion)
+            throw runtime_error("Unsupported pack file version {} in '{}'"_f(header.Version, path.string()));
+        if (header.IndexOffset % alignof(Entry) != 0 ||
+            header.IndexOffset > size || header.EntryCount > (size - header.IndexOffset) / sizeof(Entry) ||
+            header.NamesOffset > size || header.NamesSize > size - header.NamesOffset)
+            throw runtime_error("Invalid pack file '{}'"_f(path.string()));
+        entries = { (const Entry*)(data + header.IndexOffset), (size_t)header.EntryCount };
+        names = { (const char*)data + header.NamesOffset, (size_t)header.NamesSize };
+        for (auto& e : entries)
+            if (e.Offset > size || e.Size > size - e.Offset || (u64)e.NameOffset + e.NameSize > names.size())
+                throw runtime_error("Invalid pack file '{}'"_f(path.string()));
+    }
+
+    optional<cspan<u8>> PackFile::Find(const fs::path& path) const
+    {
+        auto key = KeyOf(path);
+        auto hash = HashOf(key);
+        auto it = rn::lower_bound(entries, hash, {}, &Entry::Hash);
+        for (; it != entries.end() && it->Hash == hash; ++it)
+            if (names.substr(it->NameOffset, it->NameSize) == key)
+                return file.Bytes.subspan(it->Offset, it->Size);
+        return nullopt;
+    }
+
+    string PackFile::KeyOf(const fs::path& path)
+    {
+        return path.lexically_normal().generic_string();
+    }
+
+    //FNV-1a, stable across runs and platforms unlike std::hash.
+    u64 PackFile::HashOf(string_view key)
+    {
+        u64 hash = 0xcbf29ce484222325;
+        for (auto c : key)
+            hash = (hash ^ (u8)c) * 0x100000001b3;
+        return hash;
+    }
+
+    void WritePackFile(const fs::path& output, const fs::path& root, const function<bool(const fs::path&)>& filter)
+    {
+        struct Item
+        {
+            fs::path Path;
+            string Key;
+            u64 Hash;
+        };
+        vector<Item> items;
+        auto outputPath = weakly_canonical(output);
+        for (auto& entry : fs::recursive_directory_iterator(root))
+        {
+            if (!entry.is_regular_file() || weakly_canonical(entry.path()) == outputPath)
+                continue;
+            if (filter ? !filter(entry.path()) : entry.path().extension() == PackExtension || entry.path().extension() == KeyExtension)
+                continue;
+            auto key = PackFile::KeyOf(entry.path().lexically_relative(root));
+            auto hash = PackFile::HashOf(key);
+            items.emplace_back(entry.path(), move(key), hash);
+        }
+        rn::sort(items, [](const Item& a, const Item& b) { return tie(a.Hash, a.Key) < tie(b.Hash, b.Key); });
+
+        //Written next to the output and moved over it once complete, so a running game never maps half a pack.
+        auto tempPath = fs::path(output).concat(".tmp");
+        {
+            auto f = ofstream(tempPath, std::ios::out | std::ios::binary);
+            if (!f.is_open())
+                throw runtime_error("Failed to save file '{}'"_f(tempPath.string()));
+            auto pad = [&](u64 alignment)
+            {
+                static constexpr char Zeros[PackFile::PackAlignment]{};
+                auto pos = (u64)f.tellp();
+                f.write(Zeros, (streamsize)(AlignUp(pos, alignment) - pos));
+            };
+
+            PackHeader header{ PackFileMagic, PackFileVersion, items.size() };
+            f.write((const char*)&header, sizeof header);
+
+            vector<PackFile::Entry> index;
+            index.reserve(items.size());
+            string names;
+            for (auto& item : items)
+            {
+                auto bytes = ReadFileBytes(item.Path);
+                pad(PackFile::PackAlignment);
+                index.emplace_back(item.Hash, (u64)f.tellp(), (u64)bytes.Bytes.size(), (u32)names.size(), (u32)item.Key.size());
+                f.write((const char*)bytes.Bytes.data(), (streamsize)bytes.Bytes.size());
+                names += item.Key;
+            }
+
+            pad(alignof(PackFile::Entry));
+            header.IndexOffset = (u64)f.tellp();
+            f.write((const char*)index.data(), (streamsize)(index.size() * sizeof(PackFile::Entry)));
+            header.NamesOffset = (u64)f.tellp();
+            header.NamesSize = names.size();
+            f.write(names.data(), (streamsize)names.size());
+
+            f.seekp(0);
+            f.write((const char*)&header, sizeof header);
+            if (!f)
+                throw runtime_error("Failed to save file '{}'"_f(tempPath.string()));
+        }
+        fs::rename(tempPath, output);
+    }
+
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include "Utils.hpp"
+
+namespace Kaey::Engine
+{
+    //Archive the project is read from when it sits next to the project's files.
+    constexpr string_view PackFileName = "Assets.kpak";
+
+    //Bytes of a file, viewed in a pack or read from disk and owned.
+    struct FileBytes
+    {
+        FileBytes() = default;
+        explicit FileBytes(cspan<u8> view) : view(view) {}
+        explicit FileBytes(vector<u8> storage) : storage(move(storage)) {}
+
+        FileBytes(const FileBytes&) = delete;
+        FileBytes(FileBytes&&) noexcept = default;
+
+        FileBytes& operator=(const FileBytes&) = delete;
+        FileBytes& operator=(FileBytes&&) noexcept = default;
+
+        KAEY_ENGINE_GETTER(cspan<u8>, Bytes) { return storage.empty() ? view : cspan<u8>(storage); }
+
+    private:
+        cspan<u8> view;
+        vector<u8> storage;
+    };
+
+    FileBytes ReadFileBytes(const fs::path& path);
+
+    //Whole file mapped read only, unmapped when destroyed.
+    struct MappedFile
+    {
+        explicit MappedFile(const fs::path& path);
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile(MappedFile&&) = delete;
+
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile& operator=(MappedFile&&) = delete;
+
+        ~MappedFile();
+
+        KAEY_ENGINE_GETTER(cspan<u8>, Bytes) { return { data, size }; }
+
+    private:
+        const u8* data = nullptr;
+        size_t size = 0;
+    };
+
+    //Read only archive of files, mapped into memory as a whole.
+    //Entries are found through an index sorted by the hash of their paths, their data is aligned to PackAlignment.
+    struct PackFile
+    {
+        static constexpr u64 PackAlignment = 64;
+
+        explicit PackFile(const fs::path& path);
+
+        PackFile(const PackFile&) = delete;
+        PackFile(PackFile&&) = delete;
+
+        PackFile& operator=(const PackFile&) = delete;
+        PackFile& operator=(PackFile&&) = delete;
+
+        //As stored in the index.
+        struct Entry
+        {
+            u64 Hash;
+            u64 Offset;
+            u64 Size;
+            u32 NameOffset;
+            u32 NameSize;
+        };
+
+        //'path' is relative to the directory the pack was written from.
+        optional<cspan<u8>> Find(const fs::path& path) const;
+        bool Contains(const fs::path& path) const { return Find(path).has_value(); }
+
+        KAEY_ENGINE_GETTER(const fs::path&, Path) { return path; }
+        KAEY_ENGINE_GETTER(size_t, EntryCount) { return entries.size(); }
+
+        //Same form paths are stored with, generic separators and lexically normal.
+        static string KeyOf(const fs::path& path);
+        static u64 HashOf(string_view key);
+
+    private:
+        fs::path path;
+        MappedFile file;
+        cspan<Entry> entries;
+        string_view names;
+    };
+
+    //Packs every regular file under 'root' for which 'filter' returns true, keyed by their path relative to it.
+    //Without a filter other packs and cook keys are left out.
+    void WritePackFile(const fs::path& output, const fs::path& root, const function<bool(const fs::path&)>& filter = nullptr);
+
+}
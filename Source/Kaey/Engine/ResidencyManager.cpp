@@ -0,0 +1,185 @@
+#include "ResidencyManager.hpp"
+#include "All.hpp"
+
+namespace Kaey::Engine
+{
+    namespace
+    {
+        //Bytes of a 4x4 block for the block compressed formats, zero for the others.
+        u32 BlockBytesOf(vk::Format format)
+        {
+            switch (format)
+            {
+            case vk::Format::eBc1RgbUnormBlock:
+            case vk::Format::eBc1RgbSrgbBlock:
+            case vk::Format::eBc1RgbaUnormBlock:
+            case vk::Format::eBc1RgbaSrgbBlock:
+            case vk::Format::eBc4UnormBlock:
+            case vk::Format::eBc4SnormBlock:
+                return 8;
+            case vk::Format::eBc2UnormBlock:
+            case vk::Format::eBc2SrgbBlock:
+            case vk::Format::eBc3UnormBlock:
+            case vk::Format::eBc3SrgbBlock:
+            case vk::Format::eBc5UnormBlock:
+            case vk::Format::eBc5SnormBlock:
+            case vk::Format::eBc6HUfloatBlock:
+            case vk::Format::eBc6HSfloatBlock:
+            case vk::Format::eBc7UnormBlock:
+            case vk::Format::eBc7SrgbBlock:
+                return 16;
+            default:
+                return 0;
+            }
+        }
+
+        u32 TexelBytesOf(vk::Format format)
+        {
+            switch (format)
+            {
+            case vk::Format::eR8Unorm:
+            case vk::Format::eR8Srgb:
+                return 1;
+            case vk::Format::eR8G8Unorm:
+            case vk::Format::eR16Sfloat:
+                return 2;
+            case vk::Format::eR16G16B16A16Sfloat:
+            case vk::Format::eR32G32Sfloat:
+                return 8;
+            case vk::Format::eR32G32B32A32Sfloat:
+                return 16;
+            default:
+                return 4;
+            }
+        }
+    }
+
+    u64 ResidentSizeOf(const Texture& texture)
+    {
+        auto& [w, h] = texture.Extent;
+        auto blockBytes = BlockBytesOf(texture.Format);
+        u64 result = 0;
+        for (u32 level = 0; level < std::max<u32>((u32)texture.Mipchain.size(), 1); ++level)
+        {
+            auto lw = std::max(u64(w) >> level, u64(1));
+            auto lh = std::max(u64(h) >> level, u64(1));
+            result += blockBytes ? (lw + 3) / 4 * ((lh + 3) / 4) * blockBytes : lw * lh * TexelBytesOf(texture.Format);
+        }
+        return result;
+    }
+
+    u64 ResidentSizeOf(const MeshData& meshData)
+    {
+        return meshData.VertexBuffer->Size + meshData.IndexBuffer->Size;
+    }
+
+    ResidencyManager::ResidencyManager(Engine::RenderDevice* renderDevice, u64 budget) :
+        renderDevice(renderDevice),
+        configured(budget)
+    {
+        UpdateBudgetUnlocked();
+    }
+
+    void ResidencyManager::Add(ResidencyClass cls, u64 bytes)
+    {
+        lock_guard l(mut);
+        usage[size_t(cls)] += bytes;
+    }
+
+    void ResidencyManager::Remove(ResidencyClass cls, u64 bytes)
+    {
+        lock_guard l(mut);
+        assert(usage[size_t(cls)] >= bytes);
+        usage[size_t(cls)] -= bytes;
+    }
+
+    u64 ResidencyManager::Retain(ResidencyClass cls, u64 bytes, function<void()> evict)
+    {
+        lock_guard l(mut);
+        auto ticket = nextTicket++;
+        retainedBytes += bytes;
+        tickets.emplace(ticket, lru.insert(lru.end(), Retained{ ticket, cls, bytes, move(evict) }));
+        return ticket;
+    }
+
+    void ResidencyManager::Reclaim(u64 ticket)
+    {
+        lock_guard l(mut);
+        auto it = tickets.find(ticket);
+        if (it == tickets.end())
+            return;
+        retainedBytes -= it->second->Bytes;
+        lru.erase(it->second);
+        tickets.erase(it);
+    }
+
+    void ResidencyManager::Update()
+    {
+        vector<function<void()>> evictions;
+        {
+            lock_guard l(mut);
+            UpdateBudgetUnlocked();
+            //Only what is retained can go, what is referenced stays whatever the budget.
+            auto used = UsageOfUnlocked();
+            while (used > budget && !lru.empty())
+            {
+                auto& r = lru.front();
+                used -= std::min(used, r.Bytes);
+                retainedBytes -= r.Bytes;
+                evictions.emplace_back(move(r.Evict));
+                tickets.erase(r.Ticket);
+                lru.pop_front();
+            }
+        }
+        //Outside the lock, evicting takes the asset maps' locks, which are held while reclaiming.
+        for (auto& evict : evictions)
+            evict();
+    }
+
+    u64 ResidencyManager::GetUsage(ResidencyClass cls) const
+    {
+        lock_guard l(mut);
+        return usage[size_t(cls)];
+    }
+
+    u64 ResidencyManager::GetUsage() const
+    {
+        lock_guard l(mut);
+        return UsageOfUnlocked();
+    }
+
+    u64 ResidencyManager::UsageOfUnlocked() const
+    {
+        return std::accumulate(usage.begin(), usage.end(), u64(0));
+    }
+
+    u64 ResidencyManager::GetRetained() const
+    {
+        lock_guard l(mut);
+        return retainedBytes;
+    }
+
+    u64 ResidencyManager::GetBudget() const
+    {
+        lock_guard l(mut);
+        return budget;
+    }
+
+    void ResidencyManager::SetBudget(u64 value)
+    {
+        lock_guard l(mut);
+        configured = value;
+        UpdateBudgetUnlocked();
+    }
+
+    void ResidencyManager::UpdateBudgetUnlocked()
+    {
+        auto device = renderDevice->QueryMemoryBudget();
+        //With VK_EXT_memory_budget what others use is taken out, without it only a share of the heaps is used.
+        auto available = renderDevice->MemoryBudgetSupported ?
+            device.Budget - std::min(device.Budget, device.Usage - std::min(device.Usage, UsageOfUnlocked())) :
+            device.Budget / 4 * 3;
+        budget = configured ? std::min(configured, available) : available;
+    }
+
+}
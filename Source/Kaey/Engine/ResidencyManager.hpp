@@ -0,0 +1,79 @@
+#pragma once
+#include "Utils.hpp"
+
+namespace Kaey::Engine
+{
+    enum class ResidencyClass : u8
+    {
+        Texture,
+        Mesh,
+        Material,
+        Count,
+    };
+
+    //Bytes an asset keeps resident on the device, from what it holds.
+    u64 ResidentSizeOf(const Texture& texture);
+    u64 ResidentSizeOf(const MeshData& meshData);
+    //Anything else is small next to the textures and meshes it references, and isn't retained.
+    template<class Asset>
+    u64 ResidentSizeOf(const Asset&) { return 0; }
+
+    //Accounts for the device bytes of every loaded asset, and keeps the ones nothing references loaded while they fit.
+    //Once over budget the least recently released are evicted first.
+    struct ResidencyManager
+    {
+        ResidencyManager(Engine::RenderDevice* renderDevice, u64 budget = 0);
+
+        ResidencyManager(const ResidencyManager&) = delete;
+        ResidencyManager(ResidencyManager&&) = delete;
+
+        ResidencyManager& operator=(const ResidencyManager&) = delete;
+        ResidencyManager& operator=(ResidencyManager&&) = delete;
+
+        ~ResidencyManager() = default;
+
+        void Add(ResidencyClass cls, u64 bytes);
+        void Remove(ResidencyClass cls, u64 bytes);
+
+        //Keeps an asset nothing references until it's evicted, returns the ticket that takes it back.
+        //'evict' runs on the thread calling Update.
+        u64 Retain(ResidencyClass cls, u64 bytes, function<void()> evict);
+        //The asset is referenced again, it won't be evicted.
+        void Reclaim(u64 ticket);
+
+        //Refreshes the budgets and evicts until usage fits in them, once per frame.
+        void Update();
+
+        u64 GetUsage(ResidencyClass cls) const;
+        u64 GetUsage() const;
+        u64 GetRetained() const;
+        //What usage is held to, the configured budget or what the device reports as available, whichever is smaller.
+        u64 GetBudget() const;
+
+        //Zero takes the budget from the device.
+        void SetBudget(u64 value);
+
+    private:
+        struct Retained
+        {
+            u64 Ticket;
+            ResidencyClass Class;
+            u64 Bytes;
+            function<void()> Evict;
+        };
+
+        Engine::RenderDevice* renderDevice;
+        mutable mutex mut;
+        array<u64, size_t(ResidencyClass::Count)> usage{};
+        u64 configured;
+        u64 budget = 0;
+        u64 retainedBytes = 0;
+        list<Retained> lru; //Least recently released first.
+        unordered_map<u64, list<Retained>::iterator> tickets;
+        u64 nextTicket = 1;
+
+        u64 UsageOfUnlocked() const;
+        void UpdateBudgetUnlocked();
+    };
+
+}
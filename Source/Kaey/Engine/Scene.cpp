@@ -13,6 +13,163 @@ namespace Kaey::Engine
         };
         
         const Vector4 DefaultAmbientColor = { 1, 1, 1, 0 };
+
+        //Objects a document loading on this thread has created, AddGameObject leaves them to be registered with it.
+        struct PendingObjects
+        {
+            Scene* Owner;
+            vector<unique_ptr<GameObject>> Objects;
+        };
+        thread_local PendingObjects* pendingObjects = nullptr;
+
+        shared_ptr<const json> LoadPrefab(Project* project, const fs::path& path)
+        {
+            if (project)
+                return project->FindOrLoadPrefab(path);
+            auto file = ReadFileBytes(path);
+            return make_shared<json>(json::parse(file.Bytes.begin(), file.Bytes.end()));
+        }
+
+        //Materials without a path are looked up in 'Materials' by the name the mesh gives them.
+        vector<fs::path> MaterialPathsOf(const MeshData& md, const optional<vector<string>>& materialPaths)
+        {
+            auto matPaths = md.Materials | vs::transform([](fs::path p) { return p; }) | to_vector;
+            if (materialPaths)
+            {
+                auto size = std::min(matPaths.size(), materialPaths->size());
+                for (size_t i = 0; i < size; ++i)
+                {
+                    auto& p = (*materialPaths)[i];
+                    if (!p.empty())
+                        matPaths[i] = p;
+                    else matPaths[i] = "Materials" / matPaths[i];
+                }
+            }
+            else
+            {
+                for (auto& matPath : matPaths)
+                {
+                    matPath = "Materials" / matPath;
+                    matPath.replace_extension(".json");
+                }
+            }
+            return matPaths;
+        }
+
+        //Loads what a scene references before its objects are created, so they find it cached.
+        //Prefabs add the meshes they reference, meshes add their materials, each as soon as it's known.
+        struct AssetPreloader
+        {
+            Engine::Project* Project;
+            Engine::RenderDevice* RenderDevice;
+            AssetGraph Graph;
+            mutex Mutex;
+            unordered_set<string> Seen;
+            vector<shared_ptr<const void>> Held; //Until the objects take them.
+
+            AssetPreloader(Scene* scene) : Project(scene->Project), RenderDevice(scene->RenderDevice)
+            {
+
+            }
+
+            void AddPrefab(fs::path path)
+            {
+                if (!FirstTime("P{}"_f(path.string())))
+                    return;
+                Graph.Add([=, this]
+                {
+                    auto j = LoadPrefab(Project, path);
+                    AddObject(*j);
+                    Hold(move(j));
+                });
+            }
+
+            void AddObject(const json& j)
+            {
+                auto type = j.find("Type");
+                if (type == j.end() || !type->is_string())
+                    return;
+                auto path = j.find("Path");
+                if (path != j.end() && path->is_string()) switch (chash(type->get<string>()))
+                {
+                case "Prefab"_h: return AddPrefab(path->get<string>());
+                case "Mesh"_h:
+                {
+                    optional<vector<string>> matPaths;
+                    if (auto mats = j.find("Materials"); mats != j.end() && mats->is_array())
+                    {
+                        auto& paths = matPaths.emplace();
+                        for (auto& jj : *mats)
+                            paths.emplace_back(jj.is_string() ? jj.get<string>() : string());
+                    }
+                    AddMesh(path->get<string>(), move(matPaths));
+                }break;
+                }
+                if (auto it = j.find("Children"); it != j.end() && it->is_array()) for (auto& e : *it)
+                {
+                    if (e.is_object())
+                        AddObject(e);
+                    else if (e.is_string())
+                        AddPrefab(e.get<string>());
+                }
+            }
+
+            void AddRecord(const SceneRecord& r)
+            {
+                if (r.Type == SceneObjectType::Prefab)
+                    AddPrefab(r.Path);
+                else if (r.Type == SceneObjectType::Mesh)
+                    AddMesh(r.Path, r.Materials);
+            }
+
+            void AddMesh(fs::path path, optional<vector<string>> materialPaths)
+            {
+                auto key = "M{}"_f(path.string());
+                if (materialPaths) for (auto& p : *materialPaths)
+                    key += "|{}"_f(p);
+                if (!FirstTime(move(key)))
+                    return;
+                Graph.Add([=, this]
+                {
+                    auto md = Project->FindOrCreateMeshData(path, RenderDevice, path);
+                    auto gp = RenderDevice->DiffusePipeline;
+                    for (auto& matPath : MaterialPathsOf(*md, materialPaths)) if (FirstTime("T{}"_f(matPath.string())))
+                        Graph.Add([=, this] { Hold(Project->FindOrCreateMaterial(matPath, Project, gp, matPath)); });
+                    Hold(move(md));
+                });
+            }
+
+            vector<shared_ptr<const void>> Run(std::atomic<f32>& progress)
+            {
+                //Loads found later grow the total, which would pull the ratio back.
+                Graph.SetProgressCallback([&](u32 done, u32 total) { progress = std::max(progress.load(), f32(done) / f32(total)); });
+                progress = 0;
+                try
+                {
+                    Graph.Run(Project->ThreadPool).get();
+                }
+                catch (...)
+                {
+                    progress = 1;
+                    throw;
+                }
+                progress = 1;
+                return move(Held);
+            }
+
+        private:
+            bool FirstTime(string key)
+            {
+                auto l = lock_guard(Mutex);
+                return Seen.emplace(move(key)).second;
+            }
+
+            void Hold(shared_ptr<const void> ptr)
+            {
+                auto l = lock_guard(Mutex);
+                Held.emplace_back(move(ptr));
+            }
+        };
     }
     
     Scene::Scene(Engine::RenderDevice* renderDevice) :
@@ -163,20 +320,21 @@ namespace Kaey::Engine
 
     void Scene::AddGameObject(unique_ptr<GameObject> go)
     {
+        if (pendingObjects && pendingObjects->Owner == this)
+        {
+            pendingObjects->Objects.emplace_back(move(go));
+            return;
+        }
         Register(go.get());
         Engine->SubmitSyncronized([ptr = go.release(), this] { gameObjectPtrs.emplace_back(ptr); });
     }
 
     void Scene::Load(const fs::path& path)
     {
-        json j;
-        {
-            ifstream f(path);
-            if (!f.is_open())
-                throw runtime_error("Failed to open file: {}"_f(path.string()));
-            f >> j;
-        }
-        Load(j);
+        auto file = project ? project->ReadFile(path) : ReadFileBytes(path);
+        if (IsSceneDocument(file.Bytes))
+            return Load(ReadSceneDocument(file.Bytes));
+        Load(json::parse(file.Bytes.begin(), file.Bytes.end()));
     }
 
     void Scene::Load(const json& j)
@@ -198,6 +356,15 @@ namespace Kaey::Engine
         if (it == j.end() || !it->is_array())
             return;
 
+        vector<shared_ptr<const void>> preloaded;
+        if (project)
+        {
+            AssetPreloader preloader(this);
+            for (auto& jj : *it)
+                preloader.AddObject(jj);
+            preloaded = preloader.Run(loadProgress);
+        }
+
         auto tasks = it->get<vector<json>>() | vs::transform([&](json& jj)
         {
             return RenderDevice->ThreadPool->Submit([=, this]
@@ -220,6 +387,12 @@ namespace Kaey::Engine
 
     void Scene::Save(const fs::path& path) const
     {
+        if (path.extension() != SceneJsonExtension)
+        {
+            SceneDocument doc;
+            Save(doc);
+            return SaveSceneDocument(path, doc);
+        }
         auto f = ofstream(path);
         if (!f.is_open())
             throw runtime_error("Failed to save file '{}'"_f(path.string()));
@@ -228,6 +401,94 @@ namespace Kaey::Engine
         f << j.dump(2);
     }
 
+    void Scene::Load(const SceneDocument& doc)
+    {
+        constexpr size_t ChunkSize = 256;
+
+        AmbientColor = doc.AmbientColor;
+        auto& records = doc.Records;
+
+        vector<shared_ptr<const void>> preloaded;
+        if (project)
+        {
+            AssetPreloader preloader(this);
+            for (auto& r : records)
+                preloader.AddRecord(r);
+            preloaded = preloader.Run(loadProgress);
+        }
+
+        vector<unique_ptr<GameObject>> objects(records.size());
+        ThreadPool->ParallelSubmit((records.size() + ChunkSize - 1) / ChunkSize, [&](size_t chunk)
+        {
+            for (auto i = chunk * ChunkSize; i < std::min((chunk + 1) * ChunkSize, records.size()); ++i)
+            {
+                auto& go = objects[i];
+                switch (records[i].Type)
+                {
+                case SceneObjectType::GameObject: go = make_unique<GameObject>(this); break;
+                case SceneObjectType::Mesh:       go = make_unique<MeshObject>(this); break;
+                case SceneObjectType::Light:      go = make_unique<LightObject>(this); break;
+                case SceneObjectType::Camera:     go = make_unique<CameraObject>(this); break;
+                case SceneObjectType::Prefab:     continue;
+                default: throw runtime_error("Invalid scene object type: {}"_f((int)records[i].Type));
+                }
+                go->Load(records[i]);
+            }
+        }).get();
+
+        //Parents come first, adding them in order keeps the order of the children.
+        //Prefabs go through AddGameObject, which leaves their objects in 'pending' with the rest.
+        auto pending = PendingObjects{ this };
+        pending.Objects.reserve(records.size());
+        auto previous = std::exchange(pendingObjects, &pending);
+        try
+        {
+            vector<GameObject*> added(records.size());
+            for (size_t i = 0; i < records.size(); ++i)
+            {
+                auto& r = records[i];
+                auto parent = r.Parent != SceneRecord::NoParent ? added[r.Parent] : nullptr;
+                if (r.Type == SceneObjectType::Prefab)
+                {
+                    added[i] = LoadGameObject(fs::path(r.Path), parent);
+                    continue;
+                }
+                added[i] = objects[i].get();
+                added[i]->Parent = parent;
+                pending.Objects.emplace_back(move(objects[i]));
+            }
+        }
+        catch (...)
+        {
+            pendingObjects = previous;
+            throw;
+        }
+        pendingObjects = previous;
+        //Registered once owned and all in one step, a dropped task doesn't leave dangling objects in the scene.
+        Engine->SubmitSyncronized([objects = move(pending.Objects), this] mutable
+        {
+            Register(objects);
+            gameObjectPtrs.insert(gameObjectPtrs.end(), std::make_move_iterator(objects.begin()), std::make_move_iterator(objects.end()));
+        });
+    }
+
+    void Scene::Save(SceneDocument& doc) const
+    {
+        doc.AmbientColor = AmbientColor;
+        doc.Records.clear();
+        auto add = [&](this auto& self, GameObject* go, u32 parent) -> void
+        {
+            auto index = (u32)doc.Records.size();
+            auto& r = doc.Records.emplace_back();
+            go->Save(r);
+            r.Parent = parent;
+            for (auto child : go->Children)
+                self(child, index);
+        };
+        for (auto go : gameObjects) if (!go->Parent)
+            add(go, SceneRecord::NoParent);
+    }
+
     GameObject* Scene::LoadGameObject(const json& j, GameObject* parent)
     {
         auto it = j.find("Type");
@@ -245,7 +506,7 @@ namespace Kaey::Engine
             it = j.find("Path");
             if (it == j.end())
                 throw runtime_error("Prefab doesn't contain a 'Path' key!");
-            return LoadGameObject(fs::path(it->get<string>()));
+            return LoadGameObject(fs::path(it->get<string>()), parent);
         }
         default: throw runtime_error("Invalid GameObject type: {}"_f(ty));
         }
@@ -258,14 +519,8 @@ namespace Kaey::Engine
 
     GameObject* Scene::LoadGameObject(const fs::path& path, GameObject* parent)
     {
-        json j;
-        {
-            ifstream f(path);
-            if (!f.is_open())
-                throw runtime_error("Failed to open file: {}"_f(path.string()));
-            f >> j;
-        }
-        return LoadGameObject(j, parent);
+        auto j = LoadPrefab(Project, path);
+        return LoadGameObject(*j, parent);
     }
 
     void Scene::Register(GameObject* value)
@@ -281,6 +536,21 @@ namespace Kaey::Engine
         );
     }
 
+    void Scene::Register(cspan<unique_ptr<GameObject>> values)
+    {
+        auto l = lock_guard(objectMutex);
+        gameObjects.reserve(gameObjects.size() + values.size());
+        for (auto& value : values)
+        {
+            gameObjects.emplace_back(value.get());
+            Dispatch(value.get(),
+                [this](CameraObject* cam) { cameraObjects.emplace_back(cam); },
+                [this](LightObject* light) { lightObjects.emplace_back(light); },
+                [this](MeshObject* mesh) { meshObjects.emplace_back(mesh); }
+            );
+        }
+    }
+
     void Scene::UnRegister(GameObject* value)
     {
         auto l = lock_guard(objectMutex);
@@ -418,15 +688,11 @@ namespace Kaey::Engine
     {
         if (auto it = j.find("Type"); it != j.end() && it->is_string() && it->get<string>() == "Prefab")
         {
-            json jj;
-            {
-                auto p = j["Path"].get<string>();
-                ifstream f(p);
-                if (!f.is_open())
-                    throw runtime_error("Failed to find file: {}"_f(p));
-                f >> jj;
-            }
-            return Load(jj);
+            auto it = j.find("Path");
+            if (it == j.end())
+                throw runtime_error("Prefab doesn't contain a 'Path' key!");
+            auto jj = LoadPrefab(Project, it->get<string>());
+            return Load(*jj);
         }
         if (auto it = j.find("Name"); it != j.end() && it->is_string())
         {
@@ -487,6 +753,26 @@ namespace Kaey::Engine
         return j;
     }
 
+    void GameObject::Load(const SceneRecord& r)
+    {
+        if (!r.Name.empty())
+            Name = r.Name;
+        position = r.Position;
+        rotation = r.Rotation;
+        scale = r.Scale;
+        OnTransformChange();
+    }
+
+    void GameObject::Save(SceneRecord& r) const
+    {
+        r.Type = SceneObjectType::GameObject;
+        if (Name != "{}"_f((void*)this))
+            r.Name = Name;
+        r.Position = Position;
+        r.Rotation = Rotation;
+        r.Scale = Scale;
+    }
+
     void GameObject::OnGui()
     {
         using namespace ImGui;
@@ -552,6 +838,19 @@ namespace Kaey::Engine
         j["Intensity"] = lightData.Color.w;
     }
 
+    void LightObject::Load(const SceneRecord& r)
+    {
+        GameObject::Load(r);
+        lightData.Color = r.Color;
+    }
+
+    void LightObject::Save(SceneRecord& r) const
+    {
+        GameObject::Save(r);
+        r.Type = SceneObjectType::Light;
+        r.Color = lightData.Color;
+    }
+
     CameraObject::CameraObject(Engine::Scene* scene) :
         ParentClass(scene),
         fov(60_deg), far(1000), near(.01f),
@@ -592,6 +891,25 @@ namespace Kaey::Engine
         j["CameraMode"] = CameraMode;
     }
 
+    void CameraObject::Load(const SceneRecord& r)
+    {
+        GameObject::Load(r);
+        Fov = r.Fov;
+        Far = r.Far;
+        Near = r.Near;
+        CameraMode = r.CameraMode;
+    }
+
+    void CameraObject::Save(SceneRecord& r) const
+    {
+        GameObject::Save(r);
+        r.Type = SceneObjectType::Camera;
+        r.Fov = Fov;
+        r.Far = Far;
+        r.Near = Near;
+        r.CameraMode = CameraMode;
+    }
+
     void CameraObject::OnGui()
     {
         GameObject::OnGui();
@@ -751,38 +1069,12 @@ namespace Kaey::Engine
         GameObject::OnTransformChange();
     }
 
-    void MeshObject::Load(const json& j)
+    void MeshObject::LoadMeshData(fs::path path, const optional<vector<string>>& materialPaths)
     {
-        auto it = j.find("Path");
-        if (it == j.end())
-            throw runtime_error("MeshObject doesn't contain a 'Path' key!");
-
-        auto path = (fs::path)it->get<string>();
         auto md = Project ?
             Project->FindOrCreateMeshData(path, RenderDevice, path) :
             make_shared<Engine::MeshData>(RenderDevice, move(path));
-        auto matPaths = md->Materials | vs::transform([](fs::path p) { return p; }) | to_vector;
-
-        if (it = j.find("Materials"); it != j.end() && it->is_array())
-        {
-            auto items = it->get<vector<json>>();
-            auto size = std::min(matPaths.size(), items.size());
-            for (size_t i = 0; i < size; ++i)
-            {
-                auto& jj = items[i];
-                if (jj.is_string())
-                    matPaths[i] = jj.get<string>();
-                else matPaths[i] = "Materials" / matPaths[i];
-            }
-        }
-        else
-        {
-            for (auto& matPath : matPaths)
-            {
-                matPath = "Materials" / matPath;
-                matPath.replace_extension(".json");
-            }
-        }
+        auto matPaths = MaterialPathsOf(*md, materialPaths);
 
         {
             auto obj = MeshObject(Scene, move(md), vector<shared_ptr<Engine::Material>>(matPaths.size()));
@@ -805,6 +1097,22 @@ namespace Kaey::Engine
         {
             Materials[i] = Project->FindOrCreateMaterial(matPaths[i], Scene->Project, gp, matPaths[i]);
         });
+    }
+
+    void MeshObject::Load(const json& j)
+    {
+        auto it = j.find("Path");
+        if (it == j.end())
+            throw runtime_error("MeshObject doesn't contain a 'Path' key!");
+
+        optional<vector<string>> matPaths;
+        if (auto mats = j.find("Materials"); mats != j.end() && mats->is_array())
+        {
+            auto& paths = matPaths.emplace();
+            for (auto& jj : *mats)
+                paths.emplace_back(jj.is_string() ? jj.get<string>() : string());
+        }
+        LoadMeshData(it->get<string>(), matPaths);
 
         if (it = j.find("LockShape"); it != j.end() && it->is_boolean())
             LockShape = it->get<bool>();
@@ -858,6 +1166,30 @@ namespace Kaey::Engine
 
     }
 
+    void MeshObject::Load(const SceneRecord& r)
+    {
+        LoadMeshData(r.Path, r.Materials);
+        LockShape = r.LockShape;
+        ShapeIndex = r.ShapeIndex;
+        for (auto& [name, value] : r.ShapeValues)
+        for (u32 i = 0; i < (u32)MeshData->ShapeNames.size(); ++i) if (MeshData->ShapeNames[i] == name)
+            ShapeValues[i - 1] = value;
+        GameObject::Load(r);
+    }
+
+    void MeshObject::Save(SceneRecord& r) const
+    {
+        GameObject::Save(r);
+        r.Type = SceneObjectType::Mesh;
+        r.Path = relative(Project->PathOf(MeshData.get())).string();
+        r.LockShape = LockShape;
+        r.ShapeIndex = ShapeIndex;
+        for (u32 i = 0; i + 1 < MeshData->ShapeCount; ++i) if (ShapeValues[i] != 0)
+            r.ShapeValues.emplace_back(MeshData->ShapeNames[i + 1], ShapeValues[i]);
+        if (!materials.empty())
+            r.Materials = materials | vs::transform([this](auto& mat) { return relative(Project->PathOf(mat.get())).string(); }) | to_vector;
+    }
+
     void MeshObject::OnGui()
     {
         using namespace ImGui;
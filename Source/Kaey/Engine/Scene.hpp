@@ -1,14 +1,9 @@
 #pragma once
-#include "Utils.hpp"
+#include "AssetGraph.hpp"
+#include "SceneFile.hpp"
 
 namespace Kaey::Engine
 {
-    enum class CameraMode
-    {
-        Perspective,
-        Orthographic
-    };
-
     struct Scene
     {
         Scene(Engine::RenderDevice* renderDevice);
@@ -45,11 +40,18 @@ namespace Kaey::Engine
 
         void Save(const fs::path& path) const;
 
+        //Creates and loads the objects in bulk on the thread pool, this is the binary format's path.
+        void Load(const SceneDocument& doc);
+
+        void Save(SceneDocument& doc) const;
+
         GameObject* LoadGameObject(const json& j, GameObject* parent = nullptr);
 
         GameObject* LoadGameObject(const fs::path& path, GameObject* parent = nullptr);
 
         void Register(GameObject* value);
+        //Takes a lock once and appends them all, for scenes loaded in bulk.
+        void Register(cspan<unique_ptr<GameObject>> values);
         void UnRegister(GameObject* value);
 
         KAEY_ENGINE_GETTER(Engine::RenderDevice*, RenderDevice) { return renderDevice; }
@@ -66,6 +68,8 @@ namespace Kaey::Engine
         KAEY_ENGINE_GETTER(cspan<LightObject*>, Lights) { return lightObjects; }
         KAEY_ENGINE_GETTER(cspan<CameraObject*>, Cameras) { return cameraObjects; }
         KAEY_ENGINE_GETTER(GameObject*, ActiveObject) { return activeObject; }
+        //Share of the assets referenced by the scene being loaded that are ready, 1 when nothing is loading.
+        KAEY_ENGINE_GETTER(f32, LoadProgress) { return loadProgress; }
 
     private:
         Engine::RenderDevice* renderDevice;
@@ -81,6 +85,8 @@ namespace Kaey::Engine
 
         mutex objectMutex;
 
+        std::atomic<f32> loadProgress = 1;
+
         //ImGui
         GameObject* activeObject = nullptr;
     };
@@ -123,6 +129,10 @@ namespace Kaey::Engine
 
         json Save() const;
 
+        //Children aren't part of the record, the scene sets the parents.
+        virtual void Load(const SceneRecord& r);
+        virtual void Save(SceneRecord& r) const;
+
         virtual void OnGui();
 
         KAEY_ENGINE_GETTER(Engine::Scene*, Scene) { return scene; }
@@ -172,6 +182,8 @@ namespace Kaey::Engine
 
         void Load(const json& j) override;
         void Save(json& j) const override;
+        void Load(const SceneRecord& r) override;
+        void Save(SceneRecord& r) const override;
 
         Vector4 GetColor() const { return lightData.Color; }
         void SetColor(Vector4 color) { lightData.Color = color; }
@@ -192,6 +204,8 @@ namespace Kaey::Engine
         void OnTransformChange() override;
         void Load(const json& j) override;
         void Save(json& j) const override;
+        void Load(const SceneRecord& r) override;
+        void Save(SceneRecord& r) const override;
         void OnGui() override;
 
         float GetFov() const { return fov; }
@@ -289,6 +303,8 @@ namespace Kaey::Engine
         void OnTransformChange() override;
         void Load(const json& j) override;
         void Save(json& j) const override;
+        void Load(const SceneRecord& r) override;
+        void Save(SceneRecord& r) const override;
         void OnGui() override;
 
         void Update();
@@ -325,6 +341,9 @@ namespace Kaey::Engine
         KAEY_ENGINE_GETTER(u32, UvIndex) { return uvIndex; }
 
     private:
+        //Materials without a path are looked up in 'Materials' by the name the mesh gives them.
+        void LoadMeshData(fs::path path, const optional<vector<string>>& materialPaths);
+
         shared_ptr<Engine::MeshData> meshData;
         unique_ptr<DefinedMemoryBuffer<Vertex>> vertexBuffer;
         unique_ptr<DefinedMemoryBuffer<float>> shapeDeltasBuffer;
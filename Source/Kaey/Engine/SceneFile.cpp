@@ -0,0 +1,422 @@
+#include "SceneFile.hpp"
+
+namespace Kaey::Engine
+{
+    namespace
+    {
+        constexpr u32 SceneMagic   = 0x4E43534B; //"KSCN"
+        constexpr u32 SceneVersion = 1;
+
+        struct BinaryWriter
+        {
+            vector<u8> Bytes;
+
+            template<class T> requires std::is_trivially_copyable_v<T>
+            void Write(const T& value)
+            {
+                auto ptr = (const u8*)&value;
+                Bytes.insert(Bytes.end(), ptr, ptr + sizeof(T));
+            }
+
+            void Write(string_view value)
+            {
+                Write((u32)value.size());
+                Bytes.insert(Bytes.end(), value.begin(), value.end());
+            }
+        };
+
+        struct BinaryReader
+        {
+            cspan<u8> Bytes;
+
+            cspan<u8> Take(size_t size)
+            {
+                if (size > Bytes.size())
+                    throw runtime_error("Unexpected end of scene file!");
+                auto result = Bytes.first(size);
+                Bytes = Bytes.subspan(size);
+                return result;
+            }
+
+            template<class T> requires std::is_trivially_copyable_v<T>
+            T Read()
+            {
+                T value;
+                std::memcpy(&value, Take(sizeof(T)).data(), sizeof(T));
+                return value;
+            }
+
+            string ReadString()
+            {
+                auto bytes = Take(Read<u32>());
+                return { (const char*)bytes.data(), bytes.size() };
+            }
+
+            //Count of elements taking at least 'minSize' bytes each, checked against what's left before anything is allocated for them.
+            u32 ReadCount(size_t minSize)
+            {
+                auto count = Read<u32>();
+                if (count > Bytes.size() / minSize)
+                    throw runtime_error("Unexpected end of scene file!");
+                return count;
+            }
+        };
+
+        SceneObjectType TypeOf(const json& j)
+        {
+            auto it = j.find("Type");
+            if (it == j.end())
+                throw runtime_error("Prefab doesn't contain a 'Type' key!");
+            switch (auto ty = it->get<string>(); chash(ty))
+            {
+            case "GameObject"_h:  return SceneObjectType::GameObject;
+            case "Mesh"_h:        return SceneObjectType::Mesh;
+            case "LightObject"_h: return SceneObjectType::Light;
+            case "Camera"_h:      return SceneObjectType::Camera;
+            case "Prefab"_h:      return SceneObjectType::Prefab;
+            default: throw runtime_error("Invalid GameObject type: {}"_f(ty));
+            }
+        }
+
+        //Same keys the Load(const json&) of each object reads.
+        void AddRecords(SceneDocument& doc, const json& j, u32 parent)
+        {
+            auto index = (u32)doc.Records.size();
+            auto& r = doc.Records.emplace_back();
+            r.Parent = parent;
+            if (j.is_string())
+            {
+                r.Type = SceneObjectType::Prefab;
+                r.Path = j.get<string>();
+                return;
+            }
+            r.Type = TypeOf(j);
+            if (r.Type == SceneObjectType::Prefab)
+            {
+                auto it = j.find("Path");
+                if (it == j.end())
+                    throw runtime_error("Prefab doesn't contain a 'Path' key!");
+                r.Path = it->get<string>();
+                return;
+            }
+            if (auto it = j.find("Name"); it != j.end() && it->is_string())
+                r.Name = it->get<string>();
+            if (auto it = j.find("Position"); it != j.end() && it->is_array())
+            {
+                auto v = it->get<vector<float>>();
+                r.Position = { v[0], v[1], v[2] };
+            }
+            if (auto it = j.find("Rotation"); it != j.end() && it->is_array())
+            {
+                auto v = it->get<vector<float>>();
+                r.Rotation = { v[0], v[1], v[2], v[3] };
+            }
+            if (auto it = j.find("Scale"); it != j.end() && it->is_array())
+            {
+                auto v = it->get<vector<float>>();
+                r.Scale = { v[0], v[1], v[2] };
+            }
+            switch (r.Type)
+            {
+            case SceneObjectType::Light:
+            {
+                if (auto it = j.find("Color"); it != j.end() && it->is_array())
+                {
+                    auto v = it->get<vector<float>>();
+                    for (size_t i = 0; i < std::min<size_t>(v.size(), 3); ++i)
+                        r.Color[i] = v[i];
+                }
+                if (auto it = j.find("Intensity"); it != j.end() && it->is_number())
+                    r.Color.w = it->get<float>();
+            }break;
+            case SceneObjectType::Camera:
+            {
+                if (auto it = j.find("Fov"); it != j.end() && it->is_number_float())
+                    r.Fov = it->get<float>();
+                if (auto it = j.find("Far"); it != j.end() && it->is_number_float())
+                    r.Far = it->get<float>();
+                if (auto it = j.find("Near"); it != j.end() && it->is_number_float())
+                    r.Near = it->get<float>();
+                if (auto it = j.find("CameraMode"); it != j.end())
+                    r.CameraMode = it->get<CameraMode>();
+            }break;
+            case SceneObjectType::Mesh:
+            {
+                auto it = j.find("Path");
+                if (it == j.end())
+                    throw runtime_error("MeshObject doesn't contain a 'Path' key!");
+                r.Path = it->get<string>();
+                if (it = j.find("Materials"); it != j.end() && it->is_array())
+                {
+                    auto& mats = r.Materials.emplace();
+                    for (auto& jj : *it)
+                        mats.emplace_back(jj.is_string() ? jj.get<string>() : string());
+                }
+                if (it = j.find("LockShape"); it != j.end() && it->is_boolean())
+                    r.LockShape = it->get<bool>();
+                if (it = j.find("ShapeIndex"); it != j.end() && it->is_number_integer())
+                    r.ShapeIndex = it->get<u32>();
+                if (it = j.find("Shape Values"); it != j.end())
+                    for (auto& [name, value] : it->get<unordered_map<string, float>>())
+                        r.ShapeValues.emplace_back(name, value);
+            }break;
+            default: break;
+            }
+            if (auto it = j.find("Children"); it != j.end() && it->is_array())
+                for (auto& child : *it)
+                    AddRecords(doc, child, index);
+        }
+
+        //Same keys the Save(json&) of each object writes.
+        json JsonOf(const SceneRecord& r)
+        {
+            json j;
+            switch (r.Type)
+            {
+            case SceneObjectType::GameObject: j["Type"] = "GameObject";  break;
+            case SceneObjectType::Light:      j["Type"] = "LightObject"; break;
+            case SceneObjectType::Camera:     j["Type"] = "Camera";      break;
+            case SceneObjectType::Mesh:       j["Type"] = "Mesh";        break;
+            case SceneObjectType::Prefab:
+                j["Type"] = "Prefab";
+                j["Path"] = r.Path;
+                return j;
+            default: throw runtime_error("Invalid scene object type: {}"_f((int)r.Type));
+            }
+            if (!r.Name.empty())
+                j["Name"] = r.Name;
+            if (r.Position != Vector3::Zero)
+                j["Position"] = r.Position | to_vector;
+            if (r.Rotation != Quaternion::Identity)
+                j["Rotation"] = r.Rotation | to_vector;
+            if (r.Scale != Vector3::One)
+                j["Scale"] = r.Scale | to_vector;
+            switch (r.Type)
+            {
+            case SceneObjectType::Light:
+                j["Color"] = r.Color.xyz | to_vector;
+                j["Intensity"] = r.Color.w;
+                break;
+            case SceneObjectType::Camera:
+                j["Fov"] = r.Fov;
+                j["Far"] = r.Far;
+                j["Near"] = r.Near;
+                j["CameraMode"] = r.CameraMode;
+                break;
+            case SceneObjectType::Mesh:
+                j["Path"] = r.Path;
+                if (r.LockShape)
+                    j["LockShape"] = true;
+                if (r.ShapeIndex != 0)
+                    j["ShapeIndex"] = r.ShapeIndex;
+                if (!r.ShapeValues.empty())
+                    j["Shape Values"] = unordered_map<string, float>(r.ShapeValues.begin(), r.ShapeValues.end());
+                if (r.Materials)
+                    j["Materials"] = *r.Materials;
+                break;
+            default: break;
+            }
+            return j;
+        }
+
+    }
+
+    SceneDocument SceneDocumentFromJson(const json& j)
+    {
+        auto it = j.find("Type");
+        if (it == j.end())
+            throw runtime_error("Asset type unspecified, Expected 'Scene'!");
+        if (it->get<string>() != "Scene")
+            throw runtime_error("Asset type is not 'Scene'!");
+        SceneDocument doc;
+        if (it = j.find("AmbientColor"); it != j.end() && it->is_array())
+        {
+            auto v = it->get<vector<float>>();
+            doc.AmbientColor = { v[0], v[1], v[2], v[3] };
+        }
+        if (it = j.find("Children"); it != j.end() && it->is_array())
+            for (auto& child : *it)
+                AddRecords(doc, child, SceneRecord::NoParent);
+        return doc;
+    }
+
+    json SceneDocumentToJson(const SceneDocument& doc)
+    {
+        json j;
+        j["Type"] = "Scene";
+        if (doc.AmbientColor != Vector4{ 1, 1, 1, 0 })
+            j["AmbientColor"] = doc.AmbientColor | to_vector;
+        auto& records = doc.Records;
+        vector<vector<u32>> children(records.size());
+        vector<u32> roots;
+        for (auto i : irange((u32)records.size()))
+        {
+            auto parent = records[i].Parent;
+            if (parent != SceneRecord::NoParent && parent >= i)
+                throw runtime_error("Scene object {} comes before its parent!"_f(i));
+            (parent != SceneRecord::NoParent ? children[parent] : roots).emplace_back(i);
+        }
+        //Children come after their parents, so going backwards every child is complete when its parent is.
+        auto objects = records | vs::transform(JsonOf) | to_vector;
+        for (auto i = records.size(); i-- > 0;)
+            if (!children[i].empty())
+                objects[i]["Children"] = children[i] | vs::transform([&](u32 c) { return move(objects[c]); }) | to_vector;
+        j["Children"] = roots | vs::transform([&](u32 c) { return move(objects[c]); }) | to_vector;
+        return j;
+    }
+
+    bool IsSceneDocument(cspan<u8> bytes)
+    {
+        u32 magic;
+        if (bytes.size() < sizeof magic)
+            return false;
+        std::memcpy(&magic, bytes.data(), sizeof magic);
+        return magic == SceneMagic;
+    }
+
+    SceneDocument ReadSceneDocument(cspan<u8> bytes)
+    {
+        auto r = BinaryReader{ bytes };
+        if (r.Read<u32>() != SceneMagic)
+            throw runtime_error("Not a binary scene file!");
+        if (auto version = r.Read<u32>(); version != SceneVersion)
+            throw runtime_error("Unsupported scene file version: {}"_f(version));
+        SceneDocument doc;
+        doc.AmbientColor = r.Read<Vector4>();
+        //Type, parent and the length of a name or path.
+        doc.Records.resize(r.ReadCount(sizeof(SceneObjectType) + sizeof(u32) * 2));
+        for (u32 i = 0; auto& rec : doc.Records)
+        {
+            rec.Type     = r.Read<SceneObjectType>();
+            rec.Parent   = r.Read<u32>();
+            if (rec.Parent != SceneRecord::NoParent && rec.Parent >= i)
+                throw runtime_error("Scene object {} comes before its parent!"_f(i));
+            ++i;
+            if (rec.Type == SceneObjectType::Prefab)
+            {
+                rec.Path = r.ReadString();
+                continue;
+            }
+            rec.Name     = r.ReadString();
+            rec.Position = r.Read<Vector3>();
+            rec.Rotation = r.Read<Quaternion>();
+            rec.Scale    = r.Read<Vector3>();
+            switch (rec.Type)
+            {
+            case SceneObjectType::GameObject: break;
+            case SceneObjectType::Light:
+                rec.Color = r.Read<Vector4>();
+                break;
+            case SceneObjectType::Camera:
+                rec.Fov        = r.Read<f32>();
+                rec.Far        = r.Read<f32>();
+                rec.Near       = r.Read<f32>();
+                rec.CameraMode = (CameraMode)r.Read<u32>();
+                break;
+            case SceneObjectType::Mesh:
+            {
+                rec.Path       = r.ReadString();
+                rec.LockShape  = r.Read<u8>() != 0;
+                rec.ShapeIndex = r.Read<u32>();
+                rec.ShapeValues.resize(r.ReadCount(sizeof(u32) + sizeof(f32)));
+                for (auto& [name, value] : rec.ShapeValues)
+                {
+                    name = r.ReadString();
+                    value = r.Read<f32>();
+                }
+                //Count is one more than the materials, zero when the json had none.
+                //Grown as they are read, so a bad count runs out of bytes instead of allocating for it.
+                if (auto count = r.Read<u32>(); count > 0)
+                {
+                    auto& materials = rec.Materials.emplace();
+                    for (u32 k = 1; k < count; ++k)
+                        materials.emplace_back(r.ReadString());
+                }
+            }break;
+            default: throw runtime_error("Invalid scene object type: {}"_f((int)rec.Type));
+            }
+        }
+        return doc;
+    }
+
+    vector<u8> WriteSceneDocument(const SceneDocument& doc)
+    {
+        BinaryWriter w;
+        w.Write(SceneMagic);
+        w.Write(SceneVersion);
+        w.Write(doc.AmbientColor);
+        w.Write((u32)doc.Records.size());
+        for (auto& rec : doc.Records)
+        {
+            w.Write(rec.Type);
+            w.Write(rec.Parent);
+            if (rec.Type == SceneObjectType::Prefab)
+            {
+                w.Write(string_view(rec.Path));
+                continue;
+            }
+            w.Write(string_view(rec.Name));
+            w.Write(rec.Position);
+            w.Write(rec.Rotation);
+            w.Write(rec.Scale);
+            switch (rec.Type)
+            {
+            case SceneObjectType::Light:
+                w.Write(rec.Color);
+                break;
+            case SceneObjectType::Camera:
+                w.Write(rec.Fov);
+                w.Write(rec.Far);
+                w.Write(rec.Near);
+                w.Write((u32)rec.CameraMode);
+                break;
+            case SceneObjectType::Mesh:
+                w.Write(string_view(rec.Path));
+                w.Write((u8)rec.LockShape);
+                w.Write(rec.ShapeIndex);
+                w.Write((u32)rec.ShapeValues.size());
+                for (auto& [name, value] : rec.ShapeValues)
+                {
+                    w.Write(string_view(name));
+                    w.Write(value);
+                }
+                w.Write(rec.Materials ? (u32)rec.Materials->size() + 1 : 0u);
+                if (rec.Materials)
+                    for (auto& mat : *rec.Materials)
+                        w.Write(string_view(mat));
+                break;
+            default: break;
+            }
+        }
+        return move(w.Bytes);
+    }
+
+    SceneDocument LoadSceneDocument(const fs::path& path)
+    {
+        ifstream f(path, std::ios::binary | std::ios::ate);
+        if (!f.is_open())
+            throw runtime_error("Failed to open file: {}"_f(path.string()));
+        vector<u8> bytes(f.tellg());
+        f.seekg(0);
+        f.read((char*)bytes.data(), (streamsize)bytes.size());
+        if (IsSceneDocument(bytes))
+            return ReadSceneDocument(bytes);
+        return SceneDocumentFromJson(json::parse(bytes.begin(), bytes.end()));
+    }
+
+    void SaveSceneDocument(const fs::path& path, const SceneDocument& doc)
+    {
+        auto isJson = path.extension() == SceneJsonExtension;
+        auto f = ofstream(path, isJson ? std::ios::out : std::ios::out | std::ios::binary);
+        if (!f.is_open())
+            throw runtime_error("Failed to save file '{}'"_f(path.string()));
+        if (isJson)
+        {
+            f << SceneDocumentToJson(doc).dump(2);
+            return;
+        }
+        auto bytes = WriteSceneDocument(doc);
+        f.write((const char*)bytes.data(), (streamsize)bytes.size());
+    }
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "Utils.hpp"
+
+namespace Kaey::Engine
+{
+    enum class CameraMode
+    {
+        Perspective,
+        Orthographic
+    };
+
+    enum class SceneObjectType : u8
+    {
+        GameObject,
+        Light,
+        Camera,
+        Mesh,
+        Prefab,
+    };
+
+    //What the json of a scene object holds, without its children. Only the fields of its Type are used.
+    struct SceneRecord
+    {
+        static constexpr u32 NoParent = u32(-1);
+
+        SceneObjectType Type = SceneObjectType::GameObject;
+        u32 Parent = NoParent; //Index of the parent's record, which always comes before.
+        string Name;           //Empty keeps the default name.
+        Vector3 Position = Vector3::Zero;
+        Quaternion Rotation = Quaternion::Identity;
+        Vector3 Scale = Vector3::One;
+
+        //LightObject, w is the intensity.
+        Vector4 Color = { 1, 1, 1, 1 };
+
+        //CameraObject
+        f32 Fov = 60_deg;
+        f32 Far = 1000;
+        f32 Near = .01f;
+        Engine::CameraMode CameraMode = Engine::CameraMode::Perspective;
+
+        //MeshObject, or the file of a Prefab.
+        string Path;
+        optional<vector<string>> Materials; //Empty paths use the mesh's own material.
+        bool LockShape = false;
+        u32 ShapeIndex = 0;
+        vector<pair<string, f32>> ShapeValues;
+    };
+
+    //Scene as a flat list of objects, parents first, so it can be created in bulk.
+    struct SceneDocument
+    {
+        Vector4 AmbientColor = { 1, 1, 1, 0 };
+        vector<SceneRecord> Records;
+    };
+
+    //Json is kept for authoring, anything else is written as the binary encoding.
+    //Either is read whatever the extension, the binary encoding is told apart by its magic.
+    constexpr string_view SceneJsonExtension = ".json";
+
+    SceneDocument SceneDocumentFromJson(const json& j);
+    json SceneDocumentToJson(const SceneDocument& doc);
+
+    bool IsSceneDocument(cspan<u8> bytes);
+    SceneDocument ReadSceneDocument(cspan<u8> bytes);
+    vector<u8> WriteSceneDocument(const SceneDocument& doc);
+
+    SceneDocument LoadSceneDocument(const fs::path& path);
+    void SaveSceneDocument(const fs::path& path, const SceneDocument& doc);
+
+}
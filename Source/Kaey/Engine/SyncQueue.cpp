@@ -0,0 +1,136 @@
+#include "SyncQueue.hpp"
+
+namespace Kaey::Engine
+{
+    namespace
+    {
+        //The free list head with its index replaced and its tag bumped.
+        u64 Bump(u64 head, u32 index)
+        {
+            return ((head >> 32) + 1) << 32 | index;
+        }
+    }
+
+    SyncQueue::~SyncQueue()
+    {
+        //Whatever never ran is destroyed with the queue.
+        Take();
+        for (auto& chunk : chunks)
+            delete[] chunk.load();
+    }
+
+    void SyncQueue::Push(Batch batch)
+    {
+        if (batch.first == Nil)
+            return;
+        PushChain(batch.first, batch.last);
+        batch.first = batch.last = Nil;
+        batch.count = 0;
+    }
+
+    SyncQueue::Batch SyncQueue::Take()
+    {
+        Batch batch(this);
+        batch.first = pending.exchange(Nil, std::memory_order_acquire);
+        for (auto i = batch.first; i != Nil; i = NodeAt(i).Next.load(std::memory_order_relaxed))
+        {
+            batch.last = i;
+            ++batch.count;
+        }
+        return batch;
+    }
+
+    void SyncQueue::Run(Batch batch)
+    {
+        if (batch.first == Nil)
+            return;
+        //Linked newest first, turned around so they run in the order they were pushed.
+        auto prev = Nil;
+        for (auto i = batch.first;;)
+        {
+            auto& node = NodeAt(i);
+            auto next = node.Next.load(std::memory_order_relaxed);
+            node.Next.store(prev, std::memory_order_relaxed);
+            prev = i;
+            if (i == batch.last)
+                break;
+            i = next;
+        }
+        std::swap(batch.first, batch.last);
+        for (auto i = batch.first;; i = NodeAt(i).Next.load(std::memory_order_relaxed))
+        {
+            auto& task = NodeAt(i).Task;
+            task();
+            task.Reset();
+            if (i == batch.last)
+                break;
+        }
+    }
+
+    u32 SyncQueue::Allocate()
+    {
+        auto head = freeList.load(std::memory_order_acquire);
+        for (;;)
+        {
+            if (u32(head) == Nil)
+            {
+                Grow();
+                head = freeList.load(std::memory_order_acquire);
+                continue;
+            }
+            //May be stale if another thread took the node meanwhile, the tag makes the exchange fail then.
+            auto next = NodeAt(u32(head)).Next.load(std::memory_order_relaxed);
+            if (freeList.compare_exchange_weak(head, Bump(head, next), std::memory_order_acquire, std::memory_order_acquire))
+                return u32(head);
+        }
+    }
+
+    void SyncQueue::Free(u32 first, u32 last)
+    {
+        auto head = freeList.load(std::memory_order_relaxed);
+        do NodeAt(last).Next.store(u32(head), std::memory_order_relaxed);
+        while (!freeList.compare_exchange_weak(head, Bump(head, first), std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    void SyncQueue::Grow()
+    {
+        lock_guard l(growMutex);
+        //Another thread grew it or nodes were freed while waiting.
+        if (u32(freeList.load(std::memory_order_acquire)) != Nil)
+            return;
+        if (chunkCount == MaxChunks)
+            throw runtime_error("Too many synchronized tasks pending!");
+        auto k = chunkCount;
+        auto size = FirstChunkSize << k;
+        auto base = FirstChunkSize * ((1u << k) - 1);
+        auto chunk = new Node[size];
+        for (u32 i = 0; i + 1 < size; ++i)
+            chunk[i].Next.store(base + i + 1, std::memory_order_relaxed);
+        chunks[k].store(chunk, std::memory_order_release);
+        ++chunkCount;
+        Free(base, base + size - 1);
+    }
+
+    void SyncQueue::PushChain(u32 first, u32 last)
+    {
+        auto head = pending.load(std::memory_order_relaxed);
+        do NodeAt(last).Next.store(head, std::memory_order_relaxed);
+        while (!pending.compare_exchange_weak(head, first, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    void SyncQueue::Discard(Batch& batch)
+    {
+        if (batch.first == Nil)
+            return;
+        for (auto i = batch.first;; i = NodeAt(i).Next.load(std::memory_order_relaxed))
+        {
+            NodeAt(i).Task.Reset();
+            if (i == batch.last)
+                break;
+        }
+        Free(batch.first, batch.last);
+        batch.first = batch.last = Nil;
+        batch.count = 0;
+    }
+
+}
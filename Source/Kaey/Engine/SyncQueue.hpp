@@ -0,0 +1,215 @@
+#pragma once
+#include "Utils.hpp"
+
+namespace Kaey::Engine
+{
+    //Move-only void() callable, captures of up to InlineSize bytes are stored in place instead of on the heap.
+    struct SyncTask
+    {
+        static constexpr size_t InlineSize = 64;
+
+        SyncTask() = default;
+
+        //Not for SyncTask itself, a non-const lvalue would otherwise be wrapped instead of hitting the deleted copy.
+        template<class Fn> requires (std::invocable<std::decay_t<Fn>&> && !std::same_as<std::decay_t<Fn>, SyncTask>)
+        SyncTask(Fn&& fn) : ops(&OpsOf<std::decay_t<Fn>>)
+        {
+            using F = std::decay_t<Fn>;
+            if constexpr (IsInline<F>)
+                new (storage) F(forward<Fn>(fn));
+            else new (storage) F*(new F(forward<Fn>(fn)));
+        }
+
+        SyncTask(const SyncTask&) = delete;
+        SyncTask(SyncTask&& other) noexcept : ops(other.ops)
+        {
+            if (ops)
+                ops->Relocate(storage, other.storage);
+            other.ops = nullptr;
+        }
+
+        SyncTask& operator=(const SyncTask&) = delete;
+        SyncTask& operator=(SyncTask&& other) noexcept
+        {
+            if (this != &other)
+            {
+                Reset();
+                if ((ops = other.ops))
+                    ops->Relocate(storage, other.storage);
+                other.ops = nullptr;
+            }
+            return *this;
+        }
+
+        ~SyncTask() { Reset(); }
+
+        void operator()() { ops->Invoke(storage); }
+
+        void Reset()
+        {
+            if (ops)
+                ops->Destroy(storage);
+            ops = nullptr;
+        }
+
+        explicit operator bool() const { return ops != nullptr; }
+
+    private:
+        struct Ops
+        {
+            void(*Invoke)(void*);
+            void(*Relocate)(void*, void*); //Moves into uninitialized storage and destroys the source.
+            void(*Destroy)(void*);
+        };
+
+        template<class F>
+        static constexpr bool IsInline = sizeof(F) <= InlineSize && alignof(F) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<F>;
+
+        template<class F>
+        static F& Get(void* storage)
+        {
+            if constexpr (IsInline<F>)
+                return *std::launder((F*)storage);
+            else return **std::launder((F**)storage);
+        }
+
+        template<class F>
+        static constexpr Ops OpsOf
+        {
+            [](void* s) { Get<F>(s)(); },
+            [](void* dst, void* src)
+            {
+                if constexpr (IsInline<F>)
+                {
+                    new (dst) F(move(Get<F>(src)));
+                    Get<F>(src).~F();
+                }
+                else new (dst) F*(*std::launder((F**)src));
+            },
+            [](void* s)
+            {
+                if constexpr (IsInline<F>)
+                    Get<F>(s).~F();
+                else delete &Get<F>(s);
+            },
+        };
+
+        alignas(std::max_align_t) std::byte storage[InlineSize];
+        const Ops* ops = nullptr;
+    };
+
+    //Tasks pushed from any thread without taking a lock, run by a single consumer in the order each thread pushed them.
+    //Nodes are recycled through a free list, once it has grown to the busiest frame pushing doesn't allocate.
+    struct SyncQueue
+    {
+        //Tasks pushed together with a single atomic operation, for loaders that publish many results at once.
+        //Tasks of a batch dropped without being pushed are destroyed without running.
+        struct Batch
+        {
+            explicit Batch(SyncQueue* queue) : queue(queue) {}
+
+            Batch(const Batch&) = delete;
+            Batch(Batch&& other) noexcept : queue(other.queue), first(std::exchange(other.first, Nil)), last(std::exchange(other.last, Nil)), count(std::exchange(other.count, 0)) {}
+
+            Batch& operator=(const Batch&) = delete;
+            Batch& operator=(Batch&&) = delete;
+
+            ~Batch() { queue->Discard(*this); }
+
+            template<class Fn>
+            void Add(Fn&& fn)
+            {
+                auto index = queue->NewNode(forward<Fn>(fn));
+                queue->NodeAt(index).Next.store(first, std::memory_order_relaxed);
+                first = index;
+                if (last == Nil)
+                    last = index;
+                ++count;
+            }
+
+            KAEY_ENGINE_GETTER(u32, Count) { return count; }
+
+        private:
+            friend SyncQueue;
+
+            SyncQueue* queue;
+            u32 first = Nil; //Newest, every node links to the one added before it.
+            u32 last = Nil;
+            u32 count = 0;
+        };
+
+        SyncQueue() = default;
+
+        SyncQueue(const SyncQueue&) = delete;
+        SyncQueue(SyncQueue&&) = delete;
+
+        SyncQueue& operator=(const SyncQueue&) = delete;
+        SyncQueue& operator=(SyncQueue&&) = delete;
+
+        ~SyncQueue();
+
+        template<class Fn> requires std::invocable<std::decay_t<Fn>&>
+        void Push(Fn&& fn)
+        {
+            auto index = NewNode(forward<Fn>(fn));
+            PushChain(index, index);
+        }
+
+        void Push(Batch batch);
+
+        //Everything pushed so far, tasks pushed after it are left for the next call.
+        Batch Take();
+        //Runs the tasks oldest first on the calling thread, they may push more.
+        //If one throws the rest are destroyed without running and the exception is rethrown.
+        void Run(Batch batch);
+
+    private:
+        static constexpr u32 Nil = u32(-1);
+        static constexpr u32 FirstChunkSize = 64;
+        static constexpr size_t MaxChunks = 24;
+
+        struct Node
+        {
+            std::atomic<u32> Next;
+            SyncTask Task;
+        };
+
+        //Chunk k holds FirstChunkSize << k nodes and is never moved, so indices stay valid while more are added.
+        array<std::atomic<Node*>, MaxChunks> chunks{};
+        u32 chunkCount = 0;
+        mutex growMutex;
+        std::atomic<u32> pending = Nil;
+        //Index in the low half, bumped on every change in the high half so a stale pop can't succeed.
+        std::atomic<u64> freeList = Nil;
+
+        Node& NodeAt(u32 index) const
+        {
+            auto biased = u64(index) + FirstChunkSize;
+            auto k = std::bit_width(biased) - std::bit_width(FirstChunkSize);
+            return chunks[k].load(std::memory_order_acquire)[biased - (u64(FirstChunkSize) << k)];
+        }
+
+        template<class Fn>
+        u32 NewNode(Fn&& fn)
+        {
+            auto index = Allocate();
+            try
+            {
+                NodeAt(index).Task = SyncTask(forward<Fn>(fn));
+            }
+            catch (...)
+            {
+                Free(index, index);
+                throw;
+            }
+            return index;
+        }
+
+        u32 Allocate();
+        void Free(u32 first, u32 last);
+        void Grow();
+        void PushChain(u32 first, u32 last);
+        void Discard(Batch& batch);
+    };
+
+}